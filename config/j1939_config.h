@@ -21,16 +21,86 @@ extern "C"{
 
 #include <stdint.h>
 
+/* the TWAI driver on ESP-IDF, elsewhere the in-process virtual bus unless the build picked another
+ * port, e.g. cmake -DJ1939_SHM=ON */
+#if !defined J1939_SHM && !defined J1939_MOCK && !defined ESP_PLATFORM
 #define J1939_MOCK 1
+#endif
 
 #if defined J1939_MOCK
 #define J1939_PORT_VIRTUAL
+#elif defined J1939_SHM
+/* inter-process virtual bus, see src/j1939_shm.h */
+#define J1939_PORT_SHM
 #elif defined ESP_PLATFORM
 #define J1939_PORT_ESP32
 #endif
 
 #define J1939_SIZE_DATAFIELD 8
 
+/* Feature set and sizes below may be set by the build (-D), J1939_PROFILE_MINIMAL picks the smallest
+ * of each for MCU nodes. `cmake --build . --target j1939_size` prints what every one of them costs */
+#if defined J1939_PROFILE_MINIMAL
+#define J1939_STATIC 1
+#define J1939_SIZE_SUBSCRIPTION 0
+#define J1939_SIZE_ADDRESS 1
+#define J1939_TIMESTAMP 0
+#define J1939_SIZE_PORT_HOOK 0
+#define J1939_FILTER 0
+#define J1939_SIZE_MESSAGE 2
+#define J1939_SIZE_TP_BUFFER 64
+#endif /* J1939_PROFILE_MINIMAL */
+
+/* Receive subscriptions per handle, 0 disables delivery filtering */
+#ifndef J1939_SIZE_SUBSCRIPTION
+#define J1939_SIZE_SUBSCRIPTION 16
+#endif
+
+/* Local addresses (logical ECUs) per handle, see j1939_add_address, at least 1 */
+#ifndef J1939_SIZE_ADDRESS
+#define J1939_SIZE_ADDRESS 16
+#endif
+
+/* Port time (ns) stamps on every frame and message, plus latency histograms per handle, 0 removes them */
+#ifndef J1939_TIMESTAMP
+#define J1939_TIMESTAMP 1
+#endif
+
+/* Port hooks (recorders, monitors), 0 removes the hook calls from the port */
+#ifndef J1939_SIZE_PORT_HOOK
+#define J1939_SIZE_PORT_HOOK 4
+#endif
+
+/* Acceptance filter bank, see j1939_set_filter, 0 removes it and every frame passes */
+#ifndef J1939_FILTER
+#define J1939_FILTER 1
+#endif
+
+/* Filters j1939_set_filter hands down to the port, a bank that needs more leaves the port open */
+#ifndef J1939_SIZE_PORT_FILTER
+#define J1939_SIZE_PORT_FILTER 16
+#endif
+
+/* No heap. Handles live in static storage (J1939_DEFINE_HANDLE, j1939_init) and messages in a pool
+ * of J1939_SIZE_MESSAGE buffers of J1939_SIZE_TP_BUFFER bytes, shared by every handle and not
+ * thread safe. A transport message that does not fit or finds the pool empty is refused */
+#ifndef J1939_STATIC
+#define J1939_STATIC 0
+#endif
+
+#if J1939_STATIC
+#ifndef J1939_SIZE_MESSAGE
+#define J1939_SIZE_MESSAGE 4
+#endif
+#ifndef J1939_SIZE_TP_BUFFER
+#define J1939_SIZE_TP_BUFFER 256
+#endif
+/* rules of the filter bank, filters and PGN ranges each */
+#ifndef J1939_SIZE_FILTER
+#define J1939_SIZE_FILTER 8
+#endif
+#endif /* J1939_STATIC */
+
 #define J1939_LOGI
 #define J1939_LOGW
 #define J1939_LOGE
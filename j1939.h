@@ -20,6 +20,7 @@ extern "C" {
 #endif /* __cplusplus */
 
 #include "src/j1939.h"
+#include "src/j1939_scheduler.h"
 
 #ifdef __cplusplus
 }
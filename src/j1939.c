@@ -14,56 +14,19 @@
   * limitations under the License.
   */
 #include "j1939.h"
+#include "j1939_handle.h"
 #include "j1939_port.h"
+#include "j1939_tp.h"
 #if defined J1939_PORT_VIRTUAL
 #include "j1939_virtual.h"
+#elif defined J1939_PORT_SHM
+#include "j1939_shm.h"
 #endif /* J1939_PORT_VIRTUAL */
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
 
-#define J1939_SIZE_PROTOCOL_PAYLOAD         (J1939_SIZE_DATAFIELD - 1)
-
-#define J1939_ADDRESS_DIVIDE                0xF0/* DO NOT MODIFIED THIS PRAMETER */
-#define J1939_ADDRESS_NULL                  0xFE/* DO NOT MODIFIED THIS PRAMETER */
-#define J1939_ADDRESS_GLOBAL                0xFF/* DO NOT MODIFIED THIS PRAMETER */
-
-/* Reference SAE J1939-21 5.10.1.1 */
-/* min size = 9, max size = 1785 */
-#define J1939_TP_MAX_MSG_SIZE              (UCHAR_MAX * J1939_SIZE_PROTOCOL_PAYLOAD)
-/* Config response packets number of TP CTS */
-#define J1939_TP_CM_CTS_RESPONSE            4
-
-#define J1939_TP_DEFAULT_PRIORITY           0x07
-
-#define J1939_TP_BAM_TX_INTERVAL            50
-
-/* Reference https://elearning.vector.com/mod/page/view.php?id=422 */
-/* Reference SAE J1939-81 */
-/* Used for identification of an ECU and for detection of address conflicts */
-#define J1939_PGN_ADDR_CLAIMED              0x00EE00
-/* Reference SAE J1939-21 */
-/* Other pgns can be requested using this pgn, similarly as for the CAN Remote Frame. */
-/* But note: j1939 does not support Remote Frames. The Request pgn is a CAN data frame. */
-#define J1939_PGN_REQUEST                   0x00EA00
-/* Reference SAE J1939-21 */
-/* Transmits the payload data for the transport protocols */
-#define J1939_PGN_TP_DT                     0x00EB00
-/* Reference SAE J1939-21 */
-/* Supplies the metadata (number of bytes, packets, etc.) for transport protocols */
-#define J1939_PGN_TP_CM                     0x00EC00
-/* Reference SAE J1939-21 */
-/* Manufacturer-specific definable specific pgn */
-#define J1939_PGN_PROPRIETARY_A             0x00EF00
-/* Reference SAE J1939-21 */
-/* Manufacturer-specific definable additional specific pgn */
-#define J1939_PGN_PROPRIETARY_A1            0x01EF00
-/* Reference SAE J1939-21 */
-/* Used for acknowledgement of various network services. Can be positive or negative. */
-/* The acknowledgement is referenced accordingly in the application layer. */
-#define J1939_PGN_ACKNOWLEDGEMENT           0x00E800
-
 /* transport protocol internal status */
 typedef enum j1939_tp_status {
   /* ready to transmit/receive transport self messages */
@@ -73,6 +36,8 @@ typedef enum j1939_tp_status {
   J1939_TP_CM_ABORT_TX,
   J1939_TP_CM_CTS_TX,
   J1939_TP_CM_CTS_RX,
+  /* held open by a CTS for zero packets, the next CTS is due within T4 */
+  J1939_TP_CM_HOLD_RX,
   J1939_TP_CM_ACK_TX,
   J1939_TP_CM_ACK_RX,
   J1939_TP_DT_BAM_TX,
@@ -81,116 +46,6 @@ typedef enum j1939_tp_status {
   J1939_TP_DT_CMDT_RX,
 } j1939_tp_status_t;
 
-/* Transport self timeout parameters */
-typedef enum j1939_timeout {
-  /* Reference SAE J1939-21 5.10.2.4 */
-  J1939_TIMEOUT_TR                          = 200,
-  J1939_TIMEOUT_TH                          = 500,
-  J1939_TIMEOUT_T1                          = 750,
-  J1939_TIMEOUT_T2                          = 1250,
-  J1939_TIMEOUT_T3                          = 1250,
-  J1939_TIMEOUT_T4                          = 1050,
-} j1939_timeout_t;
-
-typedef enum j1939_control{
-  J1939_CONTROL_RTS                         = 0x10U,
-  J1939_CONTROL_CTS                         = 0x11U,
-  J1939_CONTROL_ACK                         = 0x13U,
-  J1939_CONTROL_BAM                         = 0x20U,
-  J1939_CONTROL_ABORT                       = 0xFFU,
-} j1939_control_t;
-
-/* Transport self - broadcast announce message structure */
-typedef struct j1939_bam {
-  /* Fixed at 32 */
-  uint64_t control                          : 8;
-  /* Message size in bytes */
-  uint64_t message_size                     : 16;
-  /* Number of packets */
-  uint64_t total_packets                    : 8;
-  /* Fixed at 0xFF */
-  uint64_t reserved                         : 8;
-  /* pgn */
-  uint64_t pgn                              : 24;
-} j1939_bam_t;
-
-/* Transport self - request to send struct */
-typedef struct j1939_rts {
-  /* Fixed at 16 */
-  uint64_t control                          : 8;
-  /* Message size in bytes */
-  uint64_t message_size                     : 16;
-  /* Number of packets */
-  uint64_t total_packets                    : 8;
-  /* Fixed at 0xFF */
-  uint64_t reserved                         : 8;
-  /* pgn */
-  uint64_t pgn                              : 24;
-} j1939_rts_t;
-
-/* Transport self - clear to send struct */
-typedef struct j1939_cts {
-  /* Fixed at 17 */
-  uint64_t control                          : 8;
-  /* Max number of packets that can be sent at once. (Not larger than byte 5 of RTS) */
-  uint64_t response_packets                  : 8;
-  /* Next sequence number to start with */
-  uint64_t next_sequence                     : 8;
-  /* Fixed at 0xFFFF */
-  uint64_t reserved                         : 16;
-  /* pgn */
-  uint64_t pgn                              : 24;
-} j1939_cts_t;
-
-/* Transport self - EndofmsgACK_t struct */
-typedef struct j1939_ack {
-  /* Fixed at 19 */
-  uint64_t control                          : 8;
-  /* Total message size in bytes */
-  uint64_t message_size                     : 16;
-  /* Total number of packets */
-  uint64_t total_packets                    : 8;
-  /* Fixed at 0xFF */
-  uint64_t reserved                         : 8;
-  /* pgn */
-  uint64_t pgn                              : 24;
-} j1939_ack_t;
-
-/* Transport self - Connection abort struct */
-typedef struct j1939_abort {
-  /* Fixed at 255 */
-  uint64_t control                          : 8;
-  /* Connection abort reason */
-  uint64_t reason                           : 8;
-  /* Fixed at 0xFFFFFF */
-  uint64_t reserved                         : 24;
-  /* pgn */
-  uint64_t pgn                              : 24;
-} j1939_abort_t;
-
-struct j1939 {
-  uint8_t self_address;
-  uint8_t total_packets;
-  uint8_t packets_count;
-  uint8_t response_packets;
-  uint8_t abort_reason;
-  uint32_t tick;
-  j1939_tp_status_t status;
-  j1939_cb_t recv_cb;
-  j1939_cb_t timeout_cb;
-  j1939_port_t *port;
-  j1939_message_t *lmsg;
-  void *arg;
-};
-
-static inline uint8_t get_total_packets(uint16_t size) {
-  return (size - 1) / J1939_SIZE_PROTOCOL_PAYLOAD + 1;
-}
-
-static inline uint8_t get_last_section(uint16_t size) {
-  return (size % J1939_SIZE_PROTOCOL_PAYLOAD) ? (size % J1939_SIZE_PROTOCOL_PAYLOAD) : (J1939_SIZE_PROTOCOL_PAYLOAD);
-}
-
 uint32_t j1939_get_pgn(uint32_t pdu) {
   /* Reference SAE J1939-21 5.1.2 */
   return ((((j1939_pdu_t *)&pdu)->reserved << 17 | ((j1939_pdu_t *)&pdu)->data_page << 16) | (((j1939_pdu_t *)&pdu)->pdu_format < J1939_ADDRESS_DIVIDE)) ?
@@ -206,293 +61,576 @@ void j1939_set_pgn(uint32_t *pdu, const uint32_t pgn) {
     ((j1939_pdu_t *)pdu)->pdu_specific = (pgn >> 0) & 0xFF;
 }
 
-static j1939_status_t j1939_tp_cm_rts_transmit_manager(j1939_t *self, uint32_t timeout_ms) {
+#if J1939_STATIC
+#if J1939_SIZE_TP_BUFFER < J1939_SIZE_DATAFIELD || J1939_SIZE_MESSAGE > 32
+#error "J1939_SIZE_TP_BUFFER holds at least a data field, J1939_SIZE_MESSAGE is at most 32"
+#endif
+/* message pool, uint64_t keeps every buffer aligned for the timestamps */
+static uint64_t j1939_messages[J1939_SIZE_MESSAGE][(sizeof(j1939_message_t) + J1939_SIZE_TP_BUFFER + 7) / 8];
+static uint32_t j1939_messages_used;
+#endif /* J1939_STATIC */
+
+#if J1939_FILTER
+/* bits 16 to 25 of the identifier */
+#define J1939_FILTER_SLOT(id)               (((id) >> 16) & 0x3FF)
+#define J1939_FILTER_SLOT_MASK              0x03FF0000U
+
+static inline uint32_t j1939_filter_pgn(uint32_t id) {
+  /* pdu specific is part of the PGN for PDU2 only */
+  return ((id >> 8) & 0x3FFFF) & (((id >> 16) & 0xFF) < J1939_ADDRESS_DIVIDE ? 0x3FF00 : 0x3FFFF);
+}
+
+static int j1939_filter_accept(const j1939_filter_bank_t *bank, uint32_t id) {
+  if (bank == NULL)
+    return 1;
+  uint16_t slot = J1939_FILTER_SLOT(id);
+  if (bank->full[slot / 32] >> (slot % 32) & 0x01)
+    return 1;
+  if ((bank->partial[slot / 32] >> (slot % 32) & 0x01) == 0)
+    return 0;
+  for (uint8_t idx = 0; idx < bank->filter_count; ++idx) {
+    if (((id ^ bank->filter[idx].id) & bank->filter[idx].mask) == 0)
+      return 1;
+  }
+  uint32_t pgn = j1939_filter_pgn(id);
+  for (uint8_t idx = 0; idx < bank->range_count; ++idx) {
+    if (bank->range[idx].first <= pgn && pgn <= bank->range[idx].last)
+      return 1;
+  }
+  return 0;
+}
+
+/* the static bank is rebuilt in place, the heap one is swapped once built */
+static j1939_filter_bank_t *j1939_filter_compile(j1939_t *handle, const j1939_filter_t *filter, uint8_t filter_count, const j1939_pgn_range_t *range, uint8_t range_count) {
+#if J1939_STATIC
+  if (filter_count > J1939_SIZE_FILTER || range_count > J1939_SIZE_FILTER)
+    return NULL;
+  j1939_filter_bank_t *self = &handle->bank;
+  memset(self, 0, sizeof(j1939_filter_bank_t));
+#else
+  j1939_filter_bank_t *self = (j1939_filter_bank_t *)calloc(1, sizeof(j1939_filter_bank_t) + filter_count * sizeof(j1939_filter_t) + range_count * sizeof(j1939_pgn_range_t));
+  if (self == NULL)
+    return NULL;
+  self->range = (j1939_pgn_range_t *)(self->filter + filter_count);
+#endif /* J1939_STATIC */
+  self->filter_count = filter_count;
+  self->range_count = range_count;
+  if (filter_count)
+    memcpy(self->filter, filter, filter_count * sizeof(j1939_filter_t));
+  if (range_count)
+    memcpy(self->range, range, range_count * sizeof(j1939_pgn_range_t));
+
+  for (uint16_t slot = 0; slot < 1024; ++slot) {
+    int full = 0, partial = 0;
+    for (uint8_t idx = 0; idx < filter_count; ++idx) {
+      if (((slot ^ J1939_FILTER_SLOT(filter[idx].id)) & J1939_FILTER_SLOT(filter[idx].mask)) != 0)
+        continue;
+      /* a filter on nothing but the slot bits decides the slot on its own */
+      if ((filter[idx].mask & ~J1939_FILTER_SLOT_MASK & 0x1FFFFFFFU) == 0)
+        full = 1;
+      partial = 1;
+    }
+    uint32_t first = slot << 8, last = (slot & 0xFF) < J1939_ADDRESS_DIVIDE ? first : first | 0xFF;
+    for (uint8_t idx = 0; idx < range_count; ++idx) {
+      if (range[idx].last < first || range[idx].first > last)
+        continue;
+      if (range[idx].first <= first && last <= range[idx].last)
+        full = 1;
+      partial = 1;
+    }
+    self->full[slot / 32] |= (uint32_t)full << (slot % 32);
+    self->partial[slot / 32] |= (uint32_t)partial << (slot % 32);
+  }
+
+  return self;
+}
+
+/* the same bank as port filters, ranges are split into aligned PGN blocks, returns 0 if they do not fit */
+static uint16_t j1939_filter_port(const j1939_filter_bank_t *bank, j1939_filter_t *out, uint16_t size) {
+  uint16_t count = 0;
+  /* transport frames, the PGN they carry is checked on reassembly */
+  const uint32_t tp[] = {J1939_PGN_TP_CM, J1939_PGN_TP_DT};
+  for (uint8_t idx = 0; idx < sizeof(tp) / sizeof(tp[0]); ++idx) {
+    if (count == size)
+      return 0;
+    out[count++] = (j1939_filter_t){ .id = tp[idx] << 8, .mask = J1939_FILTER_SLOT_MASK, };
+  }
+  for (uint8_t idx = 0; idx < bank->filter_count; ++idx) {
+    if (count == size)
+      return 0;
+    out[count++] = bank->filter[idx];
+  }
+  for (uint8_t idx = 0; idx < bank->range_count; ++idx) {
+    uint32_t pgn = bank->range[idx].first, last = bank->range[idx].last;
+    while (pgn <= last) {
+      uint32_t block = 1;
+      while (block < 0x40000 && (pgn & (2 * block - 1)) == 0 && pgn + 2 * block - 1 <= last)
+        block *= 2;
+      if (block >= 0x100 || (pgn >> 8 & 0xFF) >= J1939_ADDRESS_DIVIDE) {
+        if (count == size)
+          return 0;
+        out[count++] = (j1939_filter_t){ .id = pgn << 8, .mask = ((0x40000 - block) & 0x3FFFF) << 8, };
+      }
+      else if ((pgn & 0xFF) == 0) {
+        /* a PDU1 PGN, its pdu specific is the destination address */
+        if (count == size)
+          return 0;
+        out[count++] = (j1939_filter_t){ .id = pgn << 8, .mask = J1939_FILTER_SLOT_MASK, };
+      }
+      pgn += block;
+    }
+  }
+  return count;
+}
+#endif /* J1939_FILTER */
+
+static inline int j1939_is_local(j1939_t *self, uint8_t address) {
+  return self->addresses[address / 32] >> (address % 32) & 0x01;
+}
+
+static j1939_local_t *j1939_local_find(j1939_t *self, uint8_t address) {
+  if (!j1939_is_local(self, address))
+    return NULL;
+  for (uint8_t idx = 0; idx < self->locals_count; ++idx) {
+    if (self->locals[idx].address == address)
+      return &self->locals[idx];
+  }
+  return NULL;
+}
+
+/* receive session a transport frame belongs to, by its destination */
+static j1939_session_t *j1939_session_find(j1939_t *self, uint8_t address) {
+  j1939_local_t *local = address == J1939_ADDRESS_GLOBAL ? NULL : j1939_local_find(self, address);
+  return local ? &local->rx : address == J1939_ADDRESS_GLOBAL ? &self->broadcast : NULL;
+}
+
+/* the session of the sending local address, messages from any other source use the first one, NULL without local addresses */
+static j1939_session_t *j1939_tx_session(j1939_t *self, uint8_t address) {
+  j1939_local_t *local = j1939_local_find(self, address);
+  return local ? &local->tx : self->locals_count ? &self->locals[0].tx : NULL;
+}
+
+/* ends the session, the handle owns the transport message from j1939_transmit or reassembly */
+static void j1939_tp_release(j1939_t *self, j1939_session_t *session) {
+  j1939_message_delete(session->lmsg);
+  session->lmsg = NULL;
+  session->status = J1939_TP_READY;
+}
+
+static uint8_t j1939_tp_bam_interval(uint32_t interval_ms) {
+  if (interval_ms == J1939_TP_BAM_TX_BURST)
+    return J1939_TP_BAM_TX_BURST;
+  if (interval_ms < J1939_TP_BAM_TX_INTERVAL_MIN)
+    return J1939_TP_BAM_TX_INTERVAL_MIN;
+  if (interval_ms > J1939_TP_BAM_TX_INTERVAL_MAX)
+    return J1939_TP_BAM_TX_INTERVAL_MAX;
+  return interval_ms;
+}
+
+static j1939_status_t j1939_tp_cm_rts_transmit_manager(j1939_t *self, j1939_session_t *session, uint32_t timeout_ms) {
   j1939_status_t res = J1939_OK;
   j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
 
-  m.pdu.source_address = self->lmsg->pdu.source_address;
-  m.pdu.pdu_specific = self->lmsg->pdu.pdu_specific;
+  m.pdu.source_address = session->lmsg->pdu.source_address;
+  m.pdu.pdu_specific = session->lmsg->pdu.pdu_specific;
   m.pdu.priority = J1939_TP_DEFAULT_PRIORITY;
   j1939_set_pgn(&m.id, J1939_PGN_TP_CM);
   ((j1939_rts_t *)m.data)->control = J1939_CONTROL_RTS;
-  ((j1939_rts_t *)m.data)->message_size = self->lmsg->size;
-  ((j1939_rts_t *)m.data)->total_packets = self->total_packets;
-  ((j1939_rts_t *)m.data)->pgn = j1939_get_pgn(self->lmsg->id);
-  ((j1939_rts_t *)m.data)->reserved = 0xFF;
+  ((j1939_rts_t *)m.data)->message_size = session->lmsg->size;
+  ((j1939_rts_t *)m.data)->total_packets = session->total_packets;
+  ((j1939_rts_t *)m.data)->pgn = j1939_get_pgn(session->lmsg->id);
+  ((j1939_rts_t *)m.data)->max_packets = 0xFF;
 
   if ((res = j1939_port_transmit(self->port, &m, timeout_ms)) == J1939_OK) {
-    self->status = J1939_TP_CM_CTS_RX;
-    self->tick = j1939_port_get_tick();
+    session->status = J1939_TP_CM_CTS_RX;
+    session->tick = j1939_port_get_tick();
   }
 
   return res;
 }
 
-static j1939_status_t j1939_tp_cm_rts_receive_manager(j1939_t *self, j1939_static_message_t *msg){
-  if (self->status != J1939_TP_READY)
+/* runs the PGN announced by RTS/BAM through the filter bank, before anything is allocated */
+static int j1939_tp_announced_accept(j1939_t *self, j1939_static_message_t *msg) {
+  uint32_t pgn = ((j1939_rts_t *)msg->data)->pgn & 0x3FFFF;
+  uint32_t id = (msg->id & 0x1C0000FFU) | pgn << 8;
+  if ((pgn >> 8 & 0xFF) < J1939_ADDRESS_DIVIDE)
+    id |= (uint32_t)msg->pdu.pdu_specific << 8;
+#if J1939_FILTER
+  return j1939_filter_accept(self->filter, id);
+#else
+  return 1;
+#endif /* J1939_FILTER */
+}
+
+/* RTS and BAM share the size fields, the size has to need a transport session and match the packet count */
+static int j1939_tp_announced_valid(j1939_static_message_t *msg) {
+  uint16_t size = ((j1939_rts_t *)msg->data)->message_size;
+  return size > J1939_SIZE_DATAFIELD && size <= J1939_TP_MAX_MSG_SIZE && ((j1939_rts_t *)msg->data)->total_packets == get_total_packets(size);
+}
+
+/* the other end of a session, seen from the address a frame was sent to */
+static inline uint8_t j1939_tp_peer(j1939_session_t *session, uint8_t address) {
+  return session->lmsg->pdu.source_address == address ? session->lmsg->pdu.pdu_specific : session->lmsg->pdu.source_address;
+}
+
+/* a receive session is taken over by a new RTS/BAM once its sender went silent, reference SAE J1939-21 5.10.2.4,
+ * or by the sender itself restarting its message */
+static int j1939_tp_rx_available(j1939_session_t *session, j1939_static_message_t *msg) {
+  uint32_t elapsed = j1939_port_get_tick() - session->tick;
+  switch (session->status) {
+    case J1939_TP_READY:
+      return 1;
+    case J1939_TP_CM_CTS_TX:
+    case J1939_TP_DT_BAM_RX:
+    case J1939_TP_DT_CMDT_RX:
+      return session->lmsg->pdu.source_address == msg->pdu.source_address || elapsed >= J1939_TIMEOUT_T1;
+    default:
+      return 0;
+  }
+}
+
+static j1939_status_t j1939_tp_cm_rts_receive_manager(j1939_t *self, j1939_session_t *session, j1939_static_message_t *msg){
+  if (!j1939_tp_announced_valid(msg) || ((j1939_rts_t *)msg->data)->max_packets == 0)
+    return J1939_ERROR;
+  else if (!j1939_tp_rx_available(session, msg))
+    return J1939_ERROR;
+  else if (!j1939_tp_announced_accept(self, msg))
     return J1939_ERROR;
 
-  self->lmsg = j1939_message_create(0, NULL, ((j1939_rts_t *)msg->data)->message_size);
-  self->lmsg->pdu.source_address = msg->pdu.source_address;
-  self->lmsg->pdu.pdu_specific = msg->pdu.pdu_specific;
-  j1939_set_pgn(&self->lmsg->id, ((j1939_rts_t *)msg->data)->pgn);
+  j1939_tp_release(self, session);
+  if ((session->lmsg = j1939_message_create(0, NULL, ((j1939_rts_t *)msg->data)->message_size)) == NULL)
+    return J1939_ERROR;
+#if J1939_TIMESTAMP
+  session->lmsg->timestamp = session->lmsg->timestamp_first = msg->timestamp;
+#endif /* J1939_TIMESTAMP */
+  session->lmsg->pdu.source_address = msg->pdu.source_address;
+  session->lmsg->pdu.pdu_specific = msg->pdu.pdu_specific;
+  j1939_set_pgn(&session->lmsg->id, ((j1939_rts_t *)msg->data)->pgn);
 
-  self->total_packets = ((j1939_rts_t *)msg->data)->total_packets;
+  session->total_packets = ((j1939_rts_t *)msg->data)->total_packets;
+  session->packets_count = 0;
+  session->max_packets = self->window < ((j1939_rts_t *)msg->data)->max_packets ? self->window : ((j1939_rts_t *)msg->data)->max_packets;
 
-  self->status = J1939_TP_CM_CTS_TX;
+  session->status = J1939_TP_CM_CTS_TX;
 
-  self->tick = j1939_port_get_tick();
+  session->tick = j1939_port_get_tick();
 
   return J1939_OK;
 }
 
-static j1939_status_t j1939_tp_cm_cts_transmit_manager(j1939_t *self) {
+static j1939_status_t j1939_tp_cm_cts_transmit_manager(j1939_t *self, j1939_session_t *session) {
   j1939_status_t res = J1939_OK;
   j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
 
-  m.pdu.source_address = self->lmsg->pdu.pdu_specific;
-  m.pdu.pdu_specific = self->lmsg->pdu.source_address;
+  m.pdu.source_address = session->lmsg->pdu.pdu_specific;
+  m.pdu.pdu_specific = session->lmsg->pdu.source_address;
   m.pdu.priority = J1939_TP_DEFAULT_PRIORITY;
   j1939_set_pgn(&m.id, J1939_PGN_TP_CM);
   ((j1939_cts_t *)m.data)->control = J1939_CONTROL_CTS;
-  ((j1939_cts_t *)m.data)->next_sequence = self->packets_count + 1;
-  ((j1939_cts_t *)m.data)->pgn = j1939_get_pgn(self->lmsg->id);
+  ((j1939_cts_t *)m.data)->next_sequence = session->packets_count + 1;
+  ((j1939_cts_t *)m.data)->pgn = j1939_get_pgn(session->lmsg->id);
   ((j1939_cts_t *)m.data)->reserved = 0xFFFF;
-  ((j1939_cts_t *)m.data)->response_packets = (self->total_packets - self->packets_count < J1939_TP_CM_CTS_RESPONSE) ? self->total_packets - self->packets_count : J1939_TP_CM_CTS_RESPONSE;
+  ((j1939_cts_t *)m.data)->response_packets = (session->total_packets - session->packets_count < session->max_packets) ? session->total_packets - session->packets_count : session->max_packets;
 
-  self->response_packets = ((j1939_cts_t *)m.data)->response_packets;
+  session->response_packets = session->cts_packets = ((j1939_cts_t *)m.data)->response_packets;
 
   if ((res = j1939_port_transmit(self->port, &m, J1939_TIMEOUT_TR)) == J1939_OK) {
-    self->status = J1939_TP_DT_CMDT_RX;
-    self->tick = j1939_port_get_tick();
+    session->status = J1939_TP_DT_CMDT_RX;
+    session->tick = j1939_port_get_tick();
   }
 
   return res;
 }
 
-static j1939_status_t j1939_tp_cm_cts_receive_manager(j1939_t *self, j1939_static_message_t *msg) {
-  if (self->status != J1939_TP_CM_CTS_RX)
+static j1939_status_t j1939_tp_cm_cts_receive_manager(j1939_t *self, j1939_session_t *session, j1939_static_message_t *msg) {
+  if (session->status != J1939_TP_CM_CTS_RX && session->status != J1939_TP_CM_HOLD_RX)
     return J1939_ERROR;
-  else if (j1939_get_pgn(self->lmsg->id) != ((j1939_cts_t *)msg->data)->pgn)
+  else if (j1939_tp_peer(session, msg->pdu.pdu_specific) != msg->pdu.source_address)
     return J1939_ERROR;
-  else if (self->packets_count + 1 != ((j1939_cts_t *)msg->data)->next_sequence)
+  else if (j1939_get_pgn(session->lmsg->id) != ((j1939_cts_t *)msg->data)->pgn)
+    return J1939_ERROR;
+  else if (session->packets_count + 1 != ((j1939_cts_t *)msg->data)->next_sequence)
     return J1939_ERROR;
 
-  self->response_packets = ((j1939_cts_t *)msg->data)->response_packets;
-
-  self->status = J1939_TP_DT_CMDT_TX;
+  session->tick = j1939_port_get_tick();
+  /* more packets than left are cut to the rest, zero packets holds the connection open */
+  session->response_packets = ((j1939_cts_t *)msg->data)->response_packets;
+  if (session->response_packets > session->total_packets - session->packets_count)
+    session->response_packets = session->total_packets - session->packets_count;
+  if (session->response_packets == 0) {
+    session->status = J1939_TP_CM_HOLD_RX;
+    return J1939_OK;
+  }
 
-  self->tick = j1939_port_get_tick();
+  session->status = J1939_TP_DT_CMDT_TX;
 
   return J1939_OK;
 }
 
-static j1939_status_t j1939_tp_cm_ack_transmit_manager(j1939_t *self) {
+static j1939_status_t j1939_tp_cm_ack_transmit_manager(j1939_t *self, j1939_session_t *session) {
   j1939_status_t res = J1939_OK;
   j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
 
-  m.pdu.source_address = self->lmsg->pdu.pdu_specific;
-  m.pdu.pdu_specific = self->lmsg->pdu.source_address;
+  m.pdu.source_address = session->lmsg->pdu.pdu_specific;
+  m.pdu.pdu_specific = session->lmsg->pdu.source_address;
   m.pdu.priority = J1939_TP_DEFAULT_PRIORITY;
   j1939_set_pgn(&m.id, J1939_PGN_TP_CM);
 
   ((j1939_ack_t *)m.data)->control = J1939_CONTROL_ACK;
-  ((j1939_ack_t *)m.data)->message_size = self->lmsg->size;
-  ((j1939_ack_t *)m.data)->pgn = j1939_get_pgn(self->lmsg->id);
+  ((j1939_ack_t *)m.data)->message_size = session->lmsg->size;
+  ((j1939_ack_t *)m.data)->pgn = j1939_get_pgn(session->lmsg->id);
   ((j1939_ack_t *)m.data)->reserved = 0xFF;
-  ((j1939_ack_t *)m.data)->total_packets = self->total_packets;
+  ((j1939_ack_t *)m.data)->total_packets = session->total_packets;
 
   if ((res = j1939_port_transmit(self->port, &m, J1939_TIMEOUT_TR)) == J1939_OK) {
-    self->status = J1939_TP_COMPLETE_RX;
-    self->tick = j1939_port_get_tick();
+    session->status = J1939_TP_COMPLETE_RX;
+    session->tick = j1939_port_get_tick();
   }
 
   return res;
 }
 
-static j1939_status_t j1939_tp_cm_ack_receive_manager(j1939_t *self, j1939_static_message_t *msg) {
-  if (self->status != J1939_TP_CM_ACK_RX)
+static j1939_status_t j1939_tp_cm_ack_receive_manager(j1939_t *self, j1939_session_t *session, j1939_static_message_t *msg) {
+  if (session->status != J1939_TP_CM_ACK_RX)
+    return J1939_ERROR;
+  else if (j1939_tp_peer(session, msg->pdu.pdu_specific) != msg->pdu.source_address)
     return J1939_ERROR;
-  else if (j1939_get_pgn(self->lmsg->id) != ((j1939_ack_t *)msg->data)->pgn)
+  else if (j1939_get_pgn(session->lmsg->id) != ((j1939_ack_t *)msg->data)->pgn)
     return J1939_ERROR;
-  else if (self->lmsg->size != ((j1939_ack_t *)msg->data)->message_size)
+  else if (session->lmsg->size != ((j1939_ack_t *)msg->data)->message_size)
     return J1939_ERROR;
-  else if (self->total_packets != ((j1939_ack_t *)msg->data)->total_packets)
+  else if (session->total_packets != ((j1939_ack_t *)msg->data)->total_packets)
     return J1939_ERROR;
 
-  self->status = J1939_TP_COMPLETE_TX;
+  j1939_tp_release(self, session);
 
   return J1939_OK;
 }
 
-static j1939_status_t j1939_tp_cm_bam_transmit_manager(j1939_t *self, uint32_t timeout_ms) {
+static j1939_status_t j1939_tp_cm_bam_transmit_manager(j1939_t *self, j1939_session_t *session, uint32_t timeout_ms) {
   j1939_status_t res = J1939_OK;
   j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
 
-  m.pdu.source_address = self->lmsg->pdu.source_address;
+  m.pdu.source_address = session->lmsg->pdu.source_address;
   m.pdu.pdu_specific = J1939_ADDRESS_GLOBAL;
   m.pdu.priority = J1939_TP_DEFAULT_PRIORITY;
   j1939_set_pgn(&m.id, J1939_PGN_TP_CM);
   ((j1939_bam_t *)&m.data)->control = J1939_CONTROL_BAM;
-  ((j1939_bam_t *)&m.data)->message_size = self->lmsg->size;
-  ((j1939_bam_t *)&m.data)->total_packets = self->total_packets;
-  ((j1939_bam_t *)&m.data)->pgn = j1939_get_pgn(self->lmsg->id);
+  ((j1939_bam_t *)&m.data)->message_size = session->lmsg->size;
+  ((j1939_bam_t *)&m.data)->total_packets = session->total_packets;
+  ((j1939_bam_t *)&m.data)->pgn = j1939_get_pgn(session->lmsg->id);
   ((j1939_bam_t *)&m.data)->reserved = 0xFF;
 
   if ((res = j1939_port_transmit(self->port, &m, timeout_ms)) == J1939_OK) {
-    self->status = J1939_TP_DT_BAM_TX;
-    self->tick = j1939_port_get_tick();
+    session->status = J1939_TP_DT_BAM_TX;
+    session->tick = j1939_port_get_tick();
   }
 
   return res;
 }
 
-static j1939_status_t j1939_tp_cm_bam_receive_manager(j1939_t *self, j1939_static_message_t *msg) {
-  if (self->status != J1939_TP_READY)
+static j1939_status_t j1939_tp_cm_bam_receive_manager(j1939_t *self, j1939_session_t *session, j1939_static_message_t *msg) {
+  if (!j1939_tp_announced_valid(msg))
+    return J1939_ERROR;
+  else if (!j1939_tp_rx_available(session, msg))
+    return J1939_ERROR;
+  else if (!j1939_tp_announced_accept(self, msg))
     return J1939_ERROR;
 
-  self->lmsg = j1939_message_create(0, NULL, ((j1939_bam_t *)msg->data)->message_size);
-  self->lmsg->pdu.source_address = msg->pdu.source_address;
-  self->lmsg->pdu.pdu_specific = msg->pdu.pdu_specific;
-  j1939_set_pgn(&self->lmsg->id, ((j1939_bam_t *)msg->data)->pgn);
+  j1939_tp_release(self, session);
+  if ((session->lmsg = j1939_message_create(0, NULL, ((j1939_bam_t *)msg->data)->message_size)) == NULL)
+    return J1939_ERROR;
+#if J1939_TIMESTAMP
+  session->lmsg->timestamp = session->lmsg->timestamp_first = msg->timestamp;
+#endif /* J1939_TIMESTAMP */
+  session->lmsg->pdu.source_address = msg->pdu.source_address;
+  session->lmsg->pdu.pdu_specific = msg->pdu.pdu_specific;
+  j1939_set_pgn(&session->lmsg->id, ((j1939_bam_t *)msg->data)->pgn);
 
-  self->total_packets = ((j1939_bam_t *)msg->data)->total_packets;
+  session->total_packets = ((j1939_bam_t *)msg->data)->total_packets;
+  session->packets_count = 0;
 
-  self->status = J1939_TP_DT_BAM_RX;
-  self->tick = j1939_port_get_tick();
+  session->status = J1939_TP_DT_BAM_RX;
+  session->tick = j1939_port_get_tick();
 
   return J1939_OK;
 }
 
-// static j1939_status_t j1939_tp_cm_abort_transmit_manager(j1939_t *self, uint32_t timeout_ms) {
-//   j1939_status_t res = J1939_OK;
-//   j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
-
-//   m.pdu.source_address = self->lmsg->pdu.pdu_specific;
-//   m.pdu.pdu_specific = self->lmsg->pdu.source_address;
-//   m.pdu.priority = J1939_TP_DEFAULT_PRIORITY;
-//   j1939_set_pgn(&m.id, J1939_PGN_TP_CM);
+/* sent from address, the local end of the session */
+static j1939_status_t j1939_tp_cm_abort_transmit_manager(j1939_t *self, j1939_session_t *session, uint8_t address) {
+  j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
 
-//   ((j1939_abort_t *)m.data)->control = J1939_CONTROL_ABORT;
-//   ((j1939_abort_t *)m.data)->reason = (uint8_t)self->abort_reason;
-//   ((j1939_abort_t *)m.data)->reserved = 0xFFFFFF;
-//   ((j1939_abort_t *)m.data)->pgn = j1939_get_pgn(self->lmsg->id);
+  m.pdu.source_address = address;
+  m.pdu.pdu_specific = j1939_tp_peer(session, address);
+  m.pdu.priority = J1939_TP_DEFAULT_PRIORITY;
+  j1939_set_pgn(&m.id, J1939_PGN_TP_CM);
 
-//   if ((res = j1939_port_transmit(self->port, &m, timeout_ms)) == J1939_OK) {
-//     self->status = J1939_TP_READY;
-//     self->tick = j1939_port_get_tick();
-//   }
+  ((j1939_abort_t *)m.data)->control = J1939_CONTROL_ABORT;
+  ((j1939_abort_t *)m.data)->reason = session->abort_reason;
+  ((j1939_abort_t *)m.data)->reserved = 0xFFFFFF;
+  ((j1939_abort_t *)m.data)->pgn = j1939_get_pgn(session->lmsg->id);
 
-//   return res;
-// }
+  return j1939_port_transmit(self->port, &m, J1939_TIMEOUT_TR);
+}
 
-static j1939_status_t j1939_tp_cm_abort_receive_manager(j1939_t *self, j1939_static_message_t *msg){
-  if (j1939_get_pgn(self->lmsg->id) != ((j1939_abort_t *)msg->data)->pgn)
+static j1939_status_t j1939_tp_cm_abort_receive_manager(j1939_t *self, j1939_session_t *session, j1939_static_message_t *msg){
+  if (session->lmsg == NULL || j1939_tp_peer(session, msg->pdu.pdu_specific) != msg->pdu.source_address)
+    return J1939_ERROR;
+  else if (j1939_get_pgn(session->lmsg->id) != ((j1939_abort_t *)msg->data)->pgn)
     return J1939_ERROR;
 
-  // J1939_MessageDelete(&self->lmsg);
-
-  memset(self, 0, sizeof(struct j1939));
+  j1939_tp_release(self, session);
 
   return J1939_OK;
 }
 
-static j1939_status_t j1939_tp_dt_transmit_manager(j1939_t *self, uint32_t timeout_ms) {
+static j1939_status_t j1939_tp_dt_transmit_manager(j1939_t *self, j1939_session_t *session, uint32_t timeout_ms) {
   j1939_status_t res = J1939_OK;
   j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
   uint8_t section = J1939_SIZE_PROTOCOL_PAYLOAD;
 
-  m.pdu.source_address = self->lmsg->pdu.source_address;
-  m.pdu.pdu_specific = self->status == J1939_TP_DT_BAM_TX ? J1939_ADDRESS_GLOBAL : self->lmsg->pdu.pdu_specific;
+  m.pdu.source_address = session->lmsg->pdu.source_address;
+  m.pdu.pdu_specific = session->status == J1939_TP_DT_BAM_TX ? J1939_ADDRESS_GLOBAL : session->lmsg->pdu.pdu_specific;
   m.pdu.priority = J1939_TP_DEFAULT_PRIORITY;
   j1939_set_pgn(&m.id, J1939_PGN_TP_DT);
 
-  if (self->packets_count + 1 == self->total_packets) {
-    section = get_last_section(self->lmsg->size);
+  if (session->packets_count + 1 == session->total_packets) {
+    section = get_last_section(session->lmsg->size);
     memset(&m.data[1] + section, 0xFF, J1939_SIZE_PROTOCOL_PAYLOAD - section);
   }
 
-  m.data[0] = self->packets_count + 1;
-  memcpy(&m.data[1], self->lmsg->data + self->packets_count * J1939_SIZE_PROTOCOL_PAYLOAD, section);
+  m.data[0] = session->packets_count + 1;
+  memcpy(&m.data[1], session->lmsg->data + session->packets_count * J1939_SIZE_PROTOCOL_PAYLOAD, section);
 
   if ((res = j1939_port_transmit(self->port, &m, timeout_ms)) == J1939_OK) {
-    self->packets_count += 1;
-    switch (self->status) {
+    session->packets_count += 1;
+    switch (session->status) {
       case J1939_TP_DT_BAM_TX:
-        if (self->packets_count == self->total_packets)
-          self->status = J1939_TP_COMPLETE_TX;
+        if (session->packets_count == session->total_packets)
+          j1939_tp_release(self, session);
         break;
       case J1939_TP_DT_CMDT_TX:
-        if (self->packets_count == self->total_packets)
-          self->status = J1939_TP_CM_ACK_RX;
-        else if (--self->response_packets == 0)
-          self->status = J1939_TP_CM_CTS_RX;
+        if (session->packets_count == session->total_packets)
+          session->status = J1939_TP_CM_ACK_RX;
+        else if (--session->response_packets == 0)
+          session->status = J1939_TP_CM_CTS_RX;
         break;
       default:
         break;
     }
-    self->tick = j1939_port_get_tick();
+    session->tick = j1939_port_get_tick();
   }
 
   return res;
 }
 
-static j1939_status_t j1939_tp_dt_receive_manager(j1939_t *self, j1939_static_message_t *msg) {
+static j1939_status_t j1939_tp_dt_receive_manager(j1939_t *self, j1939_session_t *session, j1939_static_message_t *msg) {
   uint8_t section = J1939_SIZE_PROTOCOL_PAYLOAD;
 
-  if (self->packets_count + 1 != msg->data[0]) {
+  if (session->status != J1939_TP_DT_BAM_RX && session->status != J1939_TP_DT_CMDT_RX)
+    return J1939_ERROR;
+  else if (session->lmsg->pdu.source_address != msg->pdu.source_address)
+    return J1939_ERROR;
+
+  if (session->packets_count + 1 != msg->data[0]) {
     /* TODO: TP_CM_CTS_TX */
     return J1939_OK;
   }
 
-  if (++self->packets_count == self->total_packets) {
-    section = get_last_section(self->lmsg->size);
-    switch (self->status) {
+  if (++session->packets_count == session->total_packets) {
+    section = get_last_section(session->lmsg->size);
+    switch (session->status) {
       case J1939_TP_DT_BAM_RX:
-        self->status = J1939_TP_COMPLETE_RX;
+        session->status = J1939_TP_COMPLETE_RX;
         break;
       case J1939_TP_DT_CMDT_RX:
-        j1939_tp_cm_ack_transmit_manager(self);
+        /* the message is complete even if the ACK does not get out */
+        j1939_tp_cm_ack_transmit_manager(self, session);
+        session->status = J1939_TP_COMPLETE_RX;
         break;
       default:
         break;
     }
   }
-  else if (self->status == J1939_TP_DT_CMDT_RX) {
-    if (--self->response_packets == 0)
-      self->status = J1939_TP_CM_CTS_TX;
+  else if (session->status == J1939_TP_DT_CMDT_RX) {
+    if (--session->response_packets == 0)
+      session->status = J1939_TP_CM_CTS_TX;
   }
 
-  memcpy(self->lmsg->data + (self->packets_count - 1) * J1939_SIZE_PROTOCOL_PAYLOAD, &msg->data[1], section);
+  memcpy(session->lmsg->data + (session->packets_count - 1) * J1939_SIZE_PROTOCOL_PAYLOAD, &msg->data[1], section);
+#if J1939_TIMESTAMP
+  session->lmsg->timestamp = msg->timestamp;
+#endif /* J1939_TIMESTAMP */
 
-  self->tick = j1939_port_get_tick();
+  session->tick = j1939_port_get_tick();
 
   return J1939_OK;
 }
 
-static j1939_status_t j1939_tp_dt_bam_transmit_manager(j1939_t *self) {
-  return j1939_port_get_tick() - self->tick < J1939_TP_BAM_TX_INTERVAL ? J1939_BLOCKED : j1939_tp_dt_transmit_manager(self, J1939_TIMEOUT_TR);
+static j1939_status_t j1939_tp_dt_bam_transmit_manager(j1939_t *self, j1939_session_t *session) {
+  j1939_status_t res = J1939_OK;
+  if (session->interval != J1939_TP_BAM_TX_BURST)
+    return j1939_port_get_tick() - session->tick < session->interval ? J1939_BLOCKED : j1939_tp_dt_transmit_manager(self, session, J1939_TIMEOUT_TR);
+  /* burst, stops once the session is done or the port is full, the rest goes out on the next call */
+  while (session->status == J1939_TP_DT_BAM_TX && (res = j1939_tp_dt_transmit_manager(self, session, 0)) == J1939_OK);
+  return res == J1939_TIMEOUT ? J1939_BLOCKED : res;
+}
+
+static j1939_status_t j1939_tp_dt_cmdt_transmit_manager(j1939_t *self, j1939_session_t *session) {
+  return session->response_packets ? j1939_tp_dt_transmit_manager(self, session, J1939_TIMEOUT_T3) : J1939_ERROR;
+}
+
+/* waiting for the peer, nothing to send */
+static j1939_status_t j1939_tp_cm_wait_manager(j1939_t *self, j1939_session_t *session) {
+  return J1939_ERROR;
 }
 
-static j1939_status_t j1939_tp_dt_cmdt_transmit_manager(j1939_t *self) {
-  return self->response_packets ? j1939_tp_dt_transmit_manager(self, J1939_TIMEOUT_T3) : J1939_ERROR;
+/* drops a session that timed out, a connection is aborted towards its peer first, reference SAE J1939-21 5.10.2.4.
+ * timeout_cb gets the message, sent or partly received, before it is deleted. A BAM has no peer to abort,
+ * its pdu specific is the group extension of a PDU2 PGN */
+static j1939_status_t j1939_tp_expire(j1939_t *self, j1939_session_t *session) {
+  uint8_t address = j1939_is_local(self, session->lmsg->pdu.source_address) ? session->lmsg->pdu.source_address : session->lmsg->pdu.pdu_specific;
+  if (session->status != J1939_TP_DT_BAM_TX && session->status != J1939_TP_DT_BAM_RX) {
+    session->abort_reason = J1939_ABORT_TIMEOUT;
+    j1939_tp_cm_abort_transmit_manager(self, session, address);
+  }
+  if (self->timeout_cb)
+    self->timeout_cb(self->port, session->lmsg, self->arg);
+  j1939_tp_release(self, session);
+  return J1939_TIMEOUT;
 }
 
-j1939_status_t j1939_tp_cm_transmit_helper(j1939_t *self, uint32_t timeout_ms, j1939_status_t (*func)(j1939_t *)) {
-  return j1939_port_get_tick() - self->tick < timeout_ms ? func(self) : J1939_TIMEOUT;
+/* the sender has T2 to answer a CTS and T1 between its packets, reference SAE J1939-21 5.10.2.4 */
+static inline uint32_t j1939_tp_rx_timeout(j1939_session_t *session) {
+  return session->status == J1939_TP_DT_CMDT_RX && session->response_packets == session->cts_packets ? J1939_TIMEOUT_T2 : J1939_TIMEOUT_T1;
 }
 
-j1939_status_t j1939_tp_cm_transmit_manager(j1939_t *self, uint32_t timeout_ms) {
+static j1939_status_t j1939_tp_cm_transmit_helper(j1939_t *self, j1939_session_t *session, uint32_t timeout_ms, j1939_status_t (*func)(j1939_t *, j1939_session_t *)) {
+  return j1939_port_get_tick() - session->tick < timeout_ms ? func(self, session) : j1939_tp_expire(self, session);
+}
+
+static j1939_status_t j1939_tp_session_transmit_manager(j1939_t *self, j1939_session_t *session) {
   j1939_status_t res = J1939_OK;
-  switch (self->status) {
+  switch (session->status) {
     case J1939_TP_CM_CTS_TX:
-      res = j1939_tp_cm_transmit_helper(self, J1939_TIMEOUT_TR, j1939_tp_cm_cts_transmit_manager);
+      res = j1939_tp_cm_transmit_helper(self, session, J1939_TIMEOUT_TR, j1939_tp_cm_cts_transmit_manager);
       break;
     case J1939_TP_DT_BAM_TX:
-      res = j1939_tp_cm_transmit_helper(self, J1939_TIMEOUT_TR, j1939_tp_dt_bam_transmit_manager);
+      res = j1939_tp_cm_transmit_helper(self, session, session->interval + J1939_TIMEOUT_TR, j1939_tp_dt_bam_transmit_manager);
       break;
     case J1939_TP_DT_CMDT_TX:
-      res = j1939_tp_cm_transmit_helper(self, J1939_TIMEOUT_T3, j1939_tp_dt_cmdt_transmit_manager);
+      res = j1939_tp_cm_transmit_helper(self, session, J1939_TIMEOUT_T3, j1939_tp_dt_cmdt_transmit_manager);
+      break;
+    case J1939_TP_CM_CTS_RX:
+    case J1939_TP_CM_ACK_RX:
+      res = j1939_tp_cm_transmit_helper(self, session, J1939_TIMEOUT_T3, j1939_tp_cm_wait_manager);
+      break;
+    case J1939_TP_CM_HOLD_RX:
+      res = j1939_tp_cm_transmit_helper(self, session, J1939_TIMEOUT_T4, j1939_tp_cm_wait_manager);
+      break;
+    case J1939_TP_DT_BAM_RX:
+    case J1939_TP_DT_CMDT_RX:
+      res = j1939_tp_cm_transmit_helper(self, session, j1939_tp_rx_timeout(session), j1939_tp_cm_wait_manager);
       break;
     default:
       res = J1939_ERROR;
@@ -501,23 +639,66 @@ j1939_status_t j1939_tp_cm_transmit_manager(j1939_t *self, uint32_t timeout_ms)
   return res;
 }
 
+/* tx and rx of every local address, then the broadcast session, idx runs up to 2 * locals_count */
+static inline j1939_session_t *j1939_tp_session_at(j1939_t *self, uint16_t idx) {
+  return idx == 2 * self->locals_count ? &self->broadcast : idx % 2 ? &self->locals[idx / 2].rx : &self->locals[idx / 2].tx;
+}
+
+j1939_status_t j1939_tp_cm_transmit_manager(j1939_t *self, uint32_t timeout_ms) {
+  j1939_status_t res = J1939_ERROR;
+  for (uint16_t idx = 0; idx <= 2 * self->locals_count; ++idx) {
+    j1939_status_t ret = j1939_tp_session_transmit_manager(self, j1939_tp_session_at(self, idx));
+    /* a timeout outweighs progress, progress outweighs pacing, ERROR means no session had work */
+    if (ret == J1939_TIMEOUT || (ret == J1939_OK && res != J1939_TIMEOUT) || (ret == J1939_BLOCKED && res == J1939_ERROR))
+      res = ret;
+  }
+  return res;
+}
+
+uint32_t j1939_tp_next_deadline(j1939_t *self) {
+  uint32_t deadline = UINT32_MAX;
+  for (uint16_t idx = 0; idx <= 2 * self->locals_count && deadline; ++idx) {
+    j1939_session_t *session = j1939_tp_session_at(self, idx);
+    uint32_t elapsed = j1939_port_get_tick() - session->tick;
+    if (session->status == J1939_TP_CM_CTS_TX || session->status == J1939_TP_DT_CMDT_TX)
+      deadline = 0;
+    else if (session->status == J1939_TP_DT_BAM_TX && (elapsed < session->interval ? session->interval - elapsed : 0) < deadline)
+      deadline = elapsed < session->interval ? session->interval - elapsed : 0;
+    else if ((session->status == J1939_TP_CM_CTS_RX || session->status == J1939_TP_CM_ACK_RX) && (elapsed < J1939_TIMEOUT_T3 ? J1939_TIMEOUT_T3 - elapsed : 0) < deadline)
+      deadline = elapsed < J1939_TIMEOUT_T3 ? J1939_TIMEOUT_T3 - elapsed : 0;
+    else if (session->status == J1939_TP_CM_HOLD_RX && (elapsed < J1939_TIMEOUT_T4 ? J1939_TIMEOUT_T4 - elapsed : 0) < deadline)
+      deadline = elapsed < J1939_TIMEOUT_T4 ? J1939_TIMEOUT_T4 - elapsed : 0;
+    else if ((session->status == J1939_TP_DT_BAM_RX || session->status == J1939_TP_DT_CMDT_RX) && (elapsed < j1939_tp_rx_timeout(session) ? j1939_tp_rx_timeout(session) - elapsed : 0) < deadline)
+      deadline = elapsed < j1939_tp_rx_timeout(session) ? j1939_tp_rx_timeout(session) - elapsed : 0;
+  }
+  return deadline;
+}
+
 static j1939_status_t j1939_tp_cm_receive_manager(j1939_t *self, j1939_static_message_t *msg) {
   j1939_status_t res = J1939_OK;
+  j1939_session_t *session = j1939_session_find(self, msg->pdu.pdu_specific);
+  /* CTS and ACK answer a session this address sends */
+  j1939_local_t *local = j1939_local_find(self, msg->pdu.pdu_specific);
+  if (session == NULL || msg->size != J1939_SIZE_DATAFIELD)
+    return J1939_ERROR;
   switch ((j1939_control_t)msg->data[0]) {
     case J1939_CONTROL_RTS:
-      res = j1939_tp_cm_rts_receive_manager(self, msg);
+      /* connection mode is peer to peer, broadcasts are announced by BAM only */
+      res = local ? j1939_tp_cm_rts_receive_manager(self, session, msg) : J1939_ERROR;
       break;
     case J1939_CONTROL_CTS:
-      res = j1939_tp_cm_cts_receive_manager(self, msg);
+      res = local ? j1939_tp_cm_cts_receive_manager(self, &local->tx, msg) : J1939_ERROR;
       break;
     case J1939_CONTROL_ACK:
-      res = j1939_tp_cm_ack_receive_manager(self, msg);
+      res = local ? j1939_tp_cm_ack_receive_manager(self, &local->tx, msg) : J1939_ERROR;
       break;
     case J1939_CONTROL_BAM:
-      res = j1939_tp_cm_bam_receive_manager(self, msg);
+      res = local ? J1939_ERROR : j1939_tp_cm_bam_receive_manager(self, session, msg);
       break;
     case J1939_CONTROL_ABORT:
-      res = j1939_tp_cm_abort_receive_manager(self, msg);
+      /* either direction, the PGN tells which one */
+      if (local == NULL || (res = j1939_tp_cm_abort_receive_manager(self, &local->tx, msg)) != J1939_OK)
+        res = j1939_tp_cm_abort_receive_manager(self, session, msg);
       break;
     default:
       res = J1939_ERROR;
@@ -529,89 +710,398 @@ j1939_status_t j1939_receive_filter(j1939_t *self, const j1939_message_t *msg) {
   j1939_status_t res = J1939_OK;
   /* pdu1 filter */
   if (msg->pdu.pdu_format < J1939_ADDRESS_DIVIDE) {
-    if (msg->pdu.pdu_specific != self->self_address && msg->pdu.pdu_specific != J1939_ADDRESS_GLOBAL)
+    if (!j1939_is_local(self, msg->pdu.pdu_specific) && msg->pdu.pdu_specific != J1939_ADDRESS_GLOBAL)
+      res = J1939_ERROR;
+  }
+#if J1939_FILTER
+  /* filter bank, transport frames are checked by the PGN they announce */
+  if (res == J1939_OK && msg->pdu.pdu_format != (J1939_PGN_TP_CM >> 8 & 0xFF) && msg->pdu.pdu_format != (J1939_PGN_TP_DT >> 8 & 0xFF)) {
+    if (!j1939_filter_accept(self->filter, msg->id))
       res = J1939_ERROR;
   }
+#endif /* J1939_FILTER */
   return res;
 }
 
+/* an exact (PGN, SA) match wins over the wildcard, whatever order they were subscribed in */
+static j1939_subscriber_t *j1939_subscriber_find(j1939_t *self, uint32_t pgn, uint8_t source_address, uint8_t exact) {
+  j1939_subscriber_t *wildcard = NULL;
+#if J1939_SIZE_SUBSCRIPTION
+  for (uint8_t idx = 0; idx < self->subscribers_count; ++idx) {
+    j1939_subscriber_t *sub = &self->subscribers[idx];
+    if (sub->pgn != pgn)
+      continue;
+    if (sub->source_address == source_address)
+      return sub;
+    if (!exact && sub->source_address == J1939_ADDRESS_GLOBAL)
+      wildcard = sub;
+  }
+#endif /* J1939_SIZE_SUBSCRIPTION */
+  return wildcard;
+}
+
+static int j1939_receive_deliver(j1939_t *self, const j1939_message_t *msg) {
+  j1939_subscriber_t *sub = j1939_subscriber_find(self, j1939_get_pgn(msg->id), msg->pdu.source_address, 0);
+  if (sub == NULL)
+    return 1;
+
+  uint32_t tick = j1939_port_get_tick();
+  uint64_t value = 0;
+  switch ((j1939_delivery_t)sub->mode) {
+    case J1939_DELIVERY_ON_CHANGE:
+      /* multi-packet messages are not cached, they are always delivered */
+      if (msg->size > J1939_SIZE_DATAFIELD || msg->size > sizeof(value))
+        return 1;
+      memcpy(&value, msg->data, msg->size);
+      if (sub->delivered && sub->size == msg->size && ((value ^ sub->value) & sub->mask) == 0)
+        return 0;
+      sub->value = value;
+      sub->size = msg->size;
+      break;
+    case J1939_DELIVERY_RATE_LIMIT:
+      if (sub->delivered && tick - sub->tick < sub->interval)
+        return 0;
+      break;
+    default:
+      break;
+  }
+  sub->delivered = 1;
+  sub->tick = tick;
+
+  return 1;
+}
+
+j1939_status_t j1939_subscribe(j1939_t *self, const j1939_subscription_t *sub) {
+#if J1939_SIZE_SUBSCRIPTION
+  j1939_subscriber_t *s = j1939_subscriber_find(self, sub->pgn, sub->source_address, 1);
+  if (s == NULL) {
+    if (self->subscribers_count == J1939_SIZE_SUBSCRIPTION)
+      return J1939_ERROR;
+    s = &self->subscribers[self->subscribers_count++];
+  }
+
+  uint8_t mask[sizeof(s->mask)];
+  for (uint8_t idx = 0; idx < sizeof(mask); ++idx)
+    mask[idx] = (sub->ignore_mask >> idx) & 0x01 ? 0x00 : 0xFF;
+
+  memset(s, 0, sizeof(j1939_subscriber_t));
+  s->pgn = sub->pgn;
+  s->source_address = sub->source_address;
+  s->mode = sub->mode;
+  s->interval = sub->interval_ms;
+  memcpy(&s->mask, mask, sizeof(mask));
+
+  return J1939_OK;
+#else
+  return J1939_ERROR;
+#endif /* J1939_SIZE_SUBSCRIPTION */
+}
+
+j1939_status_t j1939_unsubscribe(j1939_t *self, uint32_t pgn, uint8_t source_address) {
+#if J1939_SIZE_SUBSCRIPTION
+  j1939_subscriber_t *sub = j1939_subscriber_find(self, pgn, source_address, 1);
+  if (sub == NULL)
+    return J1939_ERROR;
+
+  *sub = self->subscribers[--self->subscribers_count];
+
+  return J1939_OK;
+#else
+  return J1939_ERROR;
+#endif /* J1939_SIZE_SUBSCRIPTION */
+}
+
 j1939_message_t *j1939_message_create(uint32_t id, const void *data, uint16_t size) {
   if (size > J1939_TP_MAX_MSG_SIZE)
     return NULL;
-  j1939_message_t *self = (j1939_message_t *)malloc(sizeof(j1939_message_t) + size);
+#if J1939_STATIC
+  uint8_t idx = 0;
+  while (idx < J1939_SIZE_MESSAGE && (j1939_messages_used >> idx & 0x01))
+    ++idx;
+  if (size > J1939_SIZE_TP_BUFFER || idx == J1939_SIZE_MESSAGE)
+    return NULL;
+  j1939_messages_used |= 1U << idx;
+  j1939_message_t *self = (j1939_message_t *)j1939_messages[idx];
+#else
+  /* single frames are passed on as j1939_static_message_t, keep at least a full data field */
+  j1939_message_t *self = (j1939_message_t *)malloc(sizeof(j1939_message_t) + (size < J1939_SIZE_DATAFIELD ? J1939_SIZE_DATAFIELD : size));
+  if (self == NULL)
+    return NULL;
+#endif /* J1939_STATIC */
   self->id = id;
   self->size = size;
+#if J1939_TIMESTAMP
+  self->timestamp = self->timestamp_first = 0;
+#endif /* J1939_TIMESTAMP */
   data ? memcpy(self->data, data, size) : memset(self->data, 0, size);
   return self;
 }
 
 void j1939_message_delete(j1939_message_t *msg) {
+#if J1939_STATIC
+  if (msg)
+    j1939_messages_used &= ~(1U << ((uint8_t *)msg - (uint8_t *)j1939_messages) / sizeof(j1939_messages[0]));
+#else
   free(msg);
+#endif /* J1939_STATIC */
 }
 
-j1939_t *j1939_create(j1939_config_t *config) {
-  j1939_t *self = (j1939_t *)calloc(1, sizeof(struct j1939));
+j1939_status_t j1939_init(j1939_t *self, const j1939_config_t *config) {
+  memset(self, 0, sizeof(struct j1939));
   self->port = config->port;
-  self->self_address = config->self_address;
   self->recv_cb = config->recv_cb;
   self->timeout_cb = config->timeout_cb;
   self->arg = config->arg;
+  self->window = J1939_TP_CM_CTS_RESPONSE;
+  self->bam_interval = J1939_TP_BAM_TX_INTERVAL;
+  /* a handle without an address of its own only listens to broadcasts */
+  if (config->self_address < J1939_ADDRESS_NULL && j1939_add_address(self, config->self_address, config->recv_cb, config->arg) != J1939_OK)
+    return J1939_ERROR;
   #if defined J1939_PORT_VIRTUAL
   j1939_virtual_add_node(self->port);
+  #elif defined J1939_PORT_SHM
+  j1939_shm_add_node(self->port);
+  #endif /* J1939_PORT_VIRTUAL */
+  return J1939_OK;
+}
+
+j1939_status_t j1939_deinit(j1939_t *self) {
+  #if defined J1939_PORT_VIRTUAL
+  j1939_virtual_remove_node(self->port);
+  #elif defined J1939_PORT_SHM
+  j1939_shm_detach(self->port);
   #endif /* J1939_PORT_VIRTUAL */
+  for (uint8_t idx = 0; idx < self->locals_count; ++idx) {
+    j1939_message_delete(self->locals[idx].tx.lmsg);
+    j1939_message_delete(self->locals[idx].rx.lmsg);
+  }
+  j1939_message_delete(self->broadcast.lmsg);
+#if J1939_FILTER && !J1939_STATIC
+  free(self->filter);
+#endif /* J1939_FILTER && !J1939_STATIC */
+  return J1939_OK;
+}
+
+#if !J1939_STATIC
+j1939_t *j1939_create(j1939_config_t *config) {
+  j1939_t *self = (j1939_t *)malloc(sizeof(struct j1939));
+  if (self && j1939_init(self, config) != J1939_OK) {
+    free(self);
+    return NULL;
+  }
   return self;
 }
 
 j1939_status_t j1939_delete(j1939_t *self) {
-  if (self->lmsg)
-    j1939_message_delete(self->lmsg);
-
+  j1939_deinit(self);
   free(self);
   return J1939_OK;
 }
+#endif /* !J1939_STATIC */
 
-j1939_status_t j1939_transmit(j1939_t *self, const j1939_message_t *msg, uint32_t timeout_ms) {
+static j1939_status_t j1939_transmit_session(j1939_t *self, const j1939_message_t *msg, uint8_t interval, uint32_t timeout_ms) {
   j1939_status_t res = J1939_OK;
-  if (self->status != J1939_TP_READY)
-    res = J1939_BUSY;
-  else if (msg->size > J1939_TP_MAX_MSG_SIZE)
+  if (msg->size > J1939_TP_MAX_MSG_SIZE)
     res = J1939_ERROR;
-  else if (msg->size > J1939_SIZE_DATAFIELD) {
-    self->lmsg = (j1939_message_t *)msg;
-    self->total_packets = get_total_packets(msg->size);
+  else if (msg->size <= J1939_SIZE_DATAFIELD)
+    /* single frames may interleave with a running transport session */
+    res = j1939_port_transmit(self->port, (const j1939_static_message_t *)msg, timeout_ms);
+  else {
+    j1939_session_t *session = j1939_tx_session(self, msg->pdu.source_address);
+    if (session == NULL)
+      return J1939_ERROR;
+    if (session->status != J1939_TP_READY)
+      return J1939_BUSY;
+    session->lmsg = (j1939_message_t *)msg;
+    session->total_packets = get_total_packets(msg->size);
+    session->packets_count = 0;
+    session->interval = interval;
     if (msg->pdu.pdu_format < J1939_ADDRESS_DIVIDE)
-      res = j1939_tp_cm_rts_transmit_manager(self, timeout_ms);
+      res = j1939_tp_cm_rts_transmit_manager(self, session, timeout_ms);
     else
-      res = j1939_tp_cm_bam_transmit_manager(self, timeout_ms);
+      res = j1939_tp_cm_bam_transmit_manager(self, session, timeout_ms);
+    /* the handle only takes the message over once the session started */
+    if (res != J1939_OK)
+      session->lmsg = NULL;
   }
-  else
-    res = j1939_port_transmit(self->port, (const j1939_static_message_t *)msg, timeout_ms);
   return res;
 }
 
+j1939_status_t j1939_transmit(j1939_t *self, const j1939_message_t *msg, uint32_t timeout_ms) {
+  return j1939_transmit_session(self, msg, self->bam_interval, timeout_ms);
+}
+
+j1939_status_t j1939_transmit_bam(j1939_t *self, const j1939_message_t *msg, uint32_t interval_ms, uint32_t timeout_ms) {
+  return j1939_transmit_session(self, msg, j1939_tp_bam_interval(interval_ms), timeout_ms);
+}
+
+#if J1939_TIMESTAMP
+static void j1939_histogram_add(j1939_histogram_t *self, uint64_t value) {
+  uint8_t bucket = 0;
+  while (bucket + 1 < J1939_HISTOGRAM_BUCKETS && value >> (bucket + 1))
+    ++bucket;
+  self->buckets[bucket] += 1;
+  if (self->count == 0 || value < self->min)
+    self->min = value;
+  if (value > self->max)
+    self->max = value;
+  self->sum += value;
+  self->count += 1;
+}
+
+uint64_t j1939_histogram_percentile(const j1939_histogram_t *histogram, double percentile) {
+  uint64_t rank = (uint64_t)(percentile / 100 * histogram->count + 0.5), count = 0;
+  for (uint8_t bucket = 0; bucket < J1939_HISTOGRAM_BUCKETS; ++bucket) {
+    if ((count += histogram->buckets[bucket]) >= rank && count) {
+      uint64_t bound = (2ULL << bucket) - 1;
+      return bound < histogram->max ? bound : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+#endif /* J1939_TIMESTAMP */
+
+/* a message addressed to a local address goes to its callback, anything else to the handle's, once */
+static void j1939_receive_dispatch(j1939_t *self, const j1939_message_t *msg) {
+  j1939_local_t *local = msg->pdu.pdu_format < J1939_ADDRESS_DIVIDE ? j1939_local_find(self, msg->pdu.pdu_specific) : NULL;
+  if (self->cache)
+    j1939_cache_update(self->cache, msg);
+  if (!j1939_receive_deliver(self, msg))
+    return;
+#if J1939_TIMESTAMP
+  j1939_histogram_add(&self->latency[J1939_LATENCY_CALLBACK], j1939_port_get_time() - msg->timestamp);
+#endif /* J1939_TIMESTAMP */
+  if (local && local->recv_cb)
+    local->recv_cb(self->port, msg, local->arg);
+  else if (self->recv_cb)
+    self->recv_cb(self->port, msg, self->arg);
+}
+
 j1939_status_t j1939_receive(j1939_t *self, uint32_t timeout_ms) {
   j1939_status_t res = J1939_OK;
   j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
-  if ((res = j1939_port_receive(self->port, &m, timeout_ms)) == J1939_OK && (res = j1939_receive_filter(self, (j1939_message_t *)&m)) == J1939_OK) {
+  if ((res = j1939_port_receive(self->port, &m, timeout_ms)) == J1939_OK && m.size > J1939_SIZE_DATAFIELD)
+    /* no CAN frame carries more than one data field, whatever the port delivered */
+    res = J1939_ERROR;
+  if (res == J1939_OK && (res = j1939_receive_filter(self, (j1939_message_t *)&m)) == J1939_OK) {
+    j1939_session_t *session = NULL;
     switch (j1939_get_pgn(m.id)) {
       case J1939_PGN_TP_CM:
         j1939_tp_cm_receive_manager(self, &m);
         break;
       case J1939_PGN_TP_DT:
-        j1939_tp_dt_receive_manager(self, &m);
-        if (self->status == J1939_TP_COMPLETE_RX) {
-          self->recv_cb(self->port, self->lmsg, self->arg);
-          self->status = J1939_TP_READY;
+        if ((session = j1939_session_find(self, m.pdu.pdu_specific)) == NULL || m.size != J1939_SIZE_DATAFIELD)
+          break;
+        j1939_tp_dt_receive_manager(self, session, &m);
+        if (session->status == J1939_TP_COMPLETE_RX) {
+#if J1939_TIMESTAMP
+          j1939_histogram_add(&self->latency[J1939_LATENCY_TP], session->lmsg->timestamp - session->lmsg->timestamp_first);
+#endif /* J1939_TIMESTAMP */
+          j1939_receive_dispatch(self, session->lmsg);
+          j1939_tp_release(self, session);
         }
         break;
       default:
-        self->recv_cb(self->port, (j1939_message_t *)&m, self->arg);
+        j1939_receive_dispatch(self, (j1939_message_t *)&m);
         break;
     }
   }
   return res;
 }
 
+j1939_status_t j1939_set_cache(j1939_t *self, j1939_cache_t *cache) {
+  self->cache = cache;
+  return J1939_OK;
+}
+
+j1939_status_t j1939_set_tp_window(j1939_t *self, uint8_t packets) {
+  if (packets == 0)
+    return J1939_ERROR;
+  self->window = packets;
+  return J1939_OK;
+}
+
+j1939_status_t j1939_set_filter(j1939_t *self, const j1939_filter_t *filter, uint8_t filter_count, const j1939_pgn_range_t *range, uint8_t range_count) {
+#if J1939_FILTER
+  j1939_filter_bank_t *bank = NULL;
+  for (uint8_t idx = 0; idx < range_count; ++idx) {
+    if (range[idx].first > range[idx].last || range[idx].last > 0x3FFFF)
+      return J1939_ERROR;
+  }
+  if ((filter_count || range_count) && (bank = j1939_filter_compile(self, filter, filter_count, range, range_count)) == NULL)
+    return J1939_ERROR;
+#if !J1939_STATIC
+  free(self->filter);
+#endif /* !J1939_STATIC */
+  self->filter = bank;
+
+  /* best effort, the bank still filters whatever the port lets through */
+  j1939_filter_t port[J1939_SIZE_PORT_FILTER];
+  uint16_t count = bank ? j1939_filter_port(bank, port, J1939_SIZE_PORT_FILTER) : 0;
+  j1939_port_set_filter(self->port, port, count);
+
+  return J1939_OK;
+#else
+  return J1939_ERROR;
+#endif /* J1939_FILTER */
+}
+
+j1939_status_t j1939_set_bam_interval(j1939_t *self, uint32_t interval_ms) {
+  self->bam_interval = j1939_tp_bam_interval(interval_ms);
+  return J1939_OK;
+}
+
+#if J1939_TIMESTAMP
+j1939_status_t j1939_get_latency(j1939_t *self, j1939_latency_t latency, j1939_histogram_t *histogram) {
+  if (latency >= J1939_LATENCY_MAX)
+    return J1939_ERROR;
+  *histogram = self->latency[latency];
+  return J1939_OK;
+}
+
+j1939_status_t j1939_reset_latency(j1939_t *self) {
+  memset(self->latency, 0, sizeof(self->latency));
+  return J1939_OK;
+}
+#endif /* J1939_TIMESTAMP */
+
+j1939_status_t j1939_add_address(j1939_t *self, uint8_t address, j1939_cb_t recv_cb, void *arg) {
+  if (address >= J1939_ADDRESS_NULL || j1939_is_local(self, address) || self->locals_count == J1939_SIZE_ADDRESS)
+    return J1939_ERROR;
+  j1939_local_t *local = &self->locals[self->locals_count++];
+  memset(local, 0, sizeof(j1939_local_t));
+  local->address = address;
+  local->recv_cb = recv_cb;
+  local->arg = arg;
+  self->addresses[address / 32] |= 1U << (address % 32);
+  return J1939_OK;
+}
+
+j1939_status_t j1939_remove_address(j1939_t *self, uint8_t address) {
+  j1939_local_t *local = j1939_local_find(self, address);
+  /* the first address stays, it sends for any other source */
+  if (local == NULL || local == &self->locals[0])
+    return J1939_ERROR;
+  j1939_message_delete(local->tx.lmsg);
+  j1939_message_delete(local->rx.lmsg);
+  *local = self->locals[--self->locals_count];
+  self->addresses[address / 32] &= ~(1U << (address % 32));
+  return J1939_OK;
+}
+
 j1939_status_t j1939_status(j1939_t *self) {
-  return (self->status == J1939_TP_READY) ? J1939_OK : J1939_BUSY;
+  if (self->broadcast.status != J1939_TP_READY)
+    return J1939_BUSY;
+  for (uint8_t idx = 0; idx < self->locals_count; ++idx) {
+    if (self->locals[idx].tx.status != J1939_TP_READY || self->locals[idx].rx.status != J1939_TP_READY)
+      return J1939_BUSY;
+  }
+  return J1939_OK;
+}
+
+j1939_status_t j1939_tx_status(j1939_t *self, uint8_t source_address) {
+  j1939_session_t *session = j1939_tx_session(self, source_address);
+  if (session == NULL)
+    return J1939_ERROR;
+  return session->status == J1939_TP_READY ? J1939_OK : J1939_BUSY;
 }
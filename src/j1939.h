@@ -20,32 +20,133 @@ extern "C" {
 #endif /* __cplusplus */
 
 #include "j1939_types.h"
+#include "j1939_cache.h"
 
 typedef void (*j1939_cb_t)(j1939_port_t *port, const j1939_message_t *msg, void *arg);
 
 typedef struct j1939_config {
+  /* J1939_ADDRESS_NULL for a handle that only listens to broadcasts, it sends single frames but no transport messages */
   uint8_t self_address;
   j1939_cb_t recv_cb;
+  /* transport session that timed out, gets its message (sent or partly received) before it is deleted */
   j1939_cb_t timeout_cb;
   j1939_port_t *port;
   void *arg;
 } j1939_config_t;
 
+typedef enum j1939_delivery {
+  /* every frame reaches recv_cb */
+  J1939_DELIVERY_ALWAYS,
+  /* only frames whose payload differs from the last delivered one */
+  J1939_DELIVERY_ON_CHANGE,
+  /* at most one frame per interval_ms */
+  J1939_DELIVERY_RATE_LIMIT,
+} j1939_delivery_t;
+
+typedef struct j1939_subscription {
+  uint32_t pgn;
+  /* 0xFF subscribes every source, which then share one delivery state */
+  uint8_t source_address;
+  /* bit n set excludes data byte n from J1939_DELIVERY_ON_CHANGE, e.g. counters and checksums */
+  uint8_t ignore_mask;
+  j1939_delivery_t mode;
+  uint32_t interval_ms;
+} j1939_subscription_t;
+
+/* PGNs first to last, inclusive */
+typedef struct j1939_pgn_range {
+  uint32_t first;
+  uint32_t last;
+} j1939_pgn_range_t;
+
+#if J1939_TIMESTAMP
+#define J1939_HISTOGRAM_BUCKETS             40
+
+/* log2 histogram of ns values, bucket n counts values from 2^n to 2^(n+1) - 1, bucket 0 also 0 */
+typedef struct j1939_histogram {
+  uint32_t count;
+  uint64_t min;
+  uint64_t max;
+  uint64_t sum;
+  uint32_t buckets[J1939_HISTOGRAM_BUCKETS];
+} j1939_histogram_t;
+
+typedef enum j1939_latency {
+  /* frame passing the port until its recv_cb call */
+  J1939_LATENCY_CALLBACK,
+  /* RTS/BAM until the last packet of received transport messages */
+  J1939_LATENCY_TP,
+  J1939_LATENCY_MAX,
+} j1939_latency_t;
+#endif /* J1939_TIMESTAMP */
+
 typedef struct j1939 j1939_t;
 
+uint32_t j1939_get_pgn(uint32_t pdu);
+void j1939_set_pgn(uint32_t *pdu, const uint32_t pgn);
+
 j1939_message_t *j1939_message_create(uint32_t id, const void *data, uint16_t size);
 void j1939_message_delete(j1939_message_t *msg);
 
+#if !J1939_STATIC
 j1939_t *j1939_create(j1939_config_t *config);
 j1939_status_t j1939_delete(j1939_t *self);
+#endif /* !J1939_STATIC */
+/* sets up a handle in storage of its own, see J1939_DEFINE_HANDLE in j1939_handle.h */
+j1939_status_t j1939_init(j1939_t *self, const j1939_config_t *config);
+j1939_status_t j1939_deinit(j1939_t *self);
 
+/* J1939_BUSY while any transport session runs, including broadcasts received from other ECUs */
 j1939_status_t j1939_status(j1939_t *self);
+/* J1939_OK once a transport message from source_address can be sent, J1939_BUSY while the one before
+ * is still going, J1939_ERROR if the handle has no local address to send it from */
+j1939_status_t j1939_tx_status(j1939_t *self, uint8_t source_address);
 
+/* keeps cache up to date with every received message, NULL detaches it */
+j1939_status_t j1939_set_cache(j1939_t *self, j1939_cache_t *cache);
+
+/* acceptance filter bank, a frame passes if it matches any filter or its PGN lies in any range.
+ * frames are dropped before they are cached or delivered, and the bank is pushed down to the port
+ * where it supports hardware filtering. transport messages are accepted by the PGN they carry.
+ * both counts 0 accept everything */
+j1939_status_t j1939_set_filter(j1939_t *self, const j1939_filter_t *filter, uint8_t filter_count, const j1939_pgn_range_t *range, uint8_t range_count);
+
+/* serves one more local address (logical ECU) on the handle's port. frames addressed to it go to
+ * recv_cb, or to the handle's callback if NULL, and it runs transport sessions of its own.
+ * broadcasts are delivered once, to the handle's callback */
+j1939_status_t j1939_add_address(j1939_t *self, uint8_t address, j1939_cb_t recv_cb, void *arg);
+/* the address from j1939_config_t, or the first one added without it, can not be removed */
+j1939_status_t j1939_remove_address(j1939_t *self, uint8_t address);
+
+/* packets this handle clears per CTS when receiving, the sender's RTS limit still applies */
+j1939_status_t j1939_set_tp_window(j1939_t *self, uint8_t packets);
+
+/* BAM packet spacing, clamped to 10 to 200 ms, 0 sends the packets back to back (J1939_TP_BAM_TX_BURST) */
+j1939_status_t j1939_set_bam_interval(j1939_t *self, uint32_t interval_ms);
+
+/* a message longer than J1939_SIZE_DATAFIELD starts a transport session. on J1939_OK the handle owns msg,
+ * it has to come from j1939_message_create and is deleted once the session ends. single frames, and
+ * messages that are refused (any other status), stay with the caller */
 j1939_status_t j1939_transmit(j1939_t *self, const j1939_message_t *msg, uint32_t timeout_ms);
+/* as j1939_transmit, a broadcast transport message is paced by interval_ms instead of the handle setting */
+j1939_status_t j1939_transmit_bam(j1939_t *self, const j1939_message_t *msg, uint32_t interval_ms, uint32_t timeout_ms);
 
 j1939_status_t j1939_receive(j1939_t *self, uint32_t timeout_ms);
 
+/* messages without a subscription are always delivered */
+j1939_status_t j1939_subscribe(j1939_t *self, const j1939_subscription_t *sub);
+j1939_status_t j1939_unsubscribe(j1939_t *self, uint32_t pgn, uint8_t source_address);
+
+#if J1939_TIMESTAMP
+j1939_status_t j1939_get_latency(j1939_t *self, j1939_latency_t latency, j1939_histogram_t *histogram);
+j1939_status_t j1939_reset_latency(j1939_t *self);
+/* upper bound (ns) of the bucket holding the percentile (0 to 100), capped by the maximum */
+uint64_t j1939_histogram_percentile(const j1939_histogram_t *histogram, double percentile);
+#endif /* J1939_TIMESTAMP */
+
 j1939_status_t j1939_tp_cm_transmit_manager(j1939_t *self, uint32_t timeout_ms);
+/* ticks until j1939_tp_cm_transmit_manager has a packet to send or a session to time out, 0 if one is due now, UINT32_MAX if none */
+uint32_t j1939_tp_next_deadline(j1939_t *self);
 
 static inline j1939_status_t j1939_transmit_static(j1939_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
   return j1939_transmit(self, (const j1939_message_t *)msg, timeout_ms);
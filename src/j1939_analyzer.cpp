@@ -0,0 +1,226 @@
+#include "j1939_analyzer.h"
+#include "j1939.h"
+#include "j1939_tp.h"
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cstring>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* shards per thread, more shards even out connections of very different size */
+static constexpr size_t shards_per_thread = 8;
+
+struct session_t {
+  uint64_t first_us;
+  uint64_t last_us;
+  uint32_t pgn;
+  uint16_t size;
+  uint8_t total_packets;
+  uint8_t received_packets;
+  bool bam;
+  std::bitset<256> seen;
+  std::vector<uint8_t> data;
+};
+
+struct output_t {
+  j1939_analyzer_message_t msg;
+  std::vector<uint8_t> data;
+};
+
+struct shard_t {
+  std::unordered_map<uint32_t, session_t> sessions;
+  std::vector<output_t> output;
+};
+
+template <typename F>
+static void parallel(uint16_t threads, size_t jobs, F &&func) {
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t job; (job = next++) < jobs;)
+      func(job);
+  };
+  std::vector<std::thread> pool;
+  for (uint16_t idx = 1; idx < threads && idx < jobs; ++idx)
+    pool.emplace_back(work);
+  work();
+  for (auto &thread : pool)
+    thread.join();
+}
+
+static inline uint32_t session_key(uint8_t channel, uint8_t sa, uint8_t da) {
+  return (uint32_t)channel << 16 | (uint32_t)sa << 8 | da;
+}
+
+static inline uint64_t session_timeout(const session_t &session) {
+  /* Reference SAE J1939-21 5.10.2.4, the longest time a healthy session stays silent */
+  return (session.bam ? J1939_TIMEOUT_T1 : J1939_TIMEOUT_T3) * 1000ULL;
+}
+
+static void emit(shard_t &shard, uint32_t key, session_t &session, j1939_analyzer_event_t event, uint64_t timestamp_us, uint8_t reason) {
+  output_t out;
+  out.msg = {};
+  out.msg.timestamp_us = timestamp_us;
+  out.msg.first_us = session.first_us;
+  out.msg.last_us = session.last_us;
+  out.msg.pgn = session.pgn;
+  out.msg.channel = key >> 16;
+  out.msg.source_address = key >> 8;
+  out.msg.destination_address = key;
+  out.msg.event = event;
+  out.msg.abort_reason = reason;
+  out.msg.size = session.size;
+  out.msg.total_packets = session.total_packets;
+  out.msg.received_packets = session.received_packets;
+  out.data = std::move(session.data);
+  shard.output.push_back(std::move(out));
+}
+
+static session_t *session_find(shard_t &shard, uint32_t key, uint64_t timestamp_us) {
+  auto it = shard.sessions.find(key);
+  if (it == shard.sessions.end())
+    return nullptr;
+  if (timestamp_us - it->second.last_us > session_timeout(it->second)) {
+    emit(shard, key, it->second, J1939_ANALYZER_TIMEOUT, it->second.last_us + session_timeout(it->second), 0);
+    shard.sessions.erase(it);
+    return nullptr;
+  }
+  return &it->second;
+}
+
+static void session_open(shard_t &shard, const j1939_log_record_t &record, uint8_t sa, uint8_t da) {
+  j1939_bam_t bam;
+  memcpy(&bam, record.data, sizeof(bam));
+  /* j1939_rts_t shares the layout of the fields used here */
+  if (bam.message_size <= J1939_SIZE_DATAFIELD || bam.message_size > J1939_TP_MAX_MSG_SIZE || bam.total_packets != get_total_packets(bam.message_size))
+    return;
+
+  uint32_t key = session_key(record.channel, sa, da);
+  if (session_t *old = session_find(shard, key, record.timestamp_us)) {
+    emit(shard, key, *old, J1939_ANALYZER_RESTART, record.timestamp_us, 0);
+    shard.sessions.erase(key);
+  }
+
+  session_t &session = shard.sessions[key];
+  session.first_us = session.last_us = record.timestamp_us;
+  session.pgn = bam.pgn;
+  session.size = bam.message_size;
+  session.total_packets = bam.total_packets;
+  session.received_packets = 0;
+  session.bam = da == J1939_ADDRESS_GLOBAL;
+  session.seen.reset();
+  session.data.assign(session.size, 0xFF);
+}
+
+static void feed(shard_t &shard, const j1939_log_record_t &record) {
+  uint8_t sa = record.id & 0xFF, da = (record.id >> 8) & 0xFF;
+  uint32_t key;
+  session_t *session;
+
+  if (j1939_get_pgn(record.id) == J1939_PGN_TP_DT) {
+    key = session_key(record.channel, sa, da);
+    if ((session = session_find(shard, key, record.timestamp_us)) == nullptr)
+      return;
+    uint8_t seq = record.data[0];
+    if (seq == 0 || seq > session->total_packets)
+      return;
+    session->last_us = record.timestamp_us;
+    uint16_t offset = (seq - 1) * J1939_SIZE_PROTOCOL_PAYLOAD;
+    memcpy(session->data.data() + offset, &record.data[1], std::min<uint16_t>(J1939_SIZE_PROTOCOL_PAYLOAD, session->size - offset));
+    if (!session->seen.test(seq)) {
+      session->seen.set(seq);
+      /* retransmitted packets after a CTS are not counted twice */
+      if (++session->received_packets == session->total_packets) {
+        emit(shard, key, *session, J1939_ANALYZER_COMPLETE, record.timestamp_us, 0);
+        shard.sessions.erase(key);
+      }
+    }
+    return;
+  }
+
+  switch (record.data[0]) {
+    case J1939_CONTROL_BAM:
+    case J1939_CONTROL_RTS:
+      session_open(shard, record, sa, da);
+      break;
+    case J1939_CONTROL_CTS:
+    case J1939_CONTROL_ACK:
+      /* sent by the receiver, keeps the sender's session alive */
+      if ((session = session_find(shard, session_key(record.channel, da, sa), record.timestamp_us)))
+        session->last_us = record.timestamp_us;
+      break;
+    case J1939_CONTROL_ABORT:
+      /* either side may abort */
+      for (uint32_t k : {session_key(record.channel, sa, da), session_key(record.channel, da, sa)}) {
+        if ((session = session_find(shard, k, record.timestamp_us))) {
+          session->last_us = record.timestamp_us;
+          emit(shard, k, *session, J1939_ANALYZER_ABORT, record.timestamp_us, record.data[1]);
+          shard.sessions.erase(k);
+          break;
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+extern "C" j1939_status_t j1939_analyze(j1939_log_t *log, uint16_t threads, j1939_analyzer_cb_t cb, void *arg) {
+  if (threads == 0)
+    threads = std::max(1U, std::thread::hardware_concurrency());
+  uint64_t count = j1939_log_count(log);
+  size_t chunks = threads, shards = threads * shards_per_thread;
+
+  /* pass 1, split the log into chunks and sort every transport frame into its connection shard */
+  std::vector<std::vector<std::vector<uint64_t>>> frames(chunks, std::vector<std::vector<uint64_t>>(shards));
+  parallel(threads, chunks, [&](size_t chunk) {
+    for (uint64_t idx = count * chunk / chunks; idx < count * (chunk + 1) / chunks; ++idx) {
+      const j1939_log_record_t *record = j1939_log_record(log, idx);
+      uint32_t pgn = j1939_get_pgn(record->id);
+      if (pgn != J1939_PGN_TP_CM && pgn != J1939_PGN_TP_DT)
+        continue;
+      /* both directions of a connection end up in the same shard */
+      uint8_t sa = record->id & 0xFF, da = (record->id >> 8) & 0xFF;
+      uint32_t key = session_key(record->channel, std::min(sa, da), std::max(sa, da));
+      frames[chunk][(key * 2654435761U) % shards].push_back(idx);
+    }
+  });
+
+  /* pass 2, reassemble every shard on its own, chunks are visited in order to keep time order */
+  std::vector<shard_t> output(shards);
+  parallel(threads, shards, [&](size_t idx) {
+    shard_t &shard = output[idx];
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+      for (uint64_t frame : frames[chunk][idx])
+        feed(shard, *j1939_log_record(log, frame));
+      std::vector<uint64_t>().swap(frames[chunk][idx]);
+    }
+    for (auto &[key, session] : shard.sessions)
+      emit(shard, key, session, J1939_ANALYZER_TIMEOUT, session.last_us + session_timeout(session), 0);
+    shard.sessions.clear();
+    std::stable_sort(shard.output.begin(), shard.output.end(), [](const output_t &l, const output_t &r) {
+      return l.msg.timestamp_us < r.msg.timestamp_us;
+    });
+  });
+
+  /* pass 3, merge the sorted shards */
+  using head_t = std::pair<uint64_t, std::pair<size_t, size_t>>;
+  std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+  for (size_t idx = 0; idx < shards; ++idx) {
+    if (!output[idx].output.empty())
+      heads.push({output[idx].output[0].msg.timestamp_us, {idx, 0}});
+  }
+  while (!heads.empty()) {
+    auto [shard, pos] = heads.top().second;
+    heads.pop();
+    output_t &out = output[shard].output[pos];
+    out.msg.data = out.data.data();
+    cb(&out.msg, arg);
+    if (++pos < output[shard].output.size())
+      heads.push({output[shard].output[pos].msg.timestamp_us, {shard, pos}});
+  }
+
+  return J1939_OK;
+}
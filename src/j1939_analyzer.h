@@ -0,0 +1,66 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_ANALYZER_H
+#define J1939_ANALYZER_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939_log.h"
+
+/* Offline transport protocol analysis of a recorded log.
+ * Frames are sharded by (channel, address pair), every shard reassembles all of its
+ * BAM/CMDT sessions passively, shards run in parallel and the results are merged in time order. */
+
+typedef enum j1939_analyzer_event {
+  J1939_ANALYZER_COMPLETE,
+  /* connection abort seen, abort_reason holds the reason */
+  J1939_ANALYZER_ABORT,
+  /* no session traffic within the SAE J1939-21 timeout, or end of log */
+  J1939_ANALYZER_TIMEOUT,
+  /* the sender announced a new message before finishing this one */
+  J1939_ANALYZER_RESTART,
+} j1939_analyzer_event_t;
+
+typedef struct j1939_analyzer_message {
+  /* time of the event, records are merged in this order */
+  uint64_t timestamp_us;
+  /* first (announce) and last frame of the session */
+  uint64_t first_us;
+  uint64_t last_us;
+  uint32_t pgn;
+  uint8_t channel;
+  uint8_t source_address;
+  uint8_t destination_address;
+  uint8_t event;
+  uint8_t abort_reason;
+  /* announced message size and number of packets actually received */
+  uint16_t size;
+  uint8_t total_packets;
+  uint8_t received_packets;
+  /* size bytes, packets that never arrived are left 0xFF */
+  const uint8_t *data;
+} j1939_analyzer_message_t;
+
+typedef void (*j1939_analyzer_cb_t)(const j1939_analyzer_message_t *msg, void *arg);
+
+/* threads 0 uses every available core, cb is called from the calling thread only */
+j1939_status_t j1939_analyze(j1939_log_t *log, uint16_t threads, j1939_analyzer_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_ANALYZER_H */
@@ -0,0 +1,164 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939_cache.h"
+#include "j1939.h"
+#include "j1939_port.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define J1939_CACHE_MAGIC                   0x4A314C43/* "J1LC" */
+#define J1939_CACHE_KEY_EMPTY               UINT32_MAX
+
+typedef struct j1939_cache_entry {
+  /* odd while the writer is updating the entry */
+  atomic_uint_least32_t seq;
+  /* pgn << 8 | source address, published once the first value is in place */
+  atomic_uint_least32_t key;
+  uint64_t timestamp;
+  uint16_t size;
+  uint8_t data[];
+} j1939_cache_entry_t;
+
+struct j1939_cache {
+  uint32_t magic;
+  uint16_t capacity;
+  uint16_t max_size;
+  uint32_t max_age;
+  uint32_t stride;
+  /* updates dropped because the cache was full */
+  uint32_t dropped;
+  uint32_t reserved;
+  uint64_t entries[];
+};
+
+/* port time rather than ticks, it is the same clock in every process mapping the cache */
+static inline uint64_t j1939_cache_time(const j1939_message_t *msg) {
+#if J1939_TIMESTAMP
+  if (msg->timestamp)
+    return msg->timestamp;
+#endif /* J1939_TIMESTAMP */
+  return j1939_port_get_time();
+}
+
+static inline uint32_t j1939_cache_stride(uint16_t max_size) {
+  /* keep every entry 8 byte aligned */
+  return (sizeof(j1939_cache_entry_t) + max_size + 7) & ~7U;
+}
+
+static inline uint32_t j1939_cache_capacity(uint16_t capacity) {
+  uint32_t res = 1;
+  while (res < capacity)
+    res <<= 1;
+  return res;
+}
+
+static inline j1939_cache_entry_t *j1939_cache_entry(j1939_cache_t *self, uint32_t index) {
+  return (j1939_cache_entry_t *)((uint8_t *)self->entries + index * self->stride);
+}
+
+static j1939_cache_entry_t *j1939_cache_find(j1939_cache_t *self, uint32_t key, int insert) {
+  uint32_t mask = self->capacity - 1;
+  uint32_t index = (key * 2654435761U) & mask;
+  for (uint32_t probe = 0; probe < self->capacity; ++probe, index = (index + 1) & mask) {
+    j1939_cache_entry_t *entry = j1939_cache_entry(self, index);
+    uint32_t k = atomic_load_explicit(&entry->key, memory_order_acquire);
+    if (k == key || (k == J1939_CACHE_KEY_EMPTY && insert))
+      return entry;
+    if (k == J1939_CACHE_KEY_EMPTY)
+      break;
+  }
+  return NULL;
+}
+
+size_t j1939_cache_footprint(uint16_t capacity, uint16_t max_size) {
+  return sizeof(struct j1939_cache) + (size_t)j1939_cache_capacity(capacity) * j1939_cache_stride(max_size);
+}
+
+j1939_cache_t *j1939_cache_init(void *mem, uint16_t capacity, uint16_t max_size, uint32_t max_age_ms) {
+  if (mem == NULL || capacity == 0 || j1939_cache_capacity(capacity) > UINT16_MAX)
+    return NULL;
+  j1939_cache_t *self = (j1939_cache_t *)mem;
+  memset(self, 0, j1939_cache_footprint(capacity, max_size));
+  self->capacity = j1939_cache_capacity(capacity);
+  self->max_size = max_size;
+  self->max_age = max_age_ms;
+  self->stride = j1939_cache_stride(max_size);
+  for (uint32_t idx = 0; idx < self->capacity; ++idx)
+    atomic_init(&j1939_cache_entry(self, idx)->key, J1939_CACHE_KEY_EMPTY);
+  atomic_thread_fence(memory_order_release);
+  self->magic = J1939_CACHE_MAGIC;
+  return self;
+}
+
+j1939_cache_t *j1939_cache_attach(void *mem) {
+  return mem && ((j1939_cache_t *)mem)->magic == J1939_CACHE_MAGIC ? (j1939_cache_t *)mem : NULL;
+}
+
+j1939_cache_t *j1939_cache_create(uint16_t capacity, uint16_t max_size, uint32_t max_age_ms) {
+  return j1939_cache_init(malloc(j1939_cache_footprint(capacity, max_size)), capacity, max_size, max_age_ms);
+}
+
+j1939_status_t j1939_cache_delete(j1939_cache_t *self) {
+  free(self);
+  return J1939_OK;
+}
+
+j1939_status_t j1939_cache_update(j1939_cache_t *self, const j1939_message_t *msg) {
+  uint32_t key = j1939_get_pgn(msg->id) << 8 | msg->pdu.source_address;
+  j1939_cache_entry_t *entry = j1939_cache_find(self, key, 1);
+  if (entry == NULL) {
+    ++self->dropped;
+    return J1939_ERROR;
+  }
+
+  uint32_t seq = atomic_load_explicit(&entry->seq, memory_order_relaxed);
+  atomic_store_explicit(&entry->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  entry->timestamp = j1939_cache_time(msg);
+  entry->size = msg->size;
+  memcpy(entry->data, msg->data, msg->size < self->max_size ? msg->size : self->max_size);
+  atomic_store_explicit(&entry->seq, seq + 2, memory_order_release);
+
+  if (atomic_load_explicit(&entry->key, memory_order_relaxed) != key)
+    atomic_store_explicit(&entry->key, key, memory_order_release);
+
+  return J1939_OK;
+}
+
+j1939_status_t j1939_cache_read(j1939_cache_t *self, uint32_t pgn, uint8_t source_address, void *data, uint16_t size, j1939_cache_info_t *info) {
+  j1939_cache_entry_t *entry = j1939_cache_find(self, pgn << 8 | source_address, 0);
+  if (entry == NULL)
+    return J1939_ERROR;
+
+  j1939_cache_info_t snapshot;
+  uint32_t seq;
+  do {
+    while ((seq = atomic_load_explicit(&entry->seq, memory_order_acquire)) & 0x01);
+    snapshot.timestamp = entry->timestamp;
+    snapshot.size = entry->size;
+    uint16_t copy = snapshot.size < self->max_size ? snapshot.size : self->max_size;
+    if (data)
+      memcpy(data, entry->data, copy < size ? copy : size);
+    atomic_thread_fence(memory_order_acquire);
+  } while (atomic_load_explicit(&entry->seq, memory_order_relaxed) != seq);
+
+  snapshot.stale = self->max_age && j1939_port_get_time() - snapshot.timestamp > self->max_age * 1000000ULL;
+  if (info)
+    *info = snapshot;
+
+  return J1939_OK;
+}
@@ -0,0 +1,58 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_CACHE_H
+#define J1939_CACHE_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939_types.h"
+#include <stddef.h>
+
+/* Last value cache of (pgn, source address) pairs.
+ * A single writer updates entries without ever blocking, any number of readers
+ * take consistent snapshots through a per entry sequence lock. The cache holds
+ * no pointers, so it can be placed in memory shared with other processes. */
+typedef struct j1939_cache j1939_cache_t;
+
+typedef struct j1939_cache_info {
+  /* port time (ns) of the last update, the frame's timestamp if it has one */
+  uint64_t timestamp;
+  /* size of the cached message, may exceed the size copied out */
+  uint16_t size;
+  /* no update within max_age_ms */
+  uint8_t stale;
+} j1939_cache_info_t;
+
+/* bytes needed to place a cache with these parameters */
+size_t j1939_cache_footprint(uint16_t capacity, uint16_t max_size);
+
+/* formats a cache inside caller provided memory of j1939_cache_footprint bytes */
+j1939_cache_t *j1939_cache_init(void *mem, uint16_t capacity, uint16_t max_size, uint32_t max_age_ms);
+/* attaches to a cache formatted by j1939_cache_init, e.g. in another process */
+j1939_cache_t *j1939_cache_attach(void *mem);
+
+j1939_cache_t *j1939_cache_create(uint16_t capacity, uint16_t max_size, uint32_t max_age_ms);
+j1939_status_t j1939_cache_delete(j1939_cache_t *self);
+
+/* messages longer than max_size are truncated, new keys are dropped once the cache is full */
+j1939_status_t j1939_cache_update(j1939_cache_t *self, const j1939_message_t *msg);
+j1939_status_t j1939_cache_read(j1939_cache_t *self, uint32_t pgn, uint8_t source_address, void *data, uint16_t size, j1939_cache_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_CACHE_H */
@@ -0,0 +1,232 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939_dm1.h"
+#include "j1939.h"
+#include "j1939_tp.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* source address 0xFF never transmits, so its keys are free to mark empty slots */
+#define J1939_DM1_EMPTY                     UINT32_MAX
+#define J1939_DM1_NONE                      UINT16_MAX
+#define J1939_DM1_LAMP_UNKNOWN              0xFFFF
+
+typedef struct j1939_dm1_entry {
+  /* source address << 24 | spn << 5 | fmi */
+  uint32_t key;
+  /* next entry of the same source */
+  uint16_t next;
+  uint8_t oc;
+  /* generation of the source's DM1 that last listed the DTC */
+  uint8_t generation;
+} j1939_dm1_entry_t;
+
+typedef struct j1939_dm1_source {
+  uint16_t head;
+  uint16_t count;
+  uint16_t lamp;
+  uint8_t generation;
+  uint8_t reserved;
+} j1939_dm1_source_t;
+
+struct j1939_dm1 {
+  j1939_dm1_cb_t cb;
+  void *arg;
+  uint16_t capacity;
+  uint16_t count;
+  uint32_t mask;
+  j1939_dm1_source_t sources[0x100];
+  j1939_dm1_entry_t entries[];
+};
+
+static inline uint32_t j1939_dm1_home(j1939_dm1_t *self, uint32_t key) {
+  return (key * 2654435761U) & self->mask;
+}
+
+static inline j1939_dtc_t j1939_dm1_dtc(const j1939_dm1_entry_t *entry) {
+  return (j1939_dtc_t){ .spn = (entry->key >> 5) & 0x7FFFF, .fmi = entry->key & 0x1F, .oc = entry->oc, };
+}
+
+/* Reference SAE J1939-73 5.7.1, lamps in bytes 0-1 then 4 bytes per DTC */
+static inline uint32_t j1939_dm1_key(uint8_t sa, const uint8_t *dtc) {
+  uint32_t spn = dtc[0] | dtc[1] << 8 | (uint32_t)(dtc[2] & 0xE0) << 11;
+  uint8_t fmi = dtc[2] & 0x1F;
+  /* SPN 0 is sent when nothing is active, all ones pads the last frame */
+  if (spn == 0 || (spn == 0x7FFFF && fmi == 0x1F))
+    return J1939_DM1_EMPTY;
+  return (uint32_t)sa << 24 | spn << 5 | fmi;
+}
+
+/* slot holding key, or the empty slot it would be inserted at */
+static uint32_t j1939_dm1_find(j1939_dm1_t *self, uint32_t key) {
+  uint32_t idx = j1939_dm1_home(self, key);
+  while (self->entries[idx].key != key && self->entries[idx].key != J1939_DM1_EMPTY)
+    idx = (idx + 1) & self->mask;
+  return idx;
+}
+
+static void j1939_dm1_relink(j1939_dm1_t *self, uint32_t from, uint32_t to) {
+  uint16_t *link = &self->sources[self->entries[from].key >> 24].head;
+  while (*link != from)
+    link = &self->entries[*link].next;
+  *link = to;
+}
+
+/* backward shift deletion, the slot must already be unlinked from its source */
+static void j1939_dm1_erase(j1939_dm1_t *self, uint32_t idx) {
+  uint32_t next = idx;
+  while (self->entries[next = (next + 1) & self->mask].key != J1939_DM1_EMPTY) {
+    /* entries whose probe sequence passes the hole move into it */
+    uint32_t home = j1939_dm1_home(self, self->entries[next].key);
+    if (((next - home) & self->mask) >= ((next - idx) & self->mask)) {
+      j1939_dm1_relink(self, next, idx);
+      self->entries[idx] = self->entries[next];
+      idx = next;
+    }
+  }
+  self->entries[idx].key = J1939_DM1_EMPTY;
+  --self->count;
+}
+
+j1939_dm1_t *j1939_dm1_create(uint16_t capacity, j1939_dm1_cb_t cb, void *arg) {
+  /* keep the load factor at or below one half */
+  uint32_t slots = 1;
+  while (slots < capacity * 2U)
+    slots <<= 1;
+  if (capacity == 0 || slots > J1939_DM1_NONE)
+    return NULL;
+
+  j1939_dm1_t *self = (j1939_dm1_t *)malloc(sizeof(j1939_dm1_t) + slots * sizeof(j1939_dm1_entry_t));
+  if (self == NULL)
+    return NULL;
+  self->cb = cb;
+  self->arg = arg;
+  self->capacity = capacity;
+  self->count = 0;
+  self->mask = slots - 1;
+  for (uint16_t sa = 0; sa < 0x100; ++sa)
+    self->sources[sa] = (j1939_dm1_source_t){ .head = J1939_DM1_NONE, .count = 0, .lamp = J1939_DM1_LAMP_UNKNOWN, .generation = 0, };
+  for (uint32_t idx = 0; idx < slots; ++idx)
+    self->entries[idx].key = J1939_DM1_EMPTY;
+
+  return self;
+}
+
+j1939_status_t j1939_dm1_delete(j1939_dm1_t *self) {
+  free(self);
+  return J1939_OK;
+}
+
+j1939_status_t j1939_dm1_update(j1939_dm1_t *self, const j1939_message_t *msg) {
+  if (j1939_get_pgn(msg->id) != J1939_PGN_DM1 || msg->size < 2 || msg->pdu.source_address == J1939_ADDRESS_GLOBAL)
+    return J1939_OK;
+
+  j1939_status_t res = J1939_OK;
+  uint8_t sa = msg->pdu.source_address;
+  j1939_dm1_source_t *source = &self->sources[sa];
+  uint8_t generation = ++source->generation;
+  uint16_t known = source->count, listed = 0, fresh = 0;
+  /* every event of this DM1 carries its lamps, the change itself is reported last */
+  uint16_t lamp = msg->data[0] << 8 | msg->data[1], previous = source->lamp;
+  source->lamp = lamp;
+
+  /* pass 1 marks the DTCs already known */
+  for (uint16_t offset = 2; offset + 4 <= msg->size; offset += 4) {
+    uint32_t key = j1939_dm1_key(sa, &msg->data[offset]);
+    if (key == J1939_DM1_EMPTY)
+      continue;
+    j1939_dm1_entry_t *entry = &self->entries[j1939_dm1_find(self, key)];
+    if (entry->key != key) {
+      ++fresh;
+      continue;
+    }
+    /* a DTC listed twice in one DM1 is counted once */
+    if (entry->generation != generation)
+      ++listed;
+    entry->generation = generation;
+    entry->oc = msg->data[offset + 3] & 0x7F;
+  }
+
+  /* pass 2 drops the unlisted ones, the steady state lists every known DTC again and skips the walk */
+  for (uint16_t stale = known - listed; stale; --stale) {
+    uint16_t *link = &source->head;
+    while (self->entries[*link].generation == generation)
+      link = &self->entries[*link].next;
+    uint16_t idx = *link;
+    j1939_dtc_t cleared = j1939_dm1_dtc(&self->entries[idx]);
+    *link = self->entries[idx].next;
+    --source->count;
+    j1939_dm1_erase(self, idx);
+    if (self->cb)
+      self->cb(sa, J1939_DM1_CLEARED, &cleared, source->lamp, self->arg);
+  }
+
+  /* pass 3 inserts the new ones into the room left */
+  for (uint16_t offset = 2; offset + 4 <= msg->size && fresh; offset += 4) {
+    uint32_t key = j1939_dm1_key(sa, &msg->data[offset]);
+    if (key == J1939_DM1_EMPTY)
+      continue;
+    uint32_t idx = j1939_dm1_find(self, key);
+    j1939_dm1_entry_t *entry = &self->entries[idx];
+    if (entry->key == key)
+      continue;
+    if (self->count == self->capacity) {
+      res = J1939_BUSY;
+      break;
+    }
+    *entry = (j1939_dm1_entry_t){ .key = key, .next = source->head, .oc = msg->data[offset + 3] & 0x7F, .generation = generation, };
+    source->head = idx;
+    ++source->count;
+    ++self->count;
+    if (self->cb) {
+      j1939_dtc_t set = j1939_dm1_dtc(entry);
+      self->cb(sa, J1939_DM1_SET, &set, source->lamp, self->arg);
+    }
+  }
+
+  if (lamp != previous && self->cb)
+    self->cb(sa, J1939_DM1_LAMP, NULL, lamp, self->arg);
+
+  return res;
+}
+
+j1939_status_t j1939_dm1_remove(j1939_dm1_t *self, uint8_t source_address) {
+  j1939_dm1_source_t *source = &self->sources[source_address];
+  while (source->head != J1939_DM1_NONE) {
+    uint16_t idx = source->head;
+    j1939_dtc_t cleared = j1939_dm1_dtc(&self->entries[idx]);
+    source->head = self->entries[idx].next;
+    --source->count;
+    j1939_dm1_erase(self, idx);
+    if (self->cb)
+      self->cb(source_address, J1939_DM1_CLEARED, &cleared, source->lamp, self->arg);
+  }
+  source->lamp = J1939_DM1_LAMP_UNKNOWN;
+  return J1939_OK;
+}
+
+uint16_t j1939_dm1_lamp(j1939_dm1_t *self, uint8_t source_address) {
+  return self->sources[source_address].lamp;
+}
+
+uint16_t j1939_dm1_active(j1939_dm1_t *self, uint8_t source_address, j1939_dtc_t *dtcs, uint16_t size) {
+  uint16_t count = 0;
+  for (uint16_t idx = self->sources[source_address].head; idx != J1939_DM1_NONE; idx = self->entries[idx].next, ++count) {
+    if (count < size)
+      dtcs[count] = j1939_dm1_dtc(&self->entries[idx]);
+  }
+  return count;
+}
@@ -0,0 +1,66 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_DM1_H
+#define J1939_DM1_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939_types.h"
+
+/* Active diagnostic trouble codes (DM1) of every source on the bus.
+ * Each DM1 is diffed against the set last seen from its source and only the
+ * changes are reported. All entries live in one fixed open addressing table
+ * allocated by j1939_dm1_create, updates never touch the heap. */
+#define J1939_PGN_DM1                       0xFECA
+
+typedef struct j1939_dtc {
+  uint32_t spn;
+  uint8_t fmi;
+  /* occurrence count, 0x7F if not available */
+  uint8_t oc;
+} j1939_dtc_t;
+
+typedef enum j1939_dm1_event {
+  J1939_DM1_SET,
+  J1939_DM1_CLEARED,
+  /* lamp status changed, dtc is NULL */
+  J1939_DM1_LAMP,
+} j1939_dm1_event_t;
+
+/* lamp: lamp status byte << 8 | flash lamp status byte, reference SAE J1939-73 5.7.1 */
+typedef void (*j1939_dm1_cb_t)(uint8_t source_address, j1939_dm1_event_t event, const j1939_dtc_t *dtc, uint16_t lamp, void *arg);
+
+typedef struct j1939_dm1 j1939_dm1_t;
+
+/* capacity: active DTCs tracked over all sources */
+j1939_dm1_t *j1939_dm1_create(uint16_t capacity, j1939_dm1_cb_t cb, void *arg);
+j1939_status_t j1939_dm1_delete(j1939_dm1_t *self);
+
+/* feed every received message, e.g. from recv_cb, anything but a DM1 is ignored.
+ * returns J1939_BUSY if some DTCs did not fit the table */
+j1939_status_t j1939_dm1_update(j1939_dm1_t *self, const j1939_message_t *msg);
+/* clears every DTC of a source that went silent */
+j1939_status_t j1939_dm1_remove(j1939_dm1_t *self, uint8_t source_address);
+
+uint16_t j1939_dm1_lamp(j1939_dm1_t *self, uint8_t source_address);
+/* copies up to size active DTCs of a source, returns the number of active DTCs */
+uint16_t j1939_dm1_active(j1939_dm1_t *self, uint8_t source_address, j1939_dtc_t *dtcs, uint16_t size);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_DM1_H */
@@ -0,0 +1,131 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_HANDLE_H
+#define J1939_HANDLE_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939.h"
+
+/* Handle layout, public only so handles can be allocated statically. The members are private to
+ * j1939.c, their order keeps the padding small on 32 and 64 bit targets */
+
+/* Receive subscription with its delivery state */
+typedef struct j1939_subscriber {
+  uint32_t pgn;
+  uint8_t source_address;
+  uint8_t mode;
+  uint8_t delivered;
+  uint8_t size;
+  uint32_t interval;
+  uint32_t tick;
+  /* payload bytes taking part in the on-change comparison */
+  uint64_t mask;
+  uint64_t value;
+} j1939_subscriber_t;
+
+#if J1939_FILTER
+/* Acceptance filter bank. Frames are first decided on their (EDP, DP, PF) slot, a slot that is
+ * fully covered by some rule passes without a scan, only partially covered slots check the rules */
+typedef struct j1939_filter_bank {
+  uint32_t full[1024 / 32];
+  uint32_t partial[1024 / 32];
+  uint8_t filter_count;
+  uint8_t range_count;
+#if J1939_STATIC
+  j1939_pgn_range_t range[J1939_SIZE_FILTER];
+  j1939_filter_t filter[J1939_SIZE_FILTER];
+#else
+  j1939_pgn_range_t *range;
+  j1939_filter_t filter[];
+#endif /* J1939_STATIC */
+} j1939_filter_bank_t;
+#endif /* J1939_FILTER */
+
+/* Transport session, one per direction and local address plus one for broadcasts received from the bus */
+typedef struct j1939_session {
+  uint8_t total_packets;
+  uint8_t packets_count;
+  uint8_t response_packets;
+  /* packets the last CTS sent asked for, none of them arrived while response_packets still matches */
+  uint8_t cts_packets;
+  uint8_t abort_reason;
+  /* packets per CTS agreed with the sender */
+  uint8_t max_packets;
+  /* BAM packet spacing */
+  uint8_t interval;
+  /* j1939_tp_status_t, a byte next to the counters instead of an enum of its own */
+  uint8_t status;
+  uint32_t tick;
+  j1939_message_t *lmsg;
+} j1939_session_t;
+
+/* Local address (logical ECU) served by a handle */
+typedef struct j1939_local {
+  uint8_t address;
+  j1939_cb_t recv_cb;
+  void *arg;
+  /* sessions this address sends (RTS, BAM) and receives (RTS addressed to it) */
+  j1939_session_t tx;
+  j1939_session_t rx;
+} j1939_local_t;
+
+struct j1939 {
+  j1939_cb_t recv_cb;
+  j1939_cb_t timeout_cb;
+  j1939_port_t *port;
+  void *arg;
+  j1939_cache_t *cache;
+#if J1939_FILTER
+  j1939_filter_bank_t *filter;
+#if J1939_STATIC
+  j1939_filter_bank_t bank;
+#endif /* J1939_STATIC */
+#endif /* J1939_FILTER */
+  /* membership bitmap of the local addresses, locals[0] is the one from j1939_config_t if it has one */
+  uint32_t addresses[256 / 32];
+  j1939_session_t broadcast;
+  j1939_local_t locals[J1939_SIZE_ADDRESS];
+#if J1939_TIMESTAMP
+  j1939_histogram_t latency[J1939_LATENCY_MAX];
+#endif /* J1939_TIMESTAMP */
+#if J1939_SIZE_SUBSCRIPTION
+  j1939_subscriber_t subscribers[J1939_SIZE_SUBSCRIPTION];
+  uint8_t subscribers_count;
+#endif /* J1939_SIZE_SUBSCRIPTION */
+  uint8_t locals_count;
+  /* packets per CTS offered by this handle */
+  uint8_t window;
+  /* BAM packet spacing of this handle */
+  uint8_t bam_interval;
+};
+
+/* handle in static storage, name##_init() sets it up from the j1939_config_t fields given and
+ * returns it, NULL if they are refused. j1939_deinit releases it, e.g.
+ *   J1939_DEFINE_HANDLE(engine, .self_address = 0x00, .port = port);
+ *   j1939_t *handle = engine_init(); */
+#define J1939_DEFINE_HANDLE(name, ...)                                                  \
+  static struct j1939 name##_storage;                                                   \
+  static inline j1939_t *name##_init(void) {                                            \
+    j1939_config_t config = {__VA_ARGS__};                                              \
+    return j1939_init(&name##_storage, &config) == J1939_OK ? &name##_storage : NULL;   \
+  }
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_HANDLE_H */
@@ -0,0 +1,371 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#if defined __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* __unix__ */
+
+#define J1939_LOG_MAGIC                     "J1939LOG"
+#define J1939_LOG_VERSION                   1
+#define J1939_LOG_MAX_CHANNEL               UINT8_MAX
+
+typedef struct j1939_log_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  /* 0 while recording, the count is then derived from the file size */
+  uint64_t count;
+  /* file offset of the index, 0 if there is none */
+  uint64_t index_offset;
+} j1939_log_header_t;
+
+_Static_assert(sizeof(j1939_log_header_t) == 32, "unexpected log header layout");
+_Static_assert(sizeof(j1939_log_record_t) == 24, "unexpected log record layout");
+
+struct j1939_recorder {
+  FILE *file;
+  uint64_t count;
+  uint64_t *index;
+  uint64_t index_capacity;
+  int capture;
+  uint8_t channels;
+  j1939_port_t *ports[J1939_LOG_MAX_CHANNEL];
+};
+
+struct j1939_log {
+  const uint8_t *base;
+  size_t size;
+  uint64_t count;
+  const j1939_log_record_t *records;
+  const uint64_t *index;
+  uint64_t index_count;
+  int mapped;
+};
+
+struct j1939_replay {
+  j1939_log_t *log;
+  j1939_port_t *port;
+  uint8_t channel;
+  /* j1939_port_dir_t, 0xFF for both */
+  uint8_t dir;
+  int realtime;
+  int started;
+  uint64_t next;
+  uint64_t origin_us;
+  uint32_t origin_tick;
+};
+
+static void j1939_recorder_capture(j1939_port_t *port, const j1939_static_message_t *msg, j1939_port_dir_t dir, void *arg) {
+  j1939_recorder_t *self = (j1939_recorder_t *)arg;
+#if J1939_TIMESTAMP
+  /* when the frame was sent or arrived, not when the hook got to it */
+  j1939_log_record_t record = { .timestamp_us = (msg->timestamp ? msg->timestamp : j1939_port_get_time()) / 1000, .id = msg->id, .dir = dir, };
+#else
+  j1939_log_record_t record = { .timestamp_us = j1939_port_get_time() / 1000, .id = msg->id, .dir = dir, };
+#endif /* J1939_TIMESTAMP */
+
+  /* ports are few and usually the same one repeats, a linear lookup is enough */
+  uint8_t channel = 0;
+  while (channel < self->channels && self->ports[channel] != port)
+    ++channel;
+  if (channel == self->channels) {
+    if (self->channels == J1939_LOG_MAX_CHANNEL)
+      return;
+    self->ports[self->channels++] = port;
+  }
+
+  record.channel = channel;
+  record.size = msg->size < sizeof(record.data) ? msg->size : sizeof(record.data);
+  memcpy(record.data, msg->data, record.size);
+  j1939_recorder_write(self, &record);
+}
+
+j1939_recorder_t *j1939_recorder_create(const char *path, int capture) {
+  j1939_recorder_t *self = (j1939_recorder_t *)calloc(1, sizeof(struct j1939_recorder));
+  if (self == NULL)
+    return NULL;
+  if ((self->file = fopen(path, "wb")) == NULL) {
+    free(self);
+    return NULL;
+  }
+  setvbuf(self->file, NULL, _IOFBF, 1 << 16);
+
+  j1939_log_header_t header = { .magic = J1939_LOG_MAGIC, .version = J1939_LOG_VERSION, .record_size = sizeof(j1939_log_record_t), };
+  fwrite(&header, sizeof(header), 1, self->file);
+
+  if (capture && j1939_port_hook_register(j1939_recorder_capture, self) == J1939_OK)
+    self->capture = 1;
+
+  return self;
+}
+
+j1939_status_t j1939_recorder_delete(j1939_recorder_t *self) {
+  j1939_status_t res = J1939_OK;
+  if (self->capture)
+    j1939_port_hook_unregister(j1939_recorder_capture, self);
+
+  j1939_log_header_t header = { .magic = J1939_LOG_MAGIC, .version = J1939_LOG_VERSION, .record_size = sizeof(j1939_log_record_t), .count = self->count, };
+  header.index_offset = sizeof(header) + self->count * sizeof(j1939_log_record_t);
+  uint64_t index_count = (self->count + J1939_LOG_INDEX_STRIDE - 1) / J1939_LOG_INDEX_STRIDE;
+  if (fwrite(self->index, sizeof(uint64_t), index_count, self->file) != index_count || fseek(self->file, 0, SEEK_SET) || fwrite(&header, sizeof(header), 1, self->file) != 1)
+    res = J1939_ERROR;
+  if (fclose(self->file))
+    res = J1939_ERROR;
+
+  free(self->index);
+  free(self);
+  return res;
+}
+
+j1939_status_t j1939_recorder_write(j1939_recorder_t *self, const j1939_log_record_t *record) {
+  if (self->count % J1939_LOG_INDEX_STRIDE == 0) {
+    uint64_t slot = self->count / J1939_LOG_INDEX_STRIDE;
+    if (slot == self->index_capacity) {
+      uint64_t capacity = self->index_capacity ? 2 * self->index_capacity : 64;
+      uint64_t *index = (uint64_t *)realloc(self->index, capacity * sizeof(uint64_t));
+      if (index == NULL)
+        return J1939_ERROR;
+      self->index = index;
+      self->index_capacity = capacity;
+    }
+    self->index[slot] = record->timestamp_us;
+  }
+
+  if (fwrite(record, sizeof(j1939_log_record_t), 1, self->file) != 1)
+    return J1939_ERROR;
+  ++self->count;
+
+  return J1939_OK;
+}
+
+static int hex_value(char c) {
+  return isdigit((unsigned char)c) ? c - '0' : isxdigit((unsigned char)c) ? (tolower((unsigned char)c) - 'a' + 10) : -1;
+}
+
+j1939_status_t j1939_recorder_import_candump(j1939_recorder_t *self, FILE *candump) {
+  char line[256], names[J1939_LOG_MAX_CHANNEL][16];
+  uint8_t channels = 0;
+
+  while (fgets(line, sizeof(line), candump)) {
+    unsigned long long sec = 0;
+    char frac[16] = {0}, name[16] = {0}, frame[160] = {0};
+    if (sscanf(line, " (%llu.%15[0-9]) %15s %159s", &sec, frac, name, frame) != 4)
+      continue;
+
+    char *sep = strchr(frame, '#');
+    /* remote frames and CAN FD frames carry no classic payload */
+    if (sep == NULL || sep[1] == 'R' || sep[1] == '#')
+      continue;
+
+    j1939_log_record_t record = {0};
+    record.timestamp_us = sec * 1000000ULL;
+    for (int idx = 0, scale = 100000; idx < 6 && frac[idx]; ++idx, scale /= 10)
+      record.timestamp_us += (uint64_t)(frac[idx] - '0') * scale;
+
+    *sep = '\0';
+    record.id = (uint32_t)strtoul(frame, NULL, 16) & 0x1FFFFFFFU;
+    for (const char *data = sep + 1; data[0] && data[1] && record.size < sizeof(record.data); data += 2) {
+      if (hex_value(data[0]) < 0 || hex_value(data[1]) < 0)
+        break;
+      record.data[record.size++] = hex_value(data[0]) << 4 | hex_value(data[1]);
+    }
+
+    uint8_t channel = 0;
+    while (channel < channels && strcmp(names[channel], name))
+      ++channel;
+    if (channel == channels) {
+      if (channels == J1939_LOG_MAX_CHANNEL)
+        continue;
+      strcpy(names[channels++], name);
+    }
+    record.channel = channel;
+    record.dir = J1939_PORT_RX;
+
+    if (j1939_recorder_write(self, &record) != J1939_OK)
+      return J1939_ERROR;
+  }
+
+  return J1939_OK;
+}
+
+j1939_log_t *j1939_log_open(const char *path) {
+  j1939_log_t *self = (j1939_log_t *)calloc(1, sizeof(struct j1939_log));
+  if (self == NULL)
+    return NULL;
+
+#if defined __unix__
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+      /* replay and analysis walk the records front to back */
+      madvise(addr, st.st_size, MADV_SEQUENTIAL);
+      self->base = (const uint8_t *)addr;
+      self->size = st.st_size;
+      self->mapped = 1;
+    }
+  }
+  if (fd >= 0)
+    close(fd);
+#endif /* __unix__ */
+
+  if (!self->mapped) {
+    FILE *file = fopen(path, "rb");
+    if (file && fseek(file, 0, SEEK_END) == 0 && ftell(file) > 0) {
+      self->size = ftell(file);
+      uint8_t *base = (uint8_t *)malloc(self->size);
+      rewind(file);
+      if (base && fread(base, 1, self->size, file) == self->size)
+        self->base = base;
+      else
+        free(base);
+    }
+    if (file)
+      fclose(file);
+  }
+
+  const j1939_log_header_t *header = (const j1939_log_header_t *)self->base;
+  if (self->base == NULL || self->size < sizeof(j1939_log_header_t) || memcmp(header->magic, J1939_LOG_MAGIC, sizeof(header->magic)) || header->record_size != sizeof(j1939_log_record_t)) {
+    j1939_log_close(self);
+    return NULL;
+  }
+
+  self->records = (const j1939_log_record_t *)(self->base + sizeof(j1939_log_header_t));
+  self->count = (self->size - sizeof(j1939_log_header_t)) / sizeof(j1939_log_record_t);
+  if (header->index_offset && header->count <= self->count) {
+    /* finalised log, trust the header */
+    self->count = header->count;
+    self->index_count = (self->count + J1939_LOG_INDEX_STRIDE - 1) / J1939_LOG_INDEX_STRIDE;
+    if (header->index_offset + self->index_count * sizeof(uint64_t) <= self->size)
+      self->index = (const uint64_t *)(self->base + header->index_offset);
+  }
+
+  return self;
+}
+
+j1939_status_t j1939_log_close(j1939_log_t *self) {
+#if defined __unix__
+  if (self->mapped)
+    munmap((void *)self->base, self->size);
+  else
+#endif /* __unix__ */
+    free((void *)self->base);
+  free(self);
+  return J1939_OK;
+}
+
+uint64_t j1939_log_count(j1939_log_t *self) {
+  return self->count;
+}
+
+const j1939_log_record_t *j1939_log_record(j1939_log_t *self, uint64_t index) {
+  return index < self->count ? &self->records[index] : NULL;
+}
+
+uint64_t j1939_log_seek(j1939_log_t *self, uint64_t timestamp_us) {
+  uint64_t l = 0, r = self->count;
+  if (self->index) {
+    /* narrow down to one index stride without touching the records */
+    uint64_t il = 0, ir = self->index_count;
+    while (il < ir) {
+      uint64_t mid = il + (ir - il) / 2;
+      if (self->index[mid] < timestamp_us)
+        il = mid + 1;
+      else
+        ir = mid;
+    }
+    l = il ? (il - 1) * J1939_LOG_INDEX_STRIDE : 0;
+    r = il * J1939_LOG_INDEX_STRIDE < self->count ? il * J1939_LOG_INDEX_STRIDE : self->count;
+  }
+  while (l < r) {
+    uint64_t mid = l + (r - l) / 2;
+    if (self->records[mid].timestamp_us < timestamp_us)
+      l = mid + 1;
+    else
+      r = mid;
+  }
+  return l;
+}
+
+j1939_replay_t *j1939_replay_create(j1939_log_t *log, j1939_port_t *port, uint8_t channel, int realtime) {
+  j1939_replay_t *self = (j1939_replay_t *)calloc(1, sizeof(struct j1939_replay));
+  if (self == NULL)
+    return NULL;
+  self->log = log;
+  self->port = port;
+  self->channel = channel;
+  self->realtime = realtime;
+  self->dir = 0xFF;
+  /* a capture holds every frame sent in the process once as TX and again as RX at each port that
+   * received it, across all channels only the TX records are replayed. candump logs are RX only */
+  for (uint64_t idx = 0; channel == J1939_LOG_MAX_CHANNEL && idx < j1939_log_count(log) && self->dir == 0xFF; ++idx) {
+    if (j1939_log_record(log, idx)->dir == J1939_PORT_TX)
+      self->dir = J1939_PORT_TX;
+  }
+  return self;
+}
+
+j1939_status_t j1939_replay_set_dir(j1939_replay_t *self, uint8_t dir) {
+  self->dir = dir;
+  return J1939_OK;
+}
+
+j1939_status_t j1939_replay_delete(j1939_replay_t *self) {
+  free(self);
+  return J1939_OK;
+}
+
+j1939_status_t j1939_replay_seek(j1939_replay_t *self, uint64_t timestamp_us) {
+  self->next = j1939_log_seek(self->log, timestamp_us);
+  self->started = 0;
+  return J1939_OK;
+}
+
+j1939_status_t j1939_replay_step(j1939_replay_t *self, uint32_t timeout_ms) {
+  const j1939_log_record_t *record;
+  while ((record = j1939_log_record(self->log, self->next)) &&
+         ((self->channel != J1939_LOG_MAX_CHANNEL && record->channel != self->channel) || (self->dir != 0xFF && record->dir != self->dir)))
+    ++self->next;
+  if (record == NULL)
+    return J1939_ERROR;
+
+  if (self->realtime) {
+    uint32_t tick = j1939_port_get_tick();
+    if (!self->started) {
+      self->started = 1;
+      self->origin_us = record->timestamp_us;
+      self->origin_tick = tick;
+    }
+    if ((uint64_t)(tick - self->origin_tick) * 1000 < record->timestamp_us - self->origin_us)
+      return J1939_BLOCKED;
+  }
+
+  j1939_static_message_t m = { .id = record->id, .size = record->size, };
+  memcpy(m.data, record->data, record->size);
+
+  j1939_status_t res = j1939_port_transmit(self->port, &m, timeout_ms);
+  if (res == J1939_OK)
+    ++self->next;
+
+  return res;
+}
@@ -0,0 +1,77 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_LOG_H
+#define J1939_LOG_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939_port.h"
+#include <stdio.h>
+
+/* Binary bus log.
+ * file   : header, records[count], index[(count + J1939_LOG_INDEX_STRIDE - 1) / J1939_LOG_INDEX_STRIDE]
+ * record : fixed 24 bytes, so record n lives at sizeof(header) + n * sizeof(record)
+ * index  : timestamp of every J1939_LOG_INDEX_STRIDE-th record, written when the recorder is closed */
+#define J1939_LOG_INDEX_STRIDE              1024
+
+typedef struct j1939_log_record {
+  uint64_t timestamp_us;
+  uint32_t id;
+  uint8_t channel;
+  uint8_t size;
+  /* j1939_port_dir_t */
+  uint8_t dir;
+  uint8_t reserved;
+  uint8_t data[8];
+} j1939_log_record_t;
+
+typedef struct j1939_recorder j1939_recorder_t;
+typedef struct j1939_log j1939_log_t;
+typedef struct j1939_replay j1939_replay_t;
+
+/* with capture set, every frame passing j1939_port_transmit/j1939_port_receive is recorded,
+ * each port gets its own channel in order of appearance */
+j1939_recorder_t *j1939_recorder_create(const char *path, int capture);
+/* writes the index and finalises the header */
+j1939_status_t j1939_recorder_delete(j1939_recorder_t *self);
+j1939_status_t j1939_recorder_write(j1939_recorder_t *self, const j1939_log_record_t *record);
+/* appends candump -l lines "(1650000000.123456) can0 18FEF100#0102030405060708",
+ * every interface gets its own channel in order of appearance */
+j1939_status_t j1939_recorder_import_candump(j1939_recorder_t *self, FILE *candump);
+
+j1939_log_t *j1939_log_open(const char *path);
+j1939_status_t j1939_log_close(j1939_log_t *self);
+uint64_t j1939_log_count(j1939_log_t *self);
+const j1939_log_record_t *j1939_log_record(j1939_log_t *self, uint64_t index);
+/* index of the first record at or after timestamp_us */
+uint64_t j1939_log_seek(j1939_log_t *self, uint64_t timestamp_us);
+
+/* replays the records of channel (0xFF for all) through j1939_port_transmit on port,
+ * either at the recorded pace or, with realtime clear, as fast as the port accepts them.
+ * across all channels only TX records are replayed if the log has any, see j1939_replay_set_dir */
+j1939_replay_t *j1939_replay_create(j1939_log_t *log, j1939_port_t *port, uint8_t channel, int realtime);
+j1939_status_t j1939_replay_delete(j1939_replay_t *self);
+/* replays records of one j1939_port_dir_t only, 0xFF for both */
+j1939_status_t j1939_replay_set_dir(j1939_replay_t *self, uint8_t dir);
+j1939_status_t j1939_replay_seek(j1939_replay_t *self, uint64_t timestamp_us);
+/* J1939_OK: one frame sent, J1939_BLOCKED: next frame not due yet, J1939_ERROR: end of log */
+j1939_status_t j1939_replay_step(j1939_replay_t *self, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_LOG_H */
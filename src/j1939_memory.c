@@ -0,0 +1,386 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939_memory.h"
+#include "j1939_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define J1939_MEMORY_PRIORITY               0x06
+
+typedef struct j1939_memory_request {
+  uint8_t command;
+  uint16_t length;
+  uint32_t address;
+} j1939_memory_request_t;
+
+struct j1939_memory_client {
+  j1939_t *handle;
+  uint8_t self_address;
+  uint8_t server_address;
+  uint8_t pipeline;
+  uint8_t command;
+  uint16_t block_size;
+  /* J1939_BUSY while a transfer runs */
+  j1939_status_t status;
+  uint32_t address;
+  uint32_t size;
+  /* byte offsets reached by the DM14 requests, DM15 proceeds, DM16 transmissions and finished blocks */
+  uint32_t requested;
+  uint32_t granted;
+  uint32_t sent;
+  uint32_t done;
+  j1939_memory_read_t source;
+  j1939_memory_write_t sink;
+  void *arg;
+  uint32_t start;
+  uint32_t finish;
+  /* tick of the last progress, for the response timeout */
+  uint32_t tick;
+};
+
+struct j1939_memory_server {
+  j1939_t *handle;
+  uint8_t self_address;
+  uint8_t client_address;
+  uint8_t head;
+  uint8_t count;
+  j1939_memory_read_t read;
+  j1939_memory_write_t write;
+  void *arg;
+  /* tick of the last message from the client, its queue is dropped after T3 of silence */
+  uint32_t tick;
+  j1939_memory_request_t queue[J1939_MEMORY_QUEUE];
+};
+
+j1939_status_t j1939_memory_file_read(void *file, uint32_t address, uint8_t *data, uint16_t size) {
+  if (fseek((FILE *)file, address, SEEK_SET) || fread(data, 1, size, (FILE *)file) != size)
+    return J1939_ERROR;
+  return J1939_OK;
+}
+
+j1939_status_t j1939_memory_file_write(void *file, uint32_t address, const uint8_t *data, uint16_t size) {
+  if (fseek((FILE *)file, address, SEEK_SET) || fwrite(data, 1, size, (FILE *)file) != size)
+    return J1939_ERROR;
+  return J1939_OK;
+}
+
+static inline void j1939_memory_id(uint32_t *id, uint8_t priority, uint32_t pgn, uint8_t source_address, uint8_t destination_address) {
+  j1939_set_pgn(id, pgn);
+  ((j1939_pdu_t *)id)->priority = priority;
+  ((j1939_pdu_t *)id)->pdu_specific = destination_address;
+  ((j1939_pdu_t *)id)->source_address = source_address;
+}
+
+/* Reference SAE J1939-73 5.7.14/5.7.15, 11 bit length split over byte 1 and bits 8-6 of byte 2 */
+static inline uint16_t j1939_memory_length(const uint8_t *data) {
+  return data[0] | (data[1] >> 5) << 8;
+}
+
+/* DM16 with byte count and data, the byte count saturates, the receiver takes the length from the message size */
+static j1939_message_t *j1939_memory_dm16(uint8_t source_address, uint8_t destination_address, uint16_t size) {
+  j1939_message_t *msg = j1939_message_create(0, NULL, size + 1);
+  if (msg == NULL)
+    return NULL;
+  j1939_memory_id(&msg->id, J1939_TP_DEFAULT_PRIORITY, J1939_PGN_DM16, source_address, destination_address);
+  msg->data[0] = size < 0xFF ? size : 0xFF;
+  return msg;
+}
+
+/* single frames are sent at once, transport messages are handed over to the handle on success */
+static j1939_status_t j1939_memory_dm16_transmit(j1939_t *handle, j1939_message_t *msg, uint32_t timeout_ms) {
+  j1939_status_t res = j1939_transmit(handle, msg, timeout_ms);
+  if (res != J1939_OK || msg->size <= J1939_SIZE_DATAFIELD)
+    j1939_message_delete(msg);
+  return res;
+}
+
+/* pushes the transport session of the handle as far as it goes */
+static j1939_status_t j1939_memory_drive(j1939_t *handle, uint32_t timeout_ms, uint32_t *tick) {
+  j1939_status_t res = J1939_OK;
+  while (j1939_status(handle) == J1939_BUSY && (res = j1939_tp_cm_transmit_manager(handle, timeout_ms)) == J1939_OK)
+    *tick = j1939_port_get_tick();
+  return res == J1939_TIMEOUT ? J1939_TIMEOUT : J1939_OK;
+}
+
+static inline uint16_t j1939_memory_block(j1939_memory_client_t *self, uint32_t offset) {
+  return self->size - offset < self->block_size ? self->size - offset : self->block_size;
+}
+
+static j1939_status_t j1939_memory_dm14_transmit(j1939_memory_client_t *self, j1939_memory_command_t command, uint32_t address, uint16_t length, uint32_t timeout_ms) {
+  j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
+  j1939_memory_id(&m.id, J1939_MEMORY_PRIORITY, J1939_PGN_DM14, self->self_address, self->server_address);
+  m.data[0] = length;
+  /* direct spatial addressing, reserved bit set */
+  m.data[1] = (length >> 8) << 5 | command << 1 | 0x01;
+  m.data[2] = address;
+  m.data[3] = address >> 8;
+  m.data[4] = address >> 16;
+  /* the pointer extension carries bits 31-24 */
+  m.data[5] = address >> 24;
+  m.data[6] = 0xFF;
+  m.data[7] = 0xFF;
+  return j1939_transmit_static(self->handle, &m, timeout_ms);
+}
+
+static j1939_status_t j1939_memory_dm15_transmit(j1939_memory_server_t *self, uint8_t destination_address, j1939_memory_response_t response, uint16_t length) {
+  j1939_static_message_t m = { .size = J1939_SIZE_DATAFIELD, };
+  j1939_memory_id(&m.id, J1939_MEMORY_PRIORITY, J1939_PGN_DM15, self->self_address, destination_address);
+  m.data[0] = length;
+  m.data[1] = (length >> 8) << 5 | 0x10 | response << 1 | 0x01;
+  memset(&m.data[2], 0xFF, J1939_SIZE_DATAFIELD - 2);
+  return j1939_transmit_static(self->handle, &m, J1939_TIMEOUT_TR);
+}
+
+/* tells the server to drop the requests still queued */
+static j1939_status_t j1939_memory_client_fail(j1939_memory_client_t *self, j1939_status_t status) {
+  j1939_memory_dm14_transmit(self, J1939_MEMORY_OPERATION_FAILED, self->address, 0, J1939_TIMEOUT_TR);
+  self->finish = j1939_port_get_tick();
+  return self->status = status;
+}
+
+j1939_memory_client_t *j1939_memory_client_create(j1939_t *handle, uint8_t self_address, uint8_t server_address, uint16_t block_size, uint8_t pipeline) {
+  if (block_size == 0 || block_size > J1939_MEMORY_BLOCK_MAX)
+    return NULL;
+  j1939_memory_client_t *self = (j1939_memory_client_t *)calloc(1, sizeof(struct j1939_memory_client));
+  if (self == NULL)
+    return NULL;
+  self->handle = handle;
+  self->self_address = self_address;
+  self->server_address = server_address;
+  self->block_size = block_size;
+  self->pipeline = pipeline;
+  self->status = J1939_OK;
+  return self;
+}
+
+j1939_status_t j1939_memory_client_delete(j1939_memory_client_t *self) {
+  free(self);
+  return J1939_OK;
+}
+
+static j1939_status_t j1939_memory_client_start(j1939_memory_client_t *self, j1939_memory_command_t command, uint32_t address, uint32_t size, void *arg) {
+  if (self->status == J1939_BUSY || size == 0)
+    return J1939_ERROR;
+  self->command = command;
+  self->address = address;
+  self->size = size;
+  self->requested = self->granted = self->sent = self->done = 0;
+  self->arg = arg;
+  self->start = self->tick = j1939_port_get_tick();
+  self->status = J1939_BUSY;
+  return J1939_OK;
+}
+
+j1939_status_t j1939_memory_client_write(j1939_memory_client_t *self, uint32_t address, uint32_t size, j1939_memory_read_t source, void *arg) {
+  self->source = source;
+  return j1939_memory_client_start(self, J1939_MEMORY_WRITE, address, size, arg);
+}
+
+j1939_status_t j1939_memory_client_read(j1939_memory_client_t *self, uint32_t address, uint32_t size, j1939_memory_write_t sink, void *arg) {
+  self->sink = sink;
+  return j1939_memory_client_start(self, J1939_MEMORY_READ, address, size, arg);
+}
+
+j1939_status_t j1939_memory_client_receive(j1939_memory_client_t *self, const j1939_message_t *msg) {
+  if (self->status != J1939_BUSY || msg->pdu.source_address != self->server_address || msg->pdu.pdu_specific != self->self_address)
+    return J1939_OK;
+
+  switch (j1939_get_pgn(msg->id)) {
+    case J1939_PGN_DM15:
+      switch ((j1939_memory_response_t)((msg->data[1] >> 1) & 0x07)) {
+        case J1939_MEMORY_PROCEED:
+          if (self->granted < self->requested)
+            self->granted += j1939_memory_block(self, self->granted);
+          break;
+        case J1939_MEMORY_COMPLETED:
+          if (self->command == J1939_MEMORY_WRITE && self->done < self->sent)
+            self->done += j1939_memory_block(self, self->done);
+          break;
+        case J1939_MEMORY_BUSY:
+          /* the server dropped the requests it could not queue, ask again */
+          self->requested = self->granted;
+          break;
+        default:
+          j1939_memory_client_fail(self, J1939_ERROR);
+          break;
+      }
+      break;
+    case J1939_PGN_DM16:
+      if (self->command != J1939_MEMORY_READ || self->done == self->granted || msg->size != j1939_memory_block(self, self->done) + 1)
+        return J1939_ERROR;
+      if (self->sink(self->arg, self->done, &msg->data[1], msg->size - 1) != J1939_OK)
+        j1939_memory_client_fail(self, J1939_ERROR);
+      self->done += msg->size - 1;
+      break;
+    default:
+      return J1939_OK;
+  }
+  self->tick = j1939_port_get_tick();
+
+  return J1939_OK;
+}
+
+j1939_status_t j1939_memory_client_process(j1939_memory_client_t *self, uint32_t timeout_ms) {
+  if (self->status != J1939_BUSY)
+    return self->status;
+
+  if (j1939_memory_drive(self->handle, timeout_ms, &self->tick) != J1939_OK)
+    return j1939_memory_client_fail(self, J1939_TIMEOUT);
+
+  /* the next granted block goes out as soon as the previous transport session ended */
+  if (self->command == J1939_MEMORY_WRITE && self->sent < self->granted && j1939_tx_status(self->handle, self->self_address) == J1939_OK) {
+    uint16_t size = j1939_memory_block(self, self->sent);
+    j1939_message_t *msg = j1939_memory_dm16(self->self_address, self->server_address, size);
+    if (msg == NULL || self->source(self->arg, self->sent, &msg->data[1], size) != J1939_OK) {
+      j1939_message_delete(msg);
+      return j1939_memory_client_fail(self, J1939_ERROR);
+    }
+    if (j1939_memory_dm16_transmit(self->handle, msg, timeout_ms) == J1939_OK) {
+      self->sent += size;
+      self->tick = j1939_port_get_tick();
+    }
+  }
+
+  /* keep up to pipeline requests queued at the server behind the block in progress */
+  while (self->requested < self->size && self->requested - self->done < (self->pipeline + 1U) * self->block_size) {
+    uint16_t size = j1939_memory_block(self, self->requested);
+    if (j1939_memory_dm14_transmit(self, self->command, self->address + self->requested, size, timeout_ms) != J1939_OK)
+      break;
+    self->requested += size;
+  }
+
+  if (self->done == self->size) {
+    j1939_memory_dm14_transmit(self, J1939_MEMORY_OPERATION_COMPLETED, self->address, 0, timeout_ms);
+    self->finish = j1939_port_get_tick();
+    return self->status = J1939_OK;
+  }
+
+  if (j1939_port_get_tick() - self->tick > J1939_TIMEOUT_T3)
+    return j1939_memory_client_fail(self, J1939_TIMEOUT);
+
+  return self->status;
+}
+
+j1939_status_t j1939_memory_client_stats(j1939_memory_client_t *self, j1939_memory_stats_t *stats) {
+  stats->bytes = self->done;
+  stats->elapsed = (self->status == J1939_BUSY ? j1939_port_get_tick() : self->finish) - self->start;
+  stats->bytes_per_second = stats->elapsed ? (uint32_t)((uint64_t)stats->bytes * 1000 / stats->elapsed) : 0;
+  return J1939_OK;
+}
+
+j1939_memory_server_t *j1939_memory_server_create(j1939_t *handle, uint8_t self_address, j1939_memory_read_t read, j1939_memory_write_t write, void *arg) {
+  j1939_memory_server_t *self = (j1939_memory_server_t *)calloc(1, sizeof(struct j1939_memory_server));
+  if (self == NULL)
+    return NULL;
+  self->handle = handle;
+  self->self_address = self_address;
+  self->read = read;
+  self->write = write;
+  self->arg = arg;
+  return self;
+}
+
+j1939_status_t j1939_memory_server_delete(j1939_memory_server_t *self) {
+  free(self);
+  return J1939_OK;
+}
+
+static inline j1939_memory_request_t *j1939_memory_server_front(j1939_memory_server_t *self) {
+  return self->count ? &self->queue[self->head] : NULL;
+}
+
+static inline void j1939_memory_server_pop(j1939_memory_server_t *self) {
+  self->head = (self->head + 1) % J1939_MEMORY_QUEUE;
+  --self->count;
+}
+
+static j1939_status_t j1939_memory_dm14_receive(j1939_memory_server_t *self, const j1939_message_t *msg) {
+  j1939_memory_command_t command = (j1939_memory_command_t)((msg->data[1] >> 1) & 0x07);
+  uint16_t length = j1939_memory_length(msg->data);
+
+  /* other clients are asked to retry until the queue of the current one is done */
+  if (self->count && msg->pdu.source_address != self->client_address)
+    return j1939_memory_dm15_transmit(self, msg->pdu.source_address, J1939_MEMORY_BUSY, length);
+  self->client_address = msg->pdu.source_address;
+  self->tick = j1939_port_get_tick();
+
+  switch (command) {
+    case J1939_MEMORY_READ:
+    case J1939_MEMORY_WRITE:
+      if (length == 0 || length > J1939_MEMORY_BLOCK_MAX || (command == J1939_MEMORY_READ ? !self->read : !self->write))
+        return j1939_memory_dm15_transmit(self, self->client_address, J1939_MEMORY_FAILED, length);
+      if (self->count == J1939_MEMORY_QUEUE)
+        return j1939_memory_dm15_transmit(self, self->client_address, J1939_MEMORY_BUSY, length);
+      self->queue[(self->head + self->count++) % J1939_MEMORY_QUEUE] = (j1939_memory_request_t){
+        .command = command,
+        .length = length,
+        .address = msg->data[2] | msg->data[3] << 8 | (uint32_t)msg->data[4] << 16 | (uint32_t)msg->data[5] << 24,
+      };
+      return j1939_memory_dm15_transmit(self, self->client_address, J1939_MEMORY_PROCEED, length);
+    case J1939_MEMORY_OPERATION_COMPLETED:
+    case J1939_MEMORY_OPERATION_FAILED:
+      self->count = 0;
+      return J1939_OK;
+    default:
+      return j1939_memory_dm15_transmit(self, self->client_address, J1939_MEMORY_FAILED, length);
+  }
+}
+
+j1939_status_t j1939_memory_server_receive(j1939_memory_server_t *self, const j1939_message_t *msg) {
+  if (msg->pdu.pdu_specific != self->self_address)
+    return J1939_OK;
+
+  switch (j1939_get_pgn(msg->id)) {
+    case J1939_PGN_DM14:
+      return j1939_memory_dm14_receive(self, msg);
+    case J1939_PGN_DM16: {
+      j1939_memory_request_t *request = j1939_memory_server_front(self);
+      if (request == NULL || msg->pdu.source_address != self->client_address || request->command != J1939_MEMORY_WRITE || request->length != msg->size - 1)
+        return J1939_ERROR;
+      self->tick = j1939_port_get_tick();
+      j1939_status_t res = self->write(self->arg, request->address, &msg->data[1], request->length);
+      j1939_memory_server_pop(self);
+      return j1939_memory_dm15_transmit(self, self->client_address, res == J1939_OK ? J1939_MEMORY_COMPLETED : J1939_MEMORY_FAILED, msg->size - 1);
+    }
+    default:
+      return J1939_OK;
+  }
+}
+
+j1939_status_t j1939_memory_server_process(j1939_memory_server_t *self, uint32_t timeout_ms) {
+  j1939_status_t res = j1939_memory_drive(self->handle, timeout_ms, &self->tick);
+
+  /* a client that vanished without OPERATION_FAILED must not hold the server */
+  if (self->count && j1939_port_get_tick() - self->tick > J1939_TIMEOUT_T3)
+    self->count = 0;
+
+  /* reads are served in order, one transport session at a time */
+  j1939_memory_request_t *request = j1939_memory_server_front(self);
+  if (request == NULL || request->command != J1939_MEMORY_READ || j1939_tx_status(self->handle, self->self_address) != J1939_OK)
+    return res;
+
+  j1939_message_t *msg = j1939_memory_dm16(self->self_address, self->client_address, request->length);
+  if (msg == NULL || self->read(self->arg, request->address, &msg->data[1], request->length) != J1939_OK) {
+    j1939_message_delete(msg);
+    j1939_memory_server_pop(self);
+    return j1939_memory_dm15_transmit(self, self->client_address, J1939_MEMORY_FAILED, request->length);
+  }
+  if ((res = j1939_memory_dm16_transmit(self->handle, msg, timeout_ms)) == J1939_OK)
+    j1939_memory_server_pop(self);
+
+  return res;
+}
@@ -0,0 +1,99 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_MEMORY_H
+#define J1939_MEMORY_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939.h"
+#include "j1939_tp.h"
+
+/* Memory access (DM14 request, DM15 response, DM16 binary data transfer), reference SAE J1939-73 5.7.14.
+ * The client splits a transfer into blocks of one DM14/DM16 pair each and keeps up to pipeline
+ * further DM14 requests in flight, so the server's DM15 answers overlap the running DM16 transfer.
+ * Data is streamed block by block through callbacks, a transfer never holds more than one block.
+ * Both sides are fed from recv_cb and driven by their process function, which also runs the
+ * transport session of the handle. */
+#define J1939_PGN_DM14                      0xD900
+#define J1939_PGN_DM15                      0xD800
+#define J1939_PGN_DM16                      0xD700
+
+/* DM16 carries a byte count followed by the data in one transport message */
+#define J1939_MEMORY_BLOCK_MAX              (J1939_TP_MAX_MSG_SIZE - 1)
+/* requests a server accepts ahead of the one being served */
+#define J1939_MEMORY_QUEUE                  4
+
+typedef enum j1939_memory_command {
+  J1939_MEMORY_ERASE,
+  J1939_MEMORY_READ,
+  J1939_MEMORY_WRITE,
+  J1939_MEMORY_STATUS_REQUEST,
+  J1939_MEMORY_OPERATION_COMPLETED,
+  J1939_MEMORY_OPERATION_FAILED,
+  J1939_MEMORY_BOOT_LOAD,
+  J1939_MEMORY_EDCP_GENERATION,
+} j1939_memory_command_t;
+
+typedef enum j1939_memory_response {
+  J1939_MEMORY_PROCEED,
+  J1939_MEMORY_BUSY,
+  J1939_MEMORY_COMPLETED                    = 4,
+  J1939_MEMORY_FAILED,
+} j1939_memory_response_t;
+
+/* copies size bytes at address into data */
+typedef j1939_status_t (*j1939_memory_read_t)(void *arg, uint32_t address, uint8_t *data, uint16_t size);
+/* stores size bytes of data at address */
+typedef j1939_status_t (*j1939_memory_write_t)(void *arg, uint32_t address, const uint8_t *data, uint16_t size);
+
+/* FILE * adapters, address is the file offset */
+j1939_status_t j1939_memory_file_read(void *file, uint32_t address, uint8_t *data, uint16_t size);
+j1939_status_t j1939_memory_file_write(void *file, uint32_t address, const uint8_t *data, uint16_t size);
+
+typedef struct j1939_memory_stats {
+  uint32_t bytes;
+  /* port ticks (ms) since the transfer started, until it finished */
+  uint32_t elapsed;
+  uint32_t bytes_per_second;
+} j1939_memory_stats_t;
+
+typedef struct j1939_memory_client j1939_memory_client_t;
+typedef struct j1939_memory_server j1939_memory_server_t;
+
+/* block_size: bytes per DM14/DM16 pair, 1 to J1939_MEMORY_BLOCK_MAX; pipeline: DM14 requests sent ahead */
+j1939_memory_client_t *j1939_memory_client_create(j1939_t *handle, uint8_t self_address, uint8_t server_address, uint16_t block_size, uint8_t pipeline);
+j1939_status_t j1939_memory_client_delete(j1939_memory_client_t *self);
+
+/* downloads size bytes read from source at offsets 0 to size - 1 into server memory at address */
+j1939_status_t j1939_memory_client_write(j1939_memory_client_t *self, uint32_t address, uint32_t size, j1939_memory_read_t source, void *arg);
+/* uploads size bytes of server memory at address, sink gets offsets 0 to size - 1 */
+j1939_status_t j1939_memory_client_read(j1939_memory_client_t *self, uint32_t address, uint32_t size, j1939_memory_write_t sink, void *arg);
+
+j1939_status_t j1939_memory_client_receive(j1939_memory_client_t *self, const j1939_message_t *msg);
+/* J1939_BUSY while the transfer runs, J1939_OK once done, J1939_ERROR on failure or J1939_TIMEOUT */
+j1939_status_t j1939_memory_client_process(j1939_memory_client_t *self, uint32_t timeout_ms);
+j1939_status_t j1939_memory_client_stats(j1939_memory_client_t *self, j1939_memory_stats_t *stats);
+
+j1939_memory_server_t *j1939_memory_server_create(j1939_t *handle, uint8_t self_address, j1939_memory_read_t read, j1939_memory_write_t write, void *arg);
+j1939_status_t j1939_memory_server_delete(j1939_memory_server_t *self);
+j1939_status_t j1939_memory_server_receive(j1939_memory_server_t *self, const j1939_message_t *msg);
+j1939_status_t j1939_memory_server_process(j1939_memory_server_t *self, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_MEMORY_H */
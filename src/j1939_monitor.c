@@ -0,0 +1,338 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939_monitor.h"
+#include "j1939.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* PGNs are 18 bits, so no PGN marks an empty slot */
+#define J1939_MONITOR_EMPTY                 UINT32_MAX
+/* CRC delimiter, ACK slot and delimiter, end of frame and intermission, never stuffed */
+#define J1939_MONITOR_FRAME_TAIL            13
+
+typedef struct j1939_monitor_ring {
+  uint32_t bits[J1939_MONITOR_BUCKETS];
+  uint32_t frames[J1939_MONITOR_BUCKETS];
+} j1939_monitor_ring_t;
+
+typedef struct j1939_monitor_entry {
+  uint32_t pgn;
+  j1939_monitor_ring_t ring;
+} j1939_monitor_entry_t;
+
+struct j1939_monitor {
+  uint32_t bitrate;
+  uint32_t bucket_us;
+  /* bucket being filled, numbered from time 0 */
+  uint64_t epoch;
+  uint64_t start_us;
+  int started;
+  j1939_port_t *port;
+  int capture;
+  uint16_t threshold;
+  int alarmed;
+  j1939_monitor_alarm_t alarm_cb;
+  void *alarm_arg;
+  uint16_t capacity;
+  uint16_t count;
+  uint32_t mask;
+  j1939_monitor_ring_t bus;
+  j1939_monitor_ring_t other;
+  j1939_monitor_ring_t sources[0x100];
+  j1939_monitor_entry_t entries[];
+};
+
+typedef struct j1939_monitor_stream {
+  uint16_t bits;
+  uint16_t crc;
+  uint8_t level;
+  uint8_t run;
+} j1939_monitor_stream_t;
+
+/* appends the count low bits of value msb first, stuffing after five equal bits, reference ISO 11898-1 */
+static void j1939_monitor_push(j1939_monitor_stream_t *stream, uint32_t value, uint8_t count, int crc) {
+  while (count--) {
+    uint8_t bit = value >> count & 0x01;
+    if (crc) {
+      uint8_t next = bit ^ (stream->crc >> 14 & 0x01);
+      stream->crc = stream->crc << 1 & 0x7FFF;
+      if (next)
+        stream->crc ^= 0x4599;
+    }
+    stream->bits += 1;
+    stream->run = bit == stream->level ? stream->run + 1 : 1;
+    stream->level = bit;
+    if (stream->run == 5) {
+      /* the stuff bit is the complement and starts the next run */
+      stream->bits += 1;
+      stream->level = !bit;
+      stream->run = 1;
+    }
+  }
+}
+
+uint16_t j1939_monitor_frame_bits(const j1939_static_message_t *msg) {
+  uint8_t size = msg->size < J1939_SIZE_DATAFIELD ? msg->size : J1939_SIZE_DATAFIELD;
+  j1939_monitor_stream_t stream = { .bits = 0, .crc = 0, .level = 0xFF, .run = 0, };
+  /* SOF, base identifier, SRR and IDE recessive, identifier extension, RTR, r1, r0, DLC */
+  j1939_monitor_push(&stream, 0, 1, 1);
+  j1939_monitor_push(&stream, msg->id >> 18 & 0x7FF, 11, 1);
+  j1939_monitor_push(&stream, 0x03, 2, 1);
+  j1939_monitor_push(&stream, msg->id & 0x3FFFF, 18, 1);
+  j1939_monitor_push(&stream, 0, 3, 1);
+  j1939_monitor_push(&stream, size, 4, 1);
+  for (uint8_t idx = 0; idx < size; ++idx)
+    j1939_monitor_push(&stream, msg->data[idx], 8, 1);
+  j1939_monitor_push(&stream, stream.crc, 15, 0);
+  return stream.bits + J1939_MONITOR_FRAME_TAIL;
+}
+
+static inline uint32_t j1939_monitor_home(j1939_monitor_t *self, uint32_t pgn) {
+  return (pgn * 2654435761U) & self->mask;
+}
+
+/* slot holding pgn, or the empty slot it would be inserted at */
+static uint32_t j1939_monitor_find(j1939_monitor_t *self, uint32_t pgn) {
+  uint32_t idx = j1939_monitor_home(self, pgn);
+  while (self->entries[idx].pgn != pgn && self->entries[idx].pgn != J1939_MONITOR_EMPTY)
+    idx = (idx + 1) & self->mask;
+  return idx;
+}
+
+/* backward shift deletion */
+static void j1939_monitor_erase(j1939_monitor_t *self, uint32_t idx) {
+  uint32_t next = idx;
+  while (self->entries[next = (next + 1) & self->mask].pgn != J1939_MONITOR_EMPTY) {
+    uint32_t home = j1939_monitor_home(self, self->entries[next].pgn);
+    if (((next - home) & self->mask) >= ((next - idx) & self->mask)) {
+      self->entries[idx] = self->entries[next];
+      idx = next;
+    }
+  }
+  self->entries[idx].pgn = J1939_MONITOR_EMPTY;
+  --self->count;
+}
+
+static inline void j1939_monitor_clear(j1939_monitor_ring_t *ring, uint8_t bucket) {
+  ring->bits[bucket] = 0;
+  ring->frames[bucket] = 0;
+}
+
+static inline int j1939_monitor_idle(const j1939_monitor_ring_t *ring) {
+  for (uint8_t bucket = 0; bucket < J1939_MONITOR_BUCKETS; ++bucket) {
+    if (ring->frames[bucket])
+      return 0;
+  }
+  return 1;
+}
+
+/* time the window ending at now_us covers, at least one bucket */
+static uint64_t j1939_monitor_span(j1939_monitor_t *self, uint64_t now_us) {
+  uint64_t begin = self->epoch * self->bucket_us;
+  uint64_t span = (uint64_t)(J1939_MONITOR_BUCKETS - 1) * self->bucket_us + (now_us > begin ? now_us - begin : 0);
+  if (now_us > self->start_us && now_us - self->start_us < span)
+    span = now_us - self->start_us;
+  return span < self->bucket_us ? self->bucket_us : span;
+}
+
+static void j1939_monitor_usage(j1939_monitor_t *self, const j1939_monitor_ring_t *ring, uint64_t span, uint32_t key, j1939_monitor_usage_t *usage) {
+  uint64_t bits = 0, frames = 0;
+  for (uint8_t bucket = 0; bucket < J1939_MONITOR_BUCKETS; ++bucket) {
+    bits += ring->bits[bucket];
+    frames += ring->frames[bucket];
+  }
+  uint64_t load = bits * 1000000 / span * 1000 / self->bitrate;
+  usage->key = key;
+  usage->bits_per_second = bits * 1000000 / span;
+  usage->frames_per_second = frames * 1000000 / span;
+  usage->load = load < UINT16_MAX ? load : UINT16_MAX;
+}
+
+static void j1939_monitor_alarm(j1939_monitor_t *self, uint64_t now_us) {
+  j1939_monitor_usage_t usage;
+  if (self->alarm_cb == NULL)
+    return;
+  j1939_monitor_usage(self, &self->bus, j1939_monitor_span(self, now_us), 0, &usage);
+  if (!self->alarmed && usage.load >= self->threshold) {
+    self->alarmed = 1;
+    self->alarm_cb(usage.load, 1, self->alarm_arg);
+  }
+  else if (self->alarmed && usage.load < self->threshold) {
+    self->alarmed = 0;
+    self->alarm_cb(usage.load, 0, self->alarm_arg);
+  }
+}
+
+/* moves on to the bucket of time_us, the buckets that fell out of the window are cleared */
+static void j1939_monitor_advance(j1939_monitor_t *self, uint64_t time_us) {
+  uint64_t epoch = time_us / self->bucket_us;
+  if (!self->started) {
+    self->started = 1;
+    self->start_us = time_us;
+    self->epoch = epoch;
+    return;
+  }
+  if (epoch <= self->epoch)
+    return;
+
+  uint64_t steps = epoch - self->epoch < J1939_MONITOR_BUCKETS ? epoch - self->epoch : J1939_MONITOR_BUCKETS;
+  for (uint64_t step = 1; step <= steps; ++step) {
+    uint8_t bucket = (self->epoch + step) % J1939_MONITOR_BUCKETS;
+    j1939_monitor_clear(&self->bus, bucket);
+    j1939_monitor_clear(&self->other, bucket);
+    for (uint16_t sa = 0; sa < 0x100; ++sa)
+      j1939_monitor_clear(&self->sources[sa], bucket);
+    for (uint32_t idx = 0; idx <= self->mask; ++idx)
+      j1939_monitor_clear(&self->entries[idx].ring, bucket);
+  }
+  self->epoch = epoch;
+
+  /* PGNs that went silent give their slot back, a shifted entry is checked again in place */
+  for (uint32_t idx = 0; idx <= self->mask;) {
+    if (self->entries[idx].pgn != J1939_MONITOR_EMPTY && j1939_monitor_idle(&self->entries[idx].ring))
+      j1939_monitor_erase(self, idx);
+    else
+      ++idx;
+  }
+
+  j1939_monitor_alarm(self, time_us);
+}
+
+static void j1939_monitor_hook(j1939_port_t *port, const j1939_static_message_t *msg, j1939_port_dir_t dir, void *arg) {
+  j1939_monitor_t *self = (j1939_monitor_t *)arg;
+  if (self->port && self->port != port)
+    return;
+#if J1939_TIMESTAMP
+  j1939_monitor_frame(self, msg, (msg->timestamp ? msg->timestamp : j1939_port_get_time()) / 1000);
+#else
+  j1939_monitor_frame(self, msg, j1939_port_get_time() / 1000);
+#endif /* J1939_TIMESTAMP */
+}
+
+j1939_monitor_t *j1939_monitor_create(uint32_t bitrate, uint32_t window_ms, uint16_t pgn_capacity) {
+  /* keep the load factor at or below one half */
+  uint32_t slots = 1;
+  while (slots < pgn_capacity * 2U)
+    slots <<= 1;
+  if (bitrate == 0 || window_ms < J1939_MONITOR_BUCKETS || window_ms > UINT32_MAX / 1000)
+    return NULL;
+
+  j1939_monitor_t *self = (j1939_monitor_t *)calloc(1, sizeof(j1939_monitor_t) + slots * sizeof(j1939_monitor_entry_t));
+  if (self == NULL)
+    return NULL;
+  self->bitrate = bitrate;
+  self->bucket_us = window_ms * 1000 / J1939_MONITOR_BUCKETS;
+  self->capacity = pgn_capacity;
+  self->mask = slots - 1;
+  for (uint32_t idx = 0; idx < slots; ++idx)
+    self->entries[idx].pgn = J1939_MONITOR_EMPTY;
+
+  return self;
+}
+
+j1939_status_t j1939_monitor_delete(j1939_monitor_t *self) {
+  if (self->capture)
+    j1939_port_hook_unregister(j1939_monitor_hook, self);
+  free(self);
+  return J1939_OK;
+}
+
+j1939_status_t j1939_monitor_capture(j1939_monitor_t *self, j1939_port_t *port) {
+  self->port = port;
+  if (!self->capture && j1939_port_hook_register(j1939_monitor_hook, self) != J1939_OK)
+    return J1939_ERROR;
+  self->capture = 1;
+  return J1939_OK;
+}
+
+j1939_status_t j1939_monitor_frame(j1939_monitor_t *self, const j1939_static_message_t *msg, uint64_t time_us) {
+  uint16_t bits = j1939_monitor_frame_bits(msg);
+  j1939_monitor_advance(self, time_us);
+
+  /* frames arriving late are counted in the current bucket */
+  uint8_t bucket = self->epoch % J1939_MONITOR_BUCKETS;
+  uint32_t pgn = j1939_get_pgn(msg->id);
+  uint32_t idx = j1939_monitor_find(self, pgn);
+  j1939_monitor_ring_t *rings[] = {&self->bus, &self->sources[msg->pdu.source_address], &self->other};
+  if (self->entries[idx].pgn == pgn)
+    rings[2] = &self->entries[idx].ring;
+  else if (self->count < self->capacity) {
+    self->entries[idx].pgn = pgn;
+    memset(&self->entries[idx].ring, 0, sizeof(j1939_monitor_ring_t));
+    ++self->count;
+    rings[2] = &self->entries[idx].ring;
+  }
+  for (uint8_t ring = 0; ring < sizeof(rings) / sizeof(rings[0]); ++ring) {
+    rings[ring]->bits[bucket] += bits;
+    rings[ring]->frames[bucket] += 1;
+  }
+  return J1939_OK;
+}
+
+j1939_status_t j1939_monitor_set_alarm(j1939_monitor_t *self, uint16_t threshold, j1939_monitor_alarm_t cb, void *arg) {
+  self->threshold = threshold;
+  self->alarm_cb = cb;
+  self->alarm_arg = arg;
+  self->alarmed = 0;
+  return J1939_OK;
+}
+
+j1939_status_t j1939_monitor_load(j1939_monitor_t *self, uint64_t now_us, j1939_monitor_usage_t *usage) {
+  if (self->started)
+    j1939_monitor_advance(self, now_us);
+  j1939_monitor_usage(self, &self->bus, j1939_monitor_span(self, now_us), 0, usage);
+  return J1939_OK;
+}
+
+/* keeps usage sorted by bits, most first, drops what does not fit */
+static uint16_t j1939_monitor_rank(j1939_monitor_usage_t *usage, uint16_t count, uint16_t size, const j1939_monitor_usage_t *item) {
+  if (item->bits_per_second == 0 || size == 0 || (count == size && usage[size - 1].bits_per_second >= item->bits_per_second))
+    return count;
+  uint16_t idx = count < size ? count++ : size - 1;
+  for (; idx && usage[idx - 1].bits_per_second < item->bits_per_second; --idx)
+    usage[idx] = usage[idx - 1];
+  usage[idx] = *item;
+  return count;
+}
+
+uint16_t j1939_monitor_top(j1939_monitor_t *self, j1939_monitor_key_t key, uint64_t now_us, j1939_monitor_usage_t *usage, uint16_t size) {
+  j1939_monitor_usage_t item;
+  uint16_t count = 0;
+  if (self->started)
+    j1939_monitor_advance(self, now_us);
+  uint64_t span = j1939_monitor_span(self, now_us);
+  switch (key) {
+    case J1939_MONITOR_SOURCE:
+      for (uint16_t sa = 0; sa < 0x100; ++sa) {
+        j1939_monitor_usage(self, &self->sources[sa], span, sa, &item);
+        count = j1939_monitor_rank(usage, count, size, &item);
+      }
+      break;
+    case J1939_MONITOR_PGN:
+      for (uint32_t idx = 0; idx <= self->mask; ++idx) {
+        if (self->entries[idx].pgn == J1939_MONITOR_EMPTY)
+          continue;
+        j1939_monitor_usage(self, &self->entries[idx].ring, span, self->entries[idx].pgn, &item);
+        count = j1939_monitor_rank(usage, count, size, &item);
+      }
+      j1939_monitor_usage(self, &self->other, span, J1939_MONITOR_OTHER, &item);
+      count = j1939_monitor_rank(usage, count, size, &item);
+      break;
+    default:
+      break;
+  }
+  return count;
+}
@@ -0,0 +1,74 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_MONITOR_H
+#define J1939_MONITOR_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939_port.h"
+
+/* Bus load monitor. Every frame is weighed by its length on the wire, stuff bits included, and
+ * counted for the whole bus, its source address and its PGN. The counters are rings of
+ * J1939_MONITOR_BUCKETS buckets that together span the window, the oldest bucket is dropped as
+ * time moves on. Memory is fixed at create, PGNs beyond the capacity are counted as
+ * J1939_MONITOR_OTHER. Loads are in per mille of the bitrate, e.g. to pick BAM intervals and
+ * cyclic rates from. */
+#define J1939_MONITOR_BUCKETS               8
+#define J1939_MONITOR_OTHER                 UINT32_MAX
+
+typedef enum j1939_monitor_key {
+  J1939_MONITOR_SOURCE,
+  J1939_MONITOR_PGN,
+} j1939_monitor_key_t;
+
+typedef struct j1939_monitor_usage {
+  /* source address, PGN or J1939_MONITOR_OTHER, unused for the whole bus */
+  uint32_t key;
+  uint32_t bits_per_second;
+  uint32_t frames_per_second;
+  /* per mille of the bitrate */
+  uint16_t load;
+} j1939_monitor_usage_t;
+
+/* raised once the bus load over the window reaches the threshold, cleared once it falls below */
+typedef void (*j1939_monitor_alarm_t)(uint16_t load, int raised, void *arg);
+
+typedef struct j1939_monitor j1939_monitor_t;
+
+/* bitrate in bit/s, window_ms of at least J1939_MONITOR_BUCKETS */
+j1939_monitor_t *j1939_monitor_create(uint32_t bitrate, uint32_t window_ms, uint16_t pgn_capacity);
+j1939_status_t j1939_monitor_delete(j1939_monitor_t *self);
+
+/* counts every frame passing port through j1939_port_transmit/j1939_port_receive, NULL for all ports.
+ * in-process buses deliver each frame to several ports, watch one of them */
+j1939_status_t j1939_monitor_capture(j1939_monitor_t *self, j1939_port_t *port);
+/* counts one frame seen at time_us */
+j1939_status_t j1939_monitor_frame(j1939_monitor_t *self, const j1939_static_message_t *msg, uint64_t time_us);
+j1939_status_t j1939_monitor_set_alarm(j1939_monitor_t *self, uint16_t threshold, j1939_monitor_alarm_t cb, void *arg);
+
+/* bus usage over the window ending at now_us */
+j1939_status_t j1939_monitor_load(j1939_monitor_t *self, uint64_t now_us, j1939_monitor_usage_t *usage);
+/* the busiest sources or PGNs, most bits first, returns the number filled in */
+uint16_t j1939_monitor_top(j1939_monitor_t *self, j1939_monitor_key_t key, uint64_t now_us, j1939_monitor_usage_t *usage, uint16_t size);
+
+/* bits on the wire for an extended data frame, stuff bits and interframe space included */
+uint16_t j1939_monitor_frame_bits(const j1939_static_message_t *msg);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_MONITOR_H */
@@ -15,43 +15,204 @@
   */
 #include "j1939_port.h"
 #include <stdio.h>
+#include <stddef.h>
 
 #if defined J1939_PORT_VIRTUAL
 #include "j1939_virtual.h"
 
-j1939_status_t j1939_port_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
+static j1939_status_t port_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
   return j1939_virtual_transmit(self, msg, timeout_ms);
 }
 
-j1939_status_t j1939_port_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms) {
+static j1939_status_t port_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms) {
   return j1939_virtual_receive(self, msg, timeout_ms);
 }
 
+static j1939_status_t port_set_filter(j1939_port_t *self, const j1939_filter_t *filter, uint8_t count) {
+  return j1939_virtual_set_filter(self, filter, count);
+}
+
 uint32_t j1939_port_get_tick() {
   return j1939_virtual_get_tick();
 }
 
+uint64_t j1939_port_get_time() {
+  return j1939_virtual_get_time();
+}
+
 void j1939_port_delay(uint32_t time_ms) {
 
 }
 
+#elif defined J1939_PORT_SHM
+#include "j1939_shm.h"
+#include <unistd.h>
+
+static j1939_status_t port_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
+  return j1939_shm_transmit(self, msg, timeout_ms);
+}
+
+static j1939_status_t port_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms) {
+  return j1939_shm_receive(self, msg, timeout_ms);
+}
+
+static j1939_status_t port_set_filter(j1939_port_t *self, const j1939_filter_t *filter, uint8_t count) {
+  /* every node reads the whole ring */
+  return J1939_ERROR;
+}
+
+uint32_t j1939_port_get_tick() {
+  return j1939_shm_get_tick();
+}
+
+uint64_t j1939_port_get_time() {
+  return j1939_shm_get_time();
+}
+
+void j1939_port_delay(uint32_t time_ms) {
+  usleep(time_ms * 1000);
+}
+
 #elif defined J1939_PORT_ESP32
 #include "driver/twai.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
 #include <string.h>
 
-j1939_status_t j1939_port_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
+static j1939_status_t port_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
   twai_message_t buff = { { { .extd = 1, }, }, .identifier = msg->id, .data_length_code = msg->size, };
   memcpy(buff.data, msg->data, msg->size);
-  return twai_transmit(&buff, pdMS_TO_TICKS(timeout_ms)) == ESP_OK ? J1939_OK : J1939_ERROR;
+  /* a full TX queue times out, bus off and a stopped driver fail */
+  switch (twai_transmit(&buff, pdMS_TO_TICKS(timeout_ms))) {
+    case ESP_OK:
+      return J1939_OK;
+    case ESP_ERR_TIMEOUT:
+      return J1939_TIMEOUT;
+    default:
+      return J1939_ERROR;
+  }
 }
 
-j1939_status_t j1939_port_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms) {
+static j1939_status_t port_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms) {
   twai_message_t buff = {0};
   return twai_receive(&buff, pdMS_TO_TICKS(timeout_ms)) == ESP_OK ? msg->id = buff.identifier, msg->size = buff.data_length_code, memcpy(msg->data, buff.data, buff.data_length_code), J1939_OK : J1939_TIMEOUT;
 }
 
+static j1939_status_t port_set_filter(j1939_port_t *self, const j1939_filter_t *filter, uint8_t count) {
+  /* TWAI takes its single code/mask at twai_driver_install, see j1939_port_esp32_filter */
+  return J1939_ERROR;
+}
+
+j1939_status_t j1939_port_esp32_filter(const j1939_filter_t *filter, uint8_t count, twai_filter_config_t *config) {
+  j1939_filter_t merged = j1939_port_filter_merge(filter, count);
+  /* single filter mode, extended id in bits 31..3, a set mask bit means don't care */
+  config->acceptance_code = merged.id << 3;
+  config->acceptance_mask = ~(merged.mask << 3);
+  config->single_filter = true;
+  return J1939_OK;
+}
+
 uint32_t j1939_port_get_tick() {
-  return 0;
+  return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+uint64_t j1939_port_get_time() {
+  return (uint64_t)esp_timer_get_time() * 1000;
+}
+
+void j1939_port_delay(uint32_t time_ms) {
+  vTaskDelay(pdMS_TO_TICKS(time_ms));
 }
 
 #endif /* J1939_PORT */
+
+#if J1939_SIZE_PORT_HOOK
+static struct {
+  j1939_port_hook_t hook;
+  void *arg;
+} _hooks[J1939_SIZE_PORT_HOOK] = {0};
+
+static inline void port_hook(j1939_port_t *self, const j1939_static_message_t *msg, j1939_port_dir_t dir) {
+  for (uint8_t idx = 0; idx < J1939_SIZE_PORT_HOOK; ++idx) {
+    if (_hooks[idx].hook)
+      _hooks[idx].hook(self, msg, dir, _hooks[idx].arg);
+  }
+}
+#endif /* J1939_SIZE_PORT_HOOK */
+
+j1939_status_t j1939_port_hook_register(j1939_port_hook_t hook, void *arg) {
+#if J1939_SIZE_PORT_HOOK
+  for (uint8_t idx = 0; idx < J1939_SIZE_PORT_HOOK; ++idx) {
+    if (_hooks[idx].hook == NULL) {
+      _hooks[idx].hook = hook;
+      _hooks[idx].arg = arg;
+      return J1939_OK;
+    }
+  }
+#endif /* J1939_SIZE_PORT_HOOK */
+  return J1939_ERROR;
+}
+
+j1939_status_t j1939_port_hook_unregister(j1939_port_hook_t hook, void *arg) {
+#if J1939_SIZE_PORT_HOOK
+  for (uint8_t idx = 0; idx < J1939_SIZE_PORT_HOOK; ++idx) {
+    if (_hooks[idx].hook == hook && _hooks[idx].arg == arg) {
+      _hooks[idx].hook = NULL;
+      _hooks[idx].arg = NULL;
+      return J1939_OK;
+    }
+  }
+#endif /* J1939_SIZE_PORT_HOOK */
+  return J1939_ERROR;
+}
+
+j1939_status_t j1939_port_set_filter(j1939_port_t *self, const j1939_filter_t *filter, uint8_t count) {
+  return port_set_filter(self, filter, count);
+}
+
+j1939_filter_t j1939_port_filter_merge(const j1939_filter_t *filter, uint8_t count) {
+  j1939_filter_t merged = { .id = 0, .mask = 0, };
+  if (count == 0)
+    return merged;
+  merged = filter[0];
+  for (uint8_t idx = 1; idx < count; ++idx) {
+    /* keep only the bits every filter cares about and agrees on */
+    merged.mask &= filter[idx].mask & ~(merged.id ^ filter[idx].id);
+  }
+  merged.id &= merged.mask;
+  return merged;
+}
+
+j1939_status_t j1939_port_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
+#if J1939_TIMESTAMP
+  /* the copy carries the transmit time, virtual buses hand it to the receivers */
+  j1939_static_message_t m = *msg;
+  m.timestamp = m.timestamp_first = j1939_port_get_time();
+  msg = &m;
+#endif /* J1939_TIMESTAMP */
+  j1939_status_t res = port_transmit(self, msg, timeout_ms);
+#if J1939_SIZE_PORT_HOOK
+  if (res == J1939_OK)
+    port_hook(self, msg, J1939_PORT_TX);
+#endif /* J1939_SIZE_PORT_HOOK */
+  return res;
+}
+
+j1939_status_t j1939_port_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms) {
+#if J1939_TIMESTAMP
+  msg->timestamp = 0;
+#endif /* J1939_TIMESTAMP */
+  j1939_status_t res = port_receive(self, msg, timeout_ms);
+#if J1939_TIMESTAMP
+  /* ports without a controller timestamp are stamped on arrival */
+  if (res == J1939_OK && msg->timestamp == 0)
+    msg->timestamp = j1939_port_get_time();
+  if (res == J1939_OK)
+    msg->timestamp_first = msg->timestamp;
+#endif /* J1939_TIMESTAMP */
+#if J1939_SIZE_PORT_HOOK
+  if (res == J1939_OK)
+    port_hook(self, msg, J1939_PORT_RX);
+#endif /* J1939_SIZE_PORT_HOOK */
+  return res;
+}
@@ -21,10 +21,35 @@ extern "C" {
 
 #include "j1939_types.h"
 
+typedef enum j1939_port_dir {
+  J1939_PORT_RX,
+  J1939_PORT_TX,
+} j1939_port_dir_t;
+
+/* called for every frame that passed the port successfully */
+typedef void (*j1939_port_hook_t)(j1939_port_t *port, const j1939_static_message_t *msg, j1939_port_dir_t dir, void *arg);
+
+j1939_status_t j1939_port_hook_register(j1939_port_hook_t hook, void *arg);
+j1939_status_t j1939_port_hook_unregister(j1939_port_hook_t hook, void *arg);
+
+/* J1939_TIMEOUT if the port stayed full for timeout_ms, J1939_ERROR if it can not send at all */
 j1939_status_t j1939_port_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms);
 j1939_status_t j1939_port_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms);
+/* hardware acceptance filters, J1939_ERROR if the port can not filter, count 0 accepts all */
+j1939_status_t j1939_port_set_filter(j1939_port_t *self, const j1939_filter_t *filter, uint8_t count);
+
+/* the single filter that lets every one of count filters pass, for controllers with one code/mask register */
+j1939_filter_t j1939_port_filter_merge(const j1939_filter_t *filter, uint8_t count);
+
+#if defined J1939_PORT_ESP32
+#include "driver/twai.h"
+/* filter config for twai_driver_install, built from j1939_port_filter_merge */
+j1939_status_t j1939_port_esp32_filter(const j1939_filter_t *filter, uint8_t count, twai_filter_config_t *config);
+#endif /* J1939_PORT_ESP32 */
 
 uint32_t j1939_port_get_tick(void);
+/* monotonic port clock in ns, resolution is the port's (us on ESP32) */
+uint64_t j1939_port_get_time(void);
 void j1939_port_delay(uint32_t time_ms);
 
 #ifdef __cplusplus
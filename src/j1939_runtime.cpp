@@ -0,0 +1,338 @@
+#include "j1939_runtime.h"
+#include "j1939_tp.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#if defined __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif /* __linux__ */
+
+/* frames one run drains at most, a busy port does not starve the other tasks of its worker */
+static constexpr uint32_t run_budget = 64;
+
+using clock_type = std::chrono::steady_clock;
+
+/* parked -> queued -> running -> parked, notified marks work that came in while running */
+enum task_state : uint8_t {
+  task_parked,
+  task_queued,
+  task_running,
+  task_notified,
+  task_removed,
+};
+
+struct task_t {
+  j1939_t *handle;
+  j1939_scheduler_t *scheduler;
+  std::atomic<uint8_t> state{task_parked};
+  /* worker that ran the task last */
+  std::atomic<uint16_t> home{0};
+  std::mutex lock;
+  std::vector<std::pair<j1939_runtime_fn_t, void *>> posted;
+};
+
+struct wakeup_t {
+  clock_type::time_point due;
+  task_t *task;
+  bool operator>(const wakeup_t &other) const {
+    return due > other.due;
+  }
+};
+
+struct worker_t {
+  std::mutex lock;
+  std::deque<task_t *> queue;
+  std::thread thread;
+  std::atomic<uint64_t> runs{0}, steals{0}, frames{0}, parks{0};
+};
+
+struct j1939_runtime {
+  std::vector<std::unique_ptr<worker_t>> workers;
+  std::chrono::milliseconds poll;
+  bool pin;
+  std::atomic<bool> stop{false};
+  /* idle workers wait here for queued tasks or the earliest wakeup */
+  std::mutex lock;
+  std::condition_variable wake;
+  std::atomic<uint32_t> sleeping{0};
+  std::priority_queue<wakeup_t, std::vector<wakeup_t>, std::greater<wakeup_t>> wakeups;
+  std::atomic<clock_type::rep> next_due{clock_type::time_point::max().time_since_epoch().count()};
+  std::mutex tasks_lock;
+  std::unordered_map<j1939_t *, std::unique_ptr<task_t>> tasks;
+  /* removed tasks may still sit in a queue or wakeup, they are freed with the runtime */
+  std::vector<std::unique_ptr<task_t>> retired;
+};
+
+static void enqueue(j1939_runtime_t *self, task_t *task) {
+  worker_t &worker = *self->workers[task->home % self->workers.size()];
+  {
+    std::lock_guard<std::mutex> lock(worker.lock);
+    worker.queue.push_back(task);
+  }
+  /* a worker going to sleep counts itself before its last look at the queues */
+  if (self->sleeping) {
+    std::lock_guard<std::mutex> lock(self->lock);
+    self->wake.notify_one();
+  }
+}
+
+static void notify(j1939_runtime_t *self, task_t *task) {
+  uint8_t state = task->state;
+  for (;;) {
+    if (state == task_parked && task->state.compare_exchange_weak(state, task_queued))
+      return enqueue(self, task);
+    else if (state == task_running && task->state.compare_exchange_weak(state, task_notified))
+      return;
+    else if (state == task_queued || state == task_notified || state == task_removed)
+      return;
+  }
+}
+
+static void park(j1939_runtime_t *self, task_t *task, clock_type::time_point due) {
+  std::lock_guard<std::mutex> lock(self->lock);
+  self->wakeups.push({due, task});
+  self->next_due = self->wakeups.top().due.time_since_epoch().count();
+}
+
+/* queues the parked tasks that are due, a task notified in the meantime is already queued */
+static bool fire(j1939_runtime_t *self) {
+  std::vector<task_t *> due;
+  {
+    std::lock_guard<std::mutex> lock(self->lock);
+    auto now = clock_type::now();
+    while (!self->wakeups.empty() && self->wakeups.top().due <= now) {
+      due.push_back(self->wakeups.top().task);
+      self->wakeups.pop();
+    }
+    self->next_due = (self->wakeups.empty() ? clock_type::time_point::max() : self->wakeups.top().due).time_since_epoch().count();
+  }
+  for (task_t *task : due) {
+    uint8_t state = task_parked;
+    if (task->state.compare_exchange_strong(state, task_queued))
+      enqueue(self, task);
+  }
+  return !due.empty();
+}
+
+static task_t *pop(worker_t &worker) {
+  std::lock_guard<std::mutex> lock(worker.lock);
+  if (worker.queue.empty())
+    return nullptr;
+  task_t *task = worker.queue.front();
+  worker.queue.pop_front();
+  return task;
+}
+
+/* takes the most recently queued task of the next worker that has any, its owner serves the oldest first */
+static task_t *steal(j1939_runtime_t *self, uint16_t idx) {
+  for (size_t step = 1; step < self->workers.size(); ++step) {
+    worker_t &victim = *self->workers[(idx + step) % self->workers.size()];
+    std::lock_guard<std::mutex> lock(victim.lock);
+    if (!victim.queue.empty()) {
+      task_t *task = victim.queue.back();
+      victim.queue.pop_back();
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+static bool idle(j1939_runtime_t *self) {
+  for (auto &worker : self->workers) {
+    std::lock_guard<std::mutex> lock(worker->lock);
+    if (!worker->queue.empty())
+      return false;
+  }
+  return !self->stop;
+}
+
+static void run(j1939_runtime_t *self, uint16_t idx, task_t *task) {
+  worker_t &worker = *self->workers[idx];
+  uint8_t state = task_queued;
+  if (!task->state.compare_exchange_strong(state, task_running))
+    return;
+  task->home = idx;
+
+  std::vector<std::pair<j1939_runtime_fn_t, void *>> posted;
+  {
+    std::lock_guard<std::mutex> lock(task->lock);
+    posted.swap(task->posted);
+  }
+  for (auto &[fn, arg] : posted)
+    fn(task->handle, arg);
+
+  uint32_t frames = 0;
+  while (frames < run_budget && j1939_receive(task->handle, 0) != J1939_TIMEOUT)
+    ++frames;
+  uint32_t deadline;
+  if (task->scheduler) {
+    j1939_scheduler_process(task->scheduler, 0);
+    deadline = j1939_scheduler_next_deadline(task->scheduler);
+  }
+  else {
+    j1939_tp_cm_transmit_manager(task->handle, 0);
+    deadline = j1939_tp_next_deadline(task->handle);
+  }
+
+  worker.runs += 1;
+  worker.frames += frames;
+  bool again = frames == run_budget || deadline == 0;
+  {
+    std::lock_guard<std::mutex> lock(task->lock);
+    again |= !task->posted.empty();
+  }
+  state = task_running;
+  if (!again && task->state.compare_exchange_strong(state, task_parked)) {
+    worker.parks += 1;
+    park(self, task, clock_type::now() + std::min<std::chrono::milliseconds>(self->poll, std::chrono::milliseconds(deadline)));
+    return;
+  }
+  /* more to do, or notified while running */
+  task->state = task_queued;
+  enqueue(self, task);
+}
+
+static void work(j1939_runtime_t *self, uint16_t idx) {
+#if defined __linux__
+  if (self->pin) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(idx % std::max(1U, std::thread::hardware_concurrency()), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+#endif /* __linux__ */
+  worker_t &worker = *self->workers[idx];
+  while (!self->stop) {
+    if (clock_type::now().time_since_epoch().count() >= self->next_due)
+      fire(self);
+    task_t *task = pop(worker);
+    if (task == nullptr && (task = steal(self, idx)) != nullptr)
+      worker.steals += 1;
+    if (task) {
+      run(self, idx, task);
+      continue;
+    }
+    if (fire(self))
+      continue;
+
+    std::unique_lock<std::mutex> lock(self->lock);
+    self->sleeping += 1;
+    if (idle(self)) {
+      auto due = clock_type::now() + self->poll;
+      if (!self->wakeups.empty() && self->wakeups.top().due < due)
+        due = self->wakeups.top().due;
+      self->wake.wait_until(lock, due);
+    }
+    self->sleeping -= 1;
+  }
+}
+
+static task_t *find(j1939_runtime_t *self, j1939_t *handle) {
+  std::lock_guard<std::mutex> lock(self->tasks_lock);
+  auto it = self->tasks.find(handle);
+  return it == self->tasks.end() ? nullptr : it->second.get();
+}
+
+extern "C" j1939_runtime_t *j1939_runtime_create(uint16_t workers, uint32_t poll_ms, int pin) {
+  if (workers == 0)
+    workers = std::max(1U, std::thread::hardware_concurrency());
+  if (poll_ms == 0)
+    return nullptr;
+  j1939_runtime_t *self = new j1939_runtime;
+  self->poll = std::chrono::milliseconds(poll_ms);
+  self->pin = pin;
+  for (uint16_t idx = 0; idx < workers; ++idx)
+    self->workers.emplace_back(new worker_t);
+  for (uint16_t idx = 0; idx < workers; ++idx)
+    self->workers[idx]->thread = std::thread(work, self, idx);
+  return self;
+}
+
+extern "C" j1939_status_t j1939_runtime_delete(j1939_runtime_t *self) {
+  {
+    std::lock_guard<std::mutex> lock(self->lock);
+    self->stop = true;
+    self->wake.notify_all();
+  }
+  for (auto &worker : self->workers)
+    worker->thread.join();
+  delete self;
+  return J1939_OK;
+}
+
+extern "C" j1939_status_t j1939_runtime_add(j1939_runtime_t *self, j1939_t *handle, j1939_scheduler_t *scheduler) {
+  task_t *task;
+  {
+    std::lock_guard<std::mutex> lock(self->tasks_lock);
+    auto &slot = self->tasks[handle];
+    if (slot)
+      return J1939_ERROR;
+    slot.reset(task = new task_t);
+    task->handle = handle;
+    task->scheduler = scheduler;
+    /* spread new tasks, stealing evens out the rest */
+    task->home = (self->tasks.size() - 1) % self->workers.size();
+  }
+  notify(self, task);
+  return J1939_OK;
+}
+
+extern "C" j1939_status_t j1939_runtime_remove(j1939_runtime_t *self, j1939_t *handle) {
+  task_t *task;
+  {
+    std::lock_guard<std::mutex> lock(self->tasks_lock);
+    auto it = self->tasks.find(handle);
+    if (it == self->tasks.end())
+      return J1939_ERROR;
+    task = it->second.get();
+    self->retired.push_back(std::move(it->second));
+    self->tasks.erase(it);
+  }
+  /* a parked or queued task is dropped where it sits, a running one is waited for */
+  for (uint8_t state = task->state; state != task_removed; state = task->state) {
+    if ((state == task_parked || state == task_queued) && task->state.compare_exchange_strong(state, task_removed))
+      break;
+    std::this_thread::yield();
+  }
+  return J1939_OK;
+}
+
+extern "C" j1939_status_t j1939_runtime_post(j1939_runtime_t *self, j1939_t *handle, j1939_runtime_fn_t fn, void *arg) {
+  task_t *task = find(self, handle);
+  if (task == nullptr)
+    return J1939_ERROR;
+  {
+    std::lock_guard<std::mutex> lock(task->lock);
+    task->posted.emplace_back(fn, arg);
+  }
+  notify(self, task);
+  return J1939_OK;
+}
+
+extern "C" j1939_status_t j1939_runtime_notify(j1939_runtime_t *self, j1939_t *handle) {
+  task_t *task = find(self, handle);
+  if (task == nullptr)
+    return J1939_ERROR;
+  notify(self, task);
+  return J1939_OK;
+}
+
+extern "C" uint16_t j1939_runtime_workers(j1939_runtime_t *self) {
+  return self->workers.size();
+}
+
+extern "C" j1939_status_t j1939_runtime_stats(j1939_runtime_t *self, uint16_t worker, j1939_runtime_stats_t *stats) {
+  if (worker >= self->workers.size())
+    return J1939_ERROR;
+  worker_t &w = *self->workers[worker];
+  *stats = { .runs = w.runs, .steals = w.steals, .frames = w.frames, .parks = w.parks, };
+  return J1939_OK;
+}
@@ -0,0 +1,67 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_RUNTIME_H
+#define J1939_RUNTIME_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939.h"
+#include "j1939_scheduler.h"
+
+/* Work stealing runtime driving many handles on a pool of workers.
+ * Every handle is a task that runs posted functions, drains its port, then runs its scheduler or
+ * transport sessions. A task is queued again on the worker that ran it last, other workers only
+ * steal it once their own queue ran dry, so a handle keeps its core while the load is even.
+ * No two workers ever run the same handle, anything else touching it goes through
+ * j1939_runtime_post. A task with nothing to do parks until its next deadline, a post or notify,
+ * or at most poll_ms for ports that can not signal received frames.
+ * Port hooks are not synchronised, register them before the runtime starts. */
+
+typedef void (*j1939_runtime_fn_t)(j1939_t *handle, void *arg);
+
+typedef struct j1939_runtime_stats {
+  uint64_t runs;
+  /* runs of tasks taken from another worker's queue */
+  uint64_t steals;
+  uint64_t frames;
+  uint64_t parks;
+} j1939_runtime_stats_t;
+
+typedef struct j1939_runtime j1939_runtime_t;
+
+/* workers 0 uses every core, with pin set worker n is bound to core n */
+j1939_runtime_t *j1939_runtime_create(uint16_t workers, uint32_t poll_ms, int pin);
+/* stops the workers, functions still posted are dropped */
+j1939_status_t j1939_runtime_delete(j1939_runtime_t *self);
+
+/* scheduler may be NULL, the transport sessions are then driven by j1939_tp_cm_transmit_manager */
+j1939_status_t j1939_runtime_add(j1939_runtime_t *self, j1939_t *handle, j1939_scheduler_t *scheduler);
+/* returns once no worker runs the handle, it may be deleted afterwards */
+j1939_status_t j1939_runtime_remove(j1939_runtime_t *self, j1939_t *handle);
+
+/* fn runs on a worker, serialised with everything else done to the handle */
+j1939_status_t j1939_runtime_post(j1939_runtime_t *self, j1939_t *handle, j1939_runtime_fn_t fn, void *arg);
+/* frames are ready, e.g. from a receive interrupt, the handle runs without waiting for its poll */
+j1939_status_t j1939_runtime_notify(j1939_runtime_t *self, j1939_t *handle);
+
+uint16_t j1939_runtime_workers(j1939_runtime_t *self);
+j1939_status_t j1939_runtime_stats(j1939_runtime_t *self, uint16_t worker, j1939_runtime_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_RUNTIME_H */
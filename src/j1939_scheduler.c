@@ -0,0 +1,202 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939_scheduler.h"
+#include "j1939_port.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define J1939_SCHEDULER_FREE                UINT16_MAX
+
+typedef struct j1939_scheduler_entry {
+  /* must be the first member, the user only sees this part of the entry */
+  j1939_static_message_t msg;
+  uint32_t period;
+  uint32_t due;
+  /* position in the heap, J1939_SCHEDULER_FREE if the entry is unused */
+  uint16_t heap_index;
+  j1939_scheduler_stats_t stats;
+} j1939_scheduler_entry_t;
+
+struct j1939_scheduler {
+  j1939_t *handle;
+  uint16_t capacity;
+  uint16_t size;
+  /* min-heap of entry indexes keyed by due tick */
+  uint16_t *heap;
+  j1939_scheduler_entry_t entries[];
+};
+
+static inline int32_t tick_diff(uint32_t l, uint32_t r) {
+  /* tick counters wrap around, compare by signed distance */
+  return (int32_t)(l - r);
+}
+
+static inline uint16_t bit_reverse(uint16_t value) {
+  value = (value & 0x5555) << 1 | (value & 0xAAAA) >> 1;
+  value = (value & 0x3333) << 2 | (value & 0xCCCC) >> 2;
+  value = (value & 0x0F0F) << 4 | (value & 0xF0F0) >> 4;
+  return value << 8 | value >> 8;
+}
+
+static inline int heap_less(j1939_scheduler_t *self, uint16_t l, uint16_t r) {
+  return tick_diff(self->entries[self->heap[l]].due, self->entries[self->heap[r]].due) < 0;
+}
+
+static inline void heap_swap(j1939_scheduler_t *self, uint16_t l, uint16_t r) {
+  uint16_t tmp = self->heap[l];
+  self->heap[l] = self->heap[r];
+  self->heap[r] = tmp;
+  self->entries[self->heap[l]].heap_index = l;
+  self->entries[self->heap[r]].heap_index = r;
+}
+
+static void heap_sift_up(j1939_scheduler_t *self, uint16_t index) {
+  while (index && heap_less(self, index, (index - 1) / 2)) {
+    heap_swap(self, index, (index - 1) / 2);
+    index = (index - 1) / 2;
+  }
+}
+
+static void heap_sift_down(j1939_scheduler_t *self, uint16_t index) {
+  for (;;) {
+    uint32_t min = index, l = 2 * (uint32_t)index + 1, r = l + 1;
+    if (l < self->size && heap_less(self, l, min))
+      min = l;
+    if (r < self->size && heap_less(self, r, min))
+      min = r;
+    if (min == index)
+      break;
+    heap_swap(self, index, min);
+    index = min;
+  }
+}
+
+static j1939_scheduler_entry_t *j1939_scheduler_entry(j1939_scheduler_t *self, const j1939_static_message_t *msg) {
+  const j1939_scheduler_entry_t *entry = (const j1939_scheduler_entry_t *)msg;
+  if (entry < self->entries || entry >= self->entries + self->capacity || entry->heap_index == J1939_SCHEDULER_FREE)
+    return NULL;
+  return (j1939_scheduler_entry_t *)entry;
+}
+
+j1939_scheduler_t *j1939_scheduler_create(j1939_t *handle, uint16_t capacity) {
+  if (capacity == 0 || capacity == J1939_SCHEDULER_FREE)
+    return NULL;
+  j1939_scheduler_t *self = (j1939_scheduler_t *)calloc(1, sizeof(struct j1939_scheduler) + capacity * (sizeof(j1939_scheduler_entry_t) + sizeof(uint16_t)));
+  if (self == NULL)
+    return NULL;
+  self->handle = handle;
+  self->capacity = capacity;
+  self->heap = (uint16_t *)(self->entries + capacity);
+  for (uint16_t idx = 0; idx < capacity; ++idx)
+    self->entries[idx].heap_index = J1939_SCHEDULER_FREE;
+  return self;
+}
+
+j1939_status_t j1939_scheduler_delete(j1939_scheduler_t *self) {
+  free(self);
+  return J1939_OK;
+}
+
+j1939_static_message_t *j1939_scheduler_add(j1939_scheduler_t *self, const j1939_static_message_t *msg, uint32_t period_ms) {
+  if (period_ms == 0 || period_ms > INT32_MAX || msg->size > J1939_SIZE_DATAFIELD || self->size == self->capacity)
+    return NULL;
+
+  j1939_scheduler_entry_t *entry = NULL;
+  uint16_t phase = 0;
+  for (uint16_t idx = 0; idx < self->capacity; ++idx) {
+    if (self->entries[idx].heap_index == J1939_SCHEDULER_FREE) {
+      if (entry == NULL)
+        entry = &self->entries[idx];
+    }
+    else if (self->entries[idx].period == period_ms)
+      ++phase;
+  }
+
+  memset(entry, 0, sizeof(j1939_scheduler_entry_t));
+  entry->msg = *msg;
+  entry->period = period_ms;
+  /* spread messages of equal period over the period (0, 1/2, 1/4, 3/4, ...) to avoid bursts */
+  entry->due = j1939_port_get_tick() + (uint32_t)(((uint64_t)period_ms * bit_reverse(phase)) >> 16);
+  entry->heap_index = self->size;
+  self->heap[self->size++] = entry - self->entries;
+  heap_sift_up(self, entry->heap_index);
+
+  return &entry->msg;
+}
+
+j1939_status_t j1939_scheduler_remove(j1939_scheduler_t *self, j1939_static_message_t *msg) {
+  j1939_scheduler_entry_t *entry = j1939_scheduler_entry(self, msg);
+  if (entry == NULL)
+    return J1939_ERROR;
+
+  uint16_t index = entry->heap_index;
+  heap_swap(self, index, --self->size);
+  entry->heap_index = J1939_SCHEDULER_FREE;
+  if (index < self->size) {
+    heap_sift_up(self, index);
+    heap_sift_down(self, self->entries[self->heap[index]].heap_index);
+  }
+
+  return J1939_OK;
+}
+
+j1939_status_t j1939_scheduler_stats(j1939_scheduler_t *self, const j1939_static_message_t *msg, j1939_scheduler_stats_t *stats) {
+  j1939_scheduler_entry_t *entry = j1939_scheduler_entry(self, msg);
+  if (entry == NULL)
+    return J1939_ERROR;
+
+  *stats = entry->stats;
+
+  return J1939_OK;
+}
+
+uint32_t j1939_scheduler_next_deadline(j1939_scheduler_t *self) {
+  uint32_t deadline = j1939_tp_next_deadline(self->handle);
+  if (self->size == 0)
+    return deadline;
+  int32_t diff = tick_diff(self->entries[self->heap[0]].due, j1939_port_get_tick());
+  return diff <= 0 ? 0 : (uint32_t)diff < deadline ? (uint32_t)diff : deadline;
+}
+
+j1939_status_t j1939_scheduler_process(j1939_scheduler_t *self, uint32_t timeout_ms) {
+  j1939_status_t res = J1939_OK;
+  uint32_t tick = j1939_port_get_tick();
+
+  while (self->size && tick_diff(tick, self->entries[self->heap[0]].due) >= 0) {
+    j1939_scheduler_entry_t *entry = &self->entries[self->heap[0]];
+    if ((res = j1939_transmit_static(self->handle, &entry->msg, timeout_ms)) != J1939_OK)
+      break;
+
+    uint32_t late = tick - entry->due;
+    uint32_t missed = late / entry->period;
+    entry->stats.count += 1;
+    entry->stats.overrun += missed;
+    entry->stats.jitter_last = late;
+    entry->stats.jitter_sum += late;
+    if (late > entry->stats.jitter_max)
+      entry->stats.jitter_max = late;
+
+    /* keep the original phase, periods that were missed entirely are dropped instead of bursting */
+    entry->due += (missed + 1) * entry->period;
+    heap_sift_down(self, 0);
+  }
+
+  /* transport packets share the port with the periodic messages, they go out once those are served */
+  if (res == J1939_OK && j1939_tp_next_deadline(self->handle) == 0)
+    res = j1939_tp_cm_transmit_manager(self->handle, timeout_ms);
+
+  return res;
+}
@@ -0,0 +1,56 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_SCHEDULER_H
+#define J1939_SCHEDULER_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939.h"
+
+/* per message transmit statistics, all times in port ticks (ms) */
+typedef struct j1939_scheduler_stats {
+  uint32_t count;
+  /* number of periods skipped because the message was served too late */
+  uint32_t overrun;
+  /* lateness of the last/worst transmission against its due time */
+  uint32_t jitter_last;
+  uint32_t jitter_max;
+  /* sum of all lateness values, divide by count for the mean */
+  uint64_t jitter_sum;
+} j1939_scheduler_stats_t;
+
+typedef struct j1939_scheduler j1939_scheduler_t;
+
+j1939_scheduler_t *j1939_scheduler_create(j1939_t *handle, uint16_t capacity);
+j1939_status_t j1939_scheduler_delete(j1939_scheduler_t *self);
+
+/* returns the scheduled copy of msg, the payload can be updated in place through it */
+j1939_static_message_t *j1939_scheduler_add(j1939_scheduler_t *self, const j1939_static_message_t *msg, uint32_t period_ms);
+j1939_status_t j1939_scheduler_remove(j1939_scheduler_t *self, j1939_static_message_t *msg);
+
+j1939_status_t j1939_scheduler_stats(j1939_scheduler_t *self, const j1939_static_message_t *msg, j1939_scheduler_stats_t *stats);
+
+/* ticks until the next message or transport packet of the handle is due, 0 if one is due now, UINT32_MAX if nothing is scheduled */
+uint32_t j1939_scheduler_next_deadline(j1939_scheduler_t *self);
+
+/* transmits every message that is due and drives the transport session of the handle, stops at the first port error */
+j1939_status_t j1939_scheduler_process(j1939_scheduler_t *self, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_SCHEDULER_H */
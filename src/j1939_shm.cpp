@@ -0,0 +1,282 @@
+#include "j1939_shm.h"
+#if defined __linux__
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifndef J1939_SHM_CAPACITY
+#define J1939_SHM_CAPACITY 4096
+#endif /* J1939_SHM_CAPACITY */
+
+/* a slot reserved but not published for this long (ms) belongs to a writer that died, readers skip it */
+#ifndef J1939_SHM_STALL
+#define J1939_SHM_STALL 50
+#endif /* J1939_SHM_STALL */
+
+#ifndef J1939_SHM_NAME
+#define J1939_SHM_NAME "/j1939"
+#endif /* J1939_SHM_NAME */
+
+static constexpr uint32_t magic = 0x4A314253;/* "J1BS" */
+
+static_assert((J1939_SHM_CAPACITY & (J1939_SHM_CAPACITY - 1)) == 0, "J1939_SHM_CAPACITY must be a power of two");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs address free atomics");
+
+/* the virtual bus has a node_t of its own, the types stay private to this file */
+namespace {
+
+struct slot_t {
+  /* 2 * position + 1 while written, 2 * position + 2 once published */
+  std::atomic<uint64_t> seq;
+  uint64_t sender;
+  j1939_static_message_t msg;
+};
+
+struct ring_t {
+  std::atomic<uint32_t> magic;
+  uint32_t capacity;
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> nodes;
+  /* bumped after every publish, readers sleep on it */
+  std::atomic<uint32_t> futex;
+  std::atomic<uint32_t> waiters;
+  slot_t slots[J1939_SHM_CAPACITY];
+};
+
+struct mapping_t {
+  ring_t *ring;
+  uint32_t refs;
+};
+
+struct node_t {
+  mapping_t *mapping;
+  uint64_t id;
+  uint64_t cursor;
+  uint64_t overrun;
+  /* the unpublished slot the reader waits on since stall_tick, UINT64_MAX if none */
+  uint64_t stall;
+  uint32_t stall_tick;
+};
+
+} /* namespace */
+
+/* guards the maps, not the nodes, each port is read and written by one thread at a time */
+static std::mutex _lock;
+static std::unordered_map<std::string, mapping_t> _mappings{};
+static std::unordered_map<j1939_port_t *, node_t> _nodes{};
+
+static node_t *node_find(j1939_port_t *self) {
+  std::lock_guard<std::mutex> lock(_lock);
+  auto it = _nodes.find(self);
+  /* elements of an unordered_map stay put while others come and go */
+  return it == _nodes.end() ? nullptr : &it->second;
+}
+
+static long futex(std::atomic<uint32_t> *addr, int op, uint32_t value, const struct timespec *timeout) {
+  /* no FUTEX_PRIVATE_FLAG, waiters and wakers live in different processes */
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), op, value, timeout, nullptr, 0);
+}
+
+static ring_t *ring_map(const char *name) {
+  bool created = true;
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd < 0) {
+    created = false;
+    if ((fd = shm_open(name, O_RDWR, 0666)) < 0)
+      return nullptr;
+  }
+
+  struct stat st = {};
+  if (created && ftruncate(fd, sizeof(ring_t)) < 0) {
+    close(fd);
+    return nullptr;
+  }
+  /* the creator may not have sized the object yet */
+  while (!created && fstat(fd, &st) == 0 && (size_t)st.st_size < sizeof(ring_t))
+    usleep(100);
+
+  void *addr = mmap(nullptr, sizeof(ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return nullptr;
+
+  ring_t *ring = static_cast<ring_t *>(addr);
+  if (created) {
+    /* the fresh object is zero filled, which is a valid empty ring */
+    ring->capacity = J1939_SHM_CAPACITY;
+    ring->magic.store(magic, std::memory_order_release);
+  }
+  while (ring->magic.load(std::memory_order_acquire) != magic)
+    usleep(100);
+
+  if (ring->capacity != J1939_SHM_CAPACITY) {
+    munmap(addr, sizeof(ring_t));
+    return nullptr;
+  }
+
+  return ring;
+}
+
+static bool ring_read(node_t &node, j1939_static_message_t *msg) {
+  ring_t *ring = node.mapping->ring;
+  for (;;) {
+    if (node.cursor >= ring->head.load(std::memory_order_acquire))
+      return false;
+
+    slot_t &slot = ring->slots[node.cursor & (ring->capacity - 1)];
+    uint64_t seq = slot.seq.load(std::memory_order_acquire);
+    if (seq < 2 * node.cursor + 2) {
+      /* reserved by a writer but not published yet, once it took too long the writer is gone */
+      if (node.stall != node.cursor) {
+        node.stall = node.cursor;
+        node.stall_tick = j1939_shm_get_tick();
+        return false;
+      }
+      if (j1939_shm_get_tick() - node.stall_tick < J1939_SHM_STALL)
+        return false;
+      node.overrun += 1;
+      node.cursor += 1;
+      continue;
+    }
+
+    uint64_t sender = slot.sender;
+    *msg = slot.msg;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq != 2 * node.cursor + 2 || slot.seq.load(std::memory_order_relaxed) != seq) {
+      /* lapped by the writers, continue with the oldest frame still in the ring */
+      uint64_t oldest = ring->head.load(std::memory_order_acquire) - ring->capacity + 1;
+      node.overrun += oldest - node.cursor;
+      node.cursor = oldest;
+      continue;
+    }
+
+    ++node.cursor;
+    if (sender != node.id)
+      return true;
+  }
+}
+
+extern "C" uint32_t j1939_shm_get_tick(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+extern "C" uint64_t j1939_shm_get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+extern "C" j1939_status_t j1939_shm_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
+  node_t *node = node_find(self);
+  if (node == nullptr)
+    return J1939_ERROR;
+
+  ring_t *ring = node->mapping->ring;
+  uint64_t pos = ring->head.fetch_add(1, std::memory_order_acq_rel);
+  slot_t &slot = ring->slots[pos & (ring->capacity - 1)];
+  slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.sender = node->id;
+  slot.msg = *msg;
+  slot.seq.store(2 * pos + 2, std::memory_order_release);
+
+  ring->futex.fetch_add(1);
+  if (ring->waiters.load())
+    futex(&ring->futex, FUTEX_WAKE, INT_MAX, nullptr);
+
+  return J1939_OK;
+}
+
+extern "C" j1939_status_t j1939_shm_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms) {
+  node_t *found = node_find(self);
+  if (found == nullptr)
+    return J1939_ERROR;
+
+  node_t &node = *found;
+  ring_t *ring = node.mapping->ring;
+  uint32_t start = j1939_shm_get_tick();
+  for (;;) {
+    uint32_t value = ring->futex.load();
+    if (ring_read(node, msg))
+      return J1939_OK;
+
+    uint32_t elapsed = j1939_shm_get_tick() - start;
+    if (elapsed >= timeout_ms)
+      return J1939_TIMEOUT;
+
+    /* a stalled slot is looked at again once it may be skipped, no publish wakes the reader for it */
+    uint32_t wait = timeout_ms - elapsed;
+    bool stalled = node.stall == node.cursor && node.cursor < ring->head.load(std::memory_order_acquire);
+    if (stalled && wait > J1939_SHM_STALL)
+      wait = J1939_SHM_STALL;
+    struct timespec ts = { (time_t)(wait / 1000), (long)(wait % 1000) * 1000000 };
+    ring->waiters.fetch_add(1);
+    futex(&ring->futex, FUTEX_WAIT, value, timeout_ms == UINT32_MAX && !stalled ? nullptr : &ts);
+    ring->waiters.fetch_sub(1);
+  }
+}
+
+extern "C" j1939_status_t j1939_shm_attach(j1939_port_t *self, const char *name) {
+  std::lock_guard<std::mutex> lock(_lock);
+  if (_nodes.count(self))
+    return J1939_ERROR;
+
+  mapping_t &mapping = _mappings[name];
+  if (mapping.ring == nullptr && (mapping.ring = ring_map(name)) == nullptr) {
+    _mappings.erase(name);
+    return J1939_ERROR;
+  }
+  ++mapping.refs;
+
+  /* new ports only see frames written after they attached */
+  _nodes[self] = { &mapping, mapping.ring->nodes.fetch_add(1) + 1, mapping.ring->head.load(std::memory_order_acquire), 0, UINT64_MAX, 0 };
+
+  return J1939_OK;
+}
+
+extern "C" j1939_status_t j1939_shm_detach(j1939_port_t *self) {
+  std::lock_guard<std::mutex> lock(_lock);
+  auto it = _nodes.find(self);
+  if (it == _nodes.end())
+    return J1939_ERROR;
+
+  mapping_t *mapping = it->second.mapping;
+  _nodes.erase(it);
+  if (--mapping->refs == 0) {
+    munmap(mapping->ring, sizeof(ring_t));
+    for (auto m = _mappings.begin(); m != _mappings.end(); ++m) {
+      if (&m->second == mapping) {
+        _mappings.erase(m);
+        break;
+      }
+    }
+  }
+
+  return J1939_OK;
+}
+
+extern "C" j1939_status_t j1939_shm_unlink(const char *name) {
+  return shm_unlink(name) == 0 ? J1939_OK : J1939_ERROR;
+}
+
+extern "C" uint64_t j1939_shm_overrun(j1939_port_t *self) {
+  node_t *node = node_find(self);
+  return node ? node->overrun : 0;
+}
+
+extern "C" void j1939_shm_add_node(j1939_port_t *self) {
+  j1939_shm_attach(self, J1939_SHM_NAME);
+}
+
+#endif /* __linux__ */
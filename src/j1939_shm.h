@@ -0,0 +1,31 @@
+#pragma once
+#ifdef __cplusplus
+extern "C"{
+#endif /* __cplusplus */
+
+#include "j1939_types.h"
+
+/* Inter-process virtual bus, a broadcast ring in POSIX shared memory.
+ * Every attached port sees every frame written by the other ports, in any process. */
+
+uint32_t j1939_shm_get_tick(void);
+uint64_t j1939_shm_get_time(void);
+
+j1939_status_t j1939_shm_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms);
+j1939_status_t j1939_shm_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms);
+
+/* attaches to the ring called name (e.g. "/j1939"), creating it if needed */
+j1939_status_t j1939_shm_attach(j1939_port_t *self, const char *name);
+j1939_status_t j1939_shm_detach(j1939_port_t *self);
+/* removes the ring name, mapped rings stay valid until every port detached */
+j1939_status_t j1939_shm_unlink(const char *name);
+
+/* frames the port lost because it did not keep up with the ring, or whose writer died before publishing */
+uint64_t j1939_shm_overrun(j1939_port_t *self);
+
+/* attaches to the J1939_SHM_NAME ring, a port attached to another ring before j1939_create stays there */
+void j1939_shm_add_node(j1939_port_t *self);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
@@ -0,0 +1,300 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939_signal.h"
+#include "j1939.h"
+#include "j1939_tp.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* messages decoded per pass of j1939_signal_decode_columns, bounds the stack used for gathered words */
+#define J1939_SIGNAL_BLOCK                  64
+#define J1939_SIGNAL_LINE                   512
+
+typedef struct j1939_signal_op {
+  /* first byte loaded into the 64 bit word */
+  uint16_t base;
+  /* message size needed to hold the signal */
+  uint16_t end;
+  uint8_t shift;
+  uint8_t length;
+  uint8_t is_signed;
+  uint32_t mask;
+  /* unsigned raw values at or above are error / not available */
+  uint32_t invalid;
+  float scale;
+  float offset;
+} j1939_signal_op_t;
+
+typedef struct j1939_signal_pgn {
+  uint32_t pgn;
+  uint16_t first;
+  uint16_t count;
+} j1939_signal_pgn_t;
+
+struct j1939_signal_db {
+  uint16_t pgn_count;
+  uint16_t spn_count;
+  j1939_signal_pgn_t *pgns;
+  j1939_spn_t *spns;
+  j1939_signal_op_t *ops;
+};
+
+static int j1939_signal_compare(const void *l, const void *r) {
+  const j1939_spn_t *a = (const j1939_spn_t *)l, *b = (const j1939_spn_t *)r;
+  if (a->pgn != b->pgn)
+    return a->pgn < b->pgn ? -1 : 1;
+  return (int)a->start_bit - (int)b->start_bit;
+}
+
+static void j1939_signal_compile(j1939_signal_op_t *op, const j1939_spn_t *spn) {
+  /* signals of a single frame all come out of one word loaded at byte 0 */
+  op->base = spn->start_bit + spn->length <= 64 ? 0 : spn->start_bit / 8;
+  op->shift = spn->start_bit - op->base * 8;
+  op->end = (spn->start_bit + spn->length + 7) / 8;
+  op->length = spn->length;
+  op->is_signed = spn->is_signed;
+  op->mask = spn->length == 32 ? UINT32_MAX : (1U << spn->length) - 1;
+  /* Reference SAE J1939-71 5.1.4, 0xFB00 and up of a 2 byte parameter is reserved, 10b/11b of a discrete one */
+  if (spn->length == 1)
+    op->invalid = 2;
+  else if (spn->length % 8 == 0)
+    op->invalid = 0xFBU << (spn->length - 8);
+  else
+    op->invalid = op->mask - 1;
+  op->scale = spn->scale;
+  op->offset = spn->offset;
+}
+
+static inline uint64_t j1939_signal_load(const uint8_t *data, uint16_t avail) {
+  uint64_t word = 0;
+  memcpy(&word, data, avail < sizeof(word) ? avail : sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+/* branch free loops over contiguous words, left to the compiler to vectorise */
+static void j1939_signal_convert(const j1939_signal_op_t *op, const uint64_t *words, size_t count, float *values, uint32_t *raw) {
+  const uint8_t shift = op->shift;
+  const uint32_t mask = op->mask;
+  const float scale = op->scale, offset = op->offset;
+
+  if (op->is_signed) {
+    const uint8_t pad = 32 - op->length;
+    for (size_t idx = 0; idx < count; ++idx) {
+      uint32_t r = (uint32_t)(words[idx] >> shift) & mask;
+      values[idx] = (float)((int32_t)(r << pad) >> pad) * scale + offset;
+    }
+  }
+  else {
+    const uint32_t invalid = op->invalid;
+    const uint8_t wide = op->length == 32;
+    for (size_t idx = 0; idx < count; ++idx) {
+      uint32_t r = (uint32_t)(words[idx] >> shift) & mask, bits;
+      /* narrower raw values convert through int32_t, which has a packed conversion */
+      float value = (wide ? (float)r : (float)(int32_t)r) * scale + offset;
+      /* a quiet NAN is or-ed in rather than selected, floating point selects are not if-converted */
+      memcpy(&bits, &value, sizeof(bits));
+      bits |= r >= invalid ? 0x7FC00000U : 0;
+      memcpy(&values[idx], &bits, sizeof(bits));
+    }
+  }
+
+  if (raw) {
+    for (size_t idx = 0; idx < count; ++idx)
+      raw[idx] = (uint32_t)(words[idx] >> shift) & mask;
+  }
+}
+
+static void j1939_signal_missing(const j1939_signal_op_t *op, size_t count, float *values, uint32_t *raw) {
+  for (size_t idx = 0; idx < count; ++idx) {
+    values[idx] = NAN;
+    if (raw)
+      raw[idx] = op->mask;
+  }
+}
+
+static const j1939_signal_pgn_t *j1939_signal_pgn_find(const j1939_signal_db_t *self, uint32_t pgn) {
+  uint16_t low = 0, high = self->pgn_count;
+  while (low < high) {
+    uint16_t mid = (low + high) / 2;
+    if (self->pgns[mid].pgn < pgn)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low < self->pgn_count && self->pgns[low].pgn == pgn ? &self->pgns[low] : NULL;
+}
+
+j1939_signal_db_t *j1939_signal_db_create(const j1939_spn_t *spns, uint16_t count) {
+  size_t names = 0;
+  for (uint16_t idx = 0; idx < count; ++idx) {
+    if (spns[idx].length == 0 || spns[idx].length > 32 || spns[idx].start_bit + spns[idx].length > J1939_TP_MAX_MSG_SIZE * 8)
+      return NULL;
+    if (spns[idx].name)
+      names += strlen(spns[idx].name) + 1;
+  }
+
+  /* one block: db, pgns, spns, ops, names */
+  size_t size = sizeof(j1939_signal_db_t) + count * (sizeof(j1939_signal_pgn_t) + sizeof(j1939_spn_t) + sizeof(j1939_signal_op_t)) + names;
+  j1939_signal_db_t *self = (j1939_signal_db_t *)malloc(size);
+  if (self == NULL)
+    return NULL;
+  self->spns = (j1939_spn_t *)(self + 1);
+  self->ops = (j1939_signal_op_t *)(self->spns + count);
+  self->pgns = (j1939_signal_pgn_t *)(self->ops + count);
+  char *pool = (char *)(self->pgns + count);
+  self->spn_count = count;
+  self->pgn_count = 0;
+
+  memcpy(self->spns, spns, count * sizeof(j1939_spn_t));
+  qsort(self->spns, count, sizeof(j1939_spn_t), j1939_signal_compare);
+  for (uint16_t idx = 0; idx < count; ++idx) {
+    j1939_spn_t *spn = &self->spns[idx];
+    if (spn->name) {
+      size_t length = strlen(spn->name) + 1;
+      spn->name = memcpy(pool, spn->name, length);
+      pool += length;
+    }
+    j1939_signal_compile(&self->ops[idx], spn);
+    if (self->pgn_count == 0 || self->pgns[self->pgn_count - 1].pgn != spn->pgn)
+      self->pgns[self->pgn_count++] = (j1939_signal_pgn_t){ .pgn = spn->pgn, .first = idx, .count = 0, };
+    ++self->pgns[self->pgn_count - 1].count;
+  }
+
+  return self;
+}
+
+j1939_signal_db_t *j1939_signal_db_load(FILE *dbc) {
+  char line[J1939_SIGNAL_LINE], name[64], *colon, order, sign;
+  unsigned long id, spn;
+  uint32_t pgn = 0;
+  j1939_spn_t *spns = NULL, s;
+  uint16_t count = 0, capacity = 0;
+  j1939_signal_db_t *self = NULL;
+
+  while (fgets(line, sizeof(line), dbc)) {
+    if (sscanf(line, " BO_ %lu", &id) == 1) {
+      pgn = j1939_get_pgn(id & 0x1FFFFFFF);
+      continue;
+    }
+    memset(&s, 0, sizeof(s));
+    /* " SG_ name [multiplexer] : start|length@order sign (scale,offset) ..." */
+    if (sscanf(line, " SG_ %63s", name) == 1 && (colon = strchr(line, ':')) &&
+        sscanf(colon, ": %hu|%hhu@%c%c (%f,%f)", &s.start_bit, &s.length, &order, &sign, &s.scale, &s.offset) == 6) {
+      /* J1939 parameters are little endian, big endian (@0) signals are skipped */
+      if (order != '1')
+        continue;
+      if (count == capacity) {
+        j1939_spn_t *grown = (j1939_spn_t *)realloc(spns, (capacity = capacity ? capacity * 2 : 32) * sizeof(j1939_spn_t));
+        if (grown == NULL)
+          goto exit;
+        spns = grown;
+      }
+      s.pgn = pgn;
+      s.is_signed = sign == '-';
+      if ((s.name = strdup(name)) == NULL)
+        goto exit;
+      spns[count++] = s;
+      continue;
+    }
+    if (sscanf(line, " BA_ \"SPN\" SG_ %lu %63s %lu", &id, name, &spn) == 3) {
+      for (uint16_t idx = 0; idx < count; ++idx) {
+        if (spns[idx].pgn == j1939_get_pgn(id & 0x1FFFFFFF) && strcmp(spns[idx].name, name) == 0)
+          spns[idx].spn = spn;
+      }
+    }
+  }
+
+  self = j1939_signal_db_create(spns, count);
+
+exit:
+  for (uint16_t idx = 0; idx < count; ++idx)
+    free((void *)spns[idx].name);
+  free(spns);
+  return self;
+}
+
+j1939_status_t j1939_signal_db_delete(j1939_signal_db_t *self) {
+  free(self);
+  return J1939_OK;
+}
+
+uint16_t j1939_signal_list(const j1939_signal_db_t *self, uint32_t pgn, const j1939_spn_t **spns) {
+  const j1939_signal_pgn_t *entry = j1939_signal_pgn_find(self, pgn);
+  if (entry == NULL)
+    return 0;
+  if (spns)
+    *spns = &self->spns[entry->first];
+  return entry->count;
+}
+
+const j1939_spn_t *j1939_signal_find(const j1939_signal_db_t *self, uint32_t spn) {
+  for (uint16_t idx = 0; idx < self->spn_count; ++idx) {
+    if (self->spns[idx].spn == spn)
+      return &self->spns[idx];
+  }
+  return NULL;
+}
+
+uint16_t j1939_signal_decode(const j1939_signal_db_t *self, const j1939_message_t *msg, float *values, uint32_t *raw) {
+  const j1939_signal_pgn_t *entry = j1939_signal_pgn_find(self, j1939_get_pgn(msg->id));
+  if (entry == NULL)
+    return 0;
+
+  const j1939_signal_op_t *op = &self->ops[entry->first];
+  for (uint16_t idx = 0; idx < entry->count; ++idx, ++op) {
+    if (op->end > msg->size) {
+      j1939_signal_missing(op, 1, &values[idx], raw ? &raw[idx] : NULL);
+      continue;
+    }
+    uint64_t word = j1939_signal_load(&msg->data[op->base], msg->size - op->base);
+    j1939_signal_convert(op, &word, 1, &values[idx], raw ? &raw[idx] : NULL);
+  }
+
+  return entry->count;
+}
+
+uint16_t j1939_signal_decode_columns(const j1939_signal_db_t *self, uint32_t pgn, const uint8_t *data, size_t stride, uint16_t size, size_t count, float *const *values, uint32_t *const *raw) {
+  const j1939_signal_pgn_t *entry = j1939_signal_pgn_find(self, pgn);
+  if (entry == NULL)
+    return 0;
+
+  uint64_t words[J1939_SIGNAL_BLOCK];
+  for (size_t block = 0; block < count; block += J1939_SIGNAL_BLOCK) {
+    size_t n = count - block < J1939_SIGNAL_BLOCK ? count - block : J1939_SIGNAL_BLOCK;
+    int32_t base = -1;
+    const j1939_signal_op_t *op = &self->ops[entry->first];
+    for (uint16_t idx = 0; idx < entry->count; ++idx, ++op) {
+      uint32_t *column = raw ? &raw[idx][block] : NULL;
+      if (op->end > size) {
+        j1939_signal_missing(op, n, &values[idx][block], column);
+        continue;
+      }
+      /* gather the block into contiguous words once per distinct base, signals of a frame share base 0 */
+      if (op->base != base) {
+        base = op->base;
+        for (size_t frame = 0; frame < n; ++frame)
+          words[frame] = j1939_signal_load(data + (block + frame) * stride + base, size - base);
+      }
+      j1939_signal_convert(op, words, n, &values[idx][block], column);
+    }
+  }
+
+  return entry->count;
+}
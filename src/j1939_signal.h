@@ -0,0 +1,73 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_SIGNAL_H
+#define J1939_SIGNAL_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include "j1939_types.h"
+#include <stddef.h>
+#include <stdio.h>
+
+/* SPN signal database.
+ * Definitions are compiled per PGN into a flat list of extract/scale operations,
+ * signals of a PGN are always reported in ascending start_bit order. */
+
+typedef struct j1939_spn {
+  uint32_t spn;
+  uint32_t pgn;
+  /* least significant bit, counted from bit 0 of data byte 0 (little endian, SAE J1939-71) */
+  uint16_t start_bit;
+  /* 1 to 32 bits */
+  uint8_t length;
+  uint8_t is_signed;
+  /* physical value = raw * scale + offset */
+  float scale;
+  float offset;
+  /* copied by j1939_signal_db_create, may be NULL */
+  const char *name;
+} j1939_spn_t;
+
+typedef struct j1939_signal_db j1939_signal_db_t;
+
+/* compiles a table of definitions, e.g. a static const array */
+j1939_signal_db_t *j1939_signal_db_create(const j1939_spn_t *spns, uint16_t count);
+/* compiles the little endian signals of a DBC file,
+ * SPN numbers are taken from BA_ "SPN" SG_ attributes when present */
+j1939_signal_db_t *j1939_signal_db_load(FILE *dbc);
+j1939_status_t j1939_signal_db_delete(j1939_signal_db_t *self);
+
+/* number of signals of pgn, *spns points to their definitions in decode order */
+uint16_t j1939_signal_list(const j1939_signal_db_t *self, uint32_t pgn, const j1939_spn_t **spns);
+const j1939_spn_t *j1939_signal_find(const j1939_signal_db_t *self, uint32_t spn);
+
+/* decodes every signal of a single frame or reassembled transport message,
+ * values[n] and raw[n] (raw may be NULL) receive signal n of j1939_signal_list.
+ * Signals outside the message or flagged error / not available (SAE J1939-71 5.1.4) decode as NAN.
+ * returns the number of signals, 0 for an unknown PGN */
+uint16_t j1939_signal_decode(const j1939_signal_db_t *self, const j1939_message_t *msg, float *values, uint32_t *raw);
+
+/* bulk decode of count messages of one PGN whose size bytes of payload start at data + n * stride,
+ * e.g. &frames[0].data with stride sizeof(j1939_static_message_t) or sizeof(j1939_log_record_t).
+ * values[k][n] and raw[k][n] (raw may be NULL) receive signal k of message n.
+ * returns the number of signals, 0 for an unknown PGN */
+uint16_t j1939_signal_decode_columns(const j1939_signal_db_t *self, uint32_t pgn, const uint8_t *data, size_t stride, uint16_t size, size_t count, float *const *values, uint32_t *const *raw);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_SIGNAL_H */
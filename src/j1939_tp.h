@@ -0,0 +1,178 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#ifndef J1939_TP_H
+#define J1939_TP_H
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/* Transport protocol wire format, shared by the protocol stack and the offline tools */
+
+#include "j1939_types.h"
+#include <limits.h>
+
+#define J1939_SIZE_PROTOCOL_PAYLOAD         (J1939_SIZE_DATAFIELD - 1)
+
+#define J1939_ADDRESS_DIVIDE                0xF0/* DO NOT MODIFIED THIS PRAMETER */
+#define J1939_ADDRESS_NULL                  0xFE/* DO NOT MODIFIED THIS PRAMETER */
+#define J1939_ADDRESS_GLOBAL                0xFF/* DO NOT MODIFIED THIS PRAMETER */
+
+/* Reference SAE J1939-21 5.10.1.1 */
+/* min size = 9, max size = 1785 */
+#define J1939_TP_MAX_MSG_SIZE              (UCHAR_MAX * J1939_SIZE_PROTOCOL_PAYLOAD)
+/* Default response packets number of TP CTS, see j1939_set_tp_window */
+#define J1939_TP_CM_CTS_RESPONSE            4
+
+#define J1939_TP_DEFAULT_PRIORITY           0x07
+
+/* Reference SAE J1939-21 5.10.3.5, BAM packets are spaced 10 to 200 ms apart (50 by default), see j1939_set_bam_interval */
+#define J1939_TP_BAM_TX_INTERVAL            50
+#define J1939_TP_BAM_TX_INTERVAL_MIN        10
+#define J1939_TP_BAM_TX_INTERVAL_MAX        200
+/* packets go out back to back, as fast as the port accepts them (private buses and simulation only) */
+#define J1939_TP_BAM_TX_BURST               0
+
+/* Reference https://elearning.vector.com/mod/page/view.php?id=422 */
+/* Reference SAE J1939-81 */
+/* Used for identification of an ECU and for detection of address conflicts */
+#define J1939_PGN_ADDR_CLAIMED              0x00EE00
+/* Reference SAE J1939-21 */
+/* Other pgns can be requested using this pgn, similarly as for the CAN Remote Frame. */
+/* But note: j1939 does not support Remote Frames. The Request pgn is a CAN data frame. */
+#define J1939_PGN_REQUEST                   0x00EA00
+/* Reference SAE J1939-21 */
+/* Transmits the payload data for the transport protocols */
+#define J1939_PGN_TP_DT                     0x00EB00
+/* Reference SAE J1939-21 */
+/* Supplies the metadata (number of bytes, packets, etc.) for transport protocols */
+#define J1939_PGN_TP_CM                     0x00EC00
+/* Reference SAE J1939-21 */
+/* Manufacturer-specific definable specific pgn */
+#define J1939_PGN_PROPRIETARY_A             0x00EF00
+/* Reference SAE J1939-21 */
+/* Manufacturer-specific definable additional specific pgn */
+#define J1939_PGN_PROPRIETARY_A1            0x01EF00
+/* Reference SAE J1939-21 */
+/* Used for acknowledgement of various network services. Can be positive or negative. */
+/* The acknowledgement is referenced accordingly in the application layer. */
+#define J1939_PGN_ACKNOWLEDGEMENT           0x00E800
+
+/* Transport self timeout parameters */
+typedef enum j1939_timeout {
+  /* Reference SAE J1939-21 5.10.2.4 */
+  J1939_TIMEOUT_TR                          = 200,
+  J1939_TIMEOUT_TH                          = 500,
+  J1939_TIMEOUT_T1                          = 750,
+  J1939_TIMEOUT_T2                          = 1250,
+  J1939_TIMEOUT_T3                          = 1250,
+  J1939_TIMEOUT_T4                          = 1050,
+} j1939_timeout_t;
+
+/* Reference SAE J1939-21 5.10.3.4, connection abort reasons */
+typedef enum j1939_abort_reason {
+  J1939_ABORT_BUSY                          = 1,
+  J1939_ABORT_RESOURCES                     = 2,
+  J1939_ABORT_TIMEOUT                       = 3,
+} j1939_abort_reason_t;
+
+typedef enum j1939_control{
+  J1939_CONTROL_RTS                         = 0x10U,
+  J1939_CONTROL_CTS                         = 0x11U,
+  J1939_CONTROL_ACK                         = 0x13U,
+  J1939_CONTROL_BAM                         = 0x20U,
+  J1939_CONTROL_ABORT                       = 0xFFU,
+} j1939_control_t;
+
+/* Transport self - broadcast announce message structure */
+typedef struct j1939_bam {
+  /* Fixed at 32 */
+  uint64_t control                          : 8;
+  /* Message size in bytes */
+  uint64_t message_size                     : 16;
+  /* Number of packets */
+  uint64_t total_packets                    : 8;
+  /* Fixed at 0xFF */
+  uint64_t reserved                         : 8;
+  /* pgn */
+  uint64_t pgn                              : 24;
+} j1939_bam_t;
+
+/* Transport self - request to send struct */
+typedef struct j1939_rts {
+  /* Fixed at 16 */
+  uint64_t control                          : 8;
+  /* Message size in bytes */
+  uint64_t message_size                     : 16;
+  /* Number of packets */
+  uint64_t total_packets                    : 8;
+  /* Max number of packets per CTS, 0xFF for no limit */
+  uint64_t max_packets                      : 8;
+  /* pgn */
+  uint64_t pgn                              : 24;
+} j1939_rts_t;
+
+/* Transport self - clear to send struct */
+typedef struct j1939_cts {
+  /* Fixed at 17 */
+  uint64_t control                          : 8;
+  /* Max number of packets that can be sent at once. (Not larger than byte 5 of RTS) */
+  uint64_t response_packets                  : 8;
+  /* Next sequence number to start with */
+  uint64_t next_sequence                     : 8;
+  /* Fixed at 0xFFFF */
+  uint64_t reserved                         : 16;
+  /* pgn */
+  uint64_t pgn                              : 24;
+} j1939_cts_t;
+
+/* Transport self - EndofmsgACK_t struct */
+typedef struct j1939_ack {
+  /* Fixed at 19 */
+  uint64_t control                          : 8;
+  /* Total message size in bytes */
+  uint64_t message_size                     : 16;
+  /* Total number of packets */
+  uint64_t total_packets                    : 8;
+  /* Fixed at 0xFF */
+  uint64_t reserved                         : 8;
+  /* pgn */
+  uint64_t pgn                              : 24;
+} j1939_ack_t;
+
+/* Transport self - Connection abort struct */
+typedef struct j1939_abort {
+  /* Fixed at 255 */
+  uint64_t control                          : 8;
+  /* Connection abort reason */
+  uint64_t reason                           : 8;
+  /* Fixed at 0xFFFFFF */
+  uint64_t reserved                         : 24;
+  /* pgn */
+  uint64_t pgn                              : 24;
+} j1939_abort_t;
+
+static inline uint8_t get_total_packets(uint16_t size) {
+  return (size - 1) / J1939_SIZE_PROTOCOL_PAYLOAD + 1;
+}
+
+static inline uint8_t get_last_section(uint16_t size) {
+  return (size % J1939_SIZE_PROTOCOL_PAYLOAD) ? (size % J1939_SIZE_PROTOCOL_PAYLOAD) : (J1939_SIZE_PROTOCOL_PAYLOAD);
+}
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* J1939_TP_H */
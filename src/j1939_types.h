@@ -46,6 +46,20 @@ typedef struct j1939_pdu {
   uint32_t eff            : 1; /* frame format flag */
 } j1939_pdu_t;
 
+#if J1939_TIMESTAMP && defined __cplusplus
+/* lets C++ designated initializers leave the timestamps out */
+#define J1939_TIMESTAMP_FIELD(name)         uint64_t name = 0
+#elif J1939_TIMESTAMP
+#define J1939_TIMESTAMP_FIELD(name)         uint64_t name
+#endif /* J1939_TIMESTAMP */
+
+/* the transport structs read the data field as uint64_t bit-fields, it stays aligned without the timestamps */
+#if defined __cplusplus
+#define J1939_DATA_ALIGN                    alignas(8)
+#else
+#define J1939_DATA_ALIGN                    _Alignas(8)
+#endif /* __cplusplus */
+
 /* j1939 message struct */
 typedef struct j1939_message {
   union {
@@ -53,7 +67,13 @@ typedef struct j1939_message {
     uint32_t id;
   };
   uint16_t size;
-  uint8_t data[];
+#if J1939_TIMESTAMP
+  /* port time (ns) the frame passed the controller, for transport messages that of the last packet */
+  J1939_TIMESTAMP_FIELD(timestamp);
+  /* for transport messages the time of the RTS/BAM, otherwise the same as timestamp */
+  J1939_TIMESTAMP_FIELD(timestamp_first);
+#endif /* J1939_TIMESTAMP */
+  J1939_DATA_ALIGN uint8_t data[];
 } j1939_message_t;
 
 typedef struct j1939_static_message {
@@ -62,9 +82,19 @@ typedef struct j1939_static_message {
     uint32_t id;
   };
   uint16_t size;
-  uint8_t data[J1939_SIZE_DATAFIELD];
+#if J1939_TIMESTAMP
+  J1939_TIMESTAMP_FIELD(timestamp);
+  J1939_TIMESTAMP_FIELD(timestamp_first);
+#endif /* J1939_TIMESTAMP */
+  J1939_DATA_ALIGN uint8_t data[J1939_SIZE_DATAFIELD];
 } j1939_static_message_t;
 
+/* acceptance filter, a frame passes if (frame id & mask) == (id & mask) */
+typedef struct j1939_filter {
+  uint32_t id;
+  uint32_t mask;
+} j1939_filter_t;
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -1,5 +1,10 @@
 #include "j1939_virtual.h"
-#include <queue>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <unordered_map>
 #include <stdio.h>
 
@@ -15,45 +20,123 @@ struct pred_t {
     }
 };
 
-using node_t = std::queue<j1939_static_message_t>;
-using bus_t = std::unordered_map<j1939_port_t *, node_t, hash_t, pred_t>;
+/* every frame is stored once in the bus log, nodes read it through their own cursor */
+struct frame_t {
+  j1939_port_t *sender;
+  j1939_static_message_t msg;
+};
 
-static bus_t _bus{};
+struct node_t {
+  /* absolute index of the next frame to read */
+  uint64_t cursor;
+  std::vector<j1939_filter_t> filter;
+};
 
-extern "C" uint32_t j1939_virtual_get_tick(void) {
-  static uint32_t count = 0;
-  return count++;
+struct bus_t {
+  std::deque<frame_t> log;
+  /* absolute index of log.front() */
+  uint64_t base;
+  /* log size that triggers the next trim */
+  size_t trim;
+  std::unordered_map<j1939_port_t *, node_t, hash_t, pred_t> nodes;
+};
+
+static bus_t _bus{{}, 0, 1024, {}};
+/* handles on different threads share the bus, e.g. under j1939_runtime */
+static std::mutex _lock;
+static std::atomic<bool> _trace{true};
+static std::atomic<bool> _realtime{false};
+
+static void trim(void) {
+  /* drop frames every node has read, O(nodes) but amortised over at least as many frames */
+  uint64_t cursor = _bus.base + _bus.log.size();
+  for (auto &[port, node] : _bus.nodes)
+    cursor = std::min(cursor, node.cursor);
+  _bus.log.erase(_bus.log.begin(), _bus.log.begin() + (cursor - _bus.base));
+  _bus.base = cursor;
+  _bus.trim = std::max<size_t>({1024, 2 * _bus.log.size(), 2 * _bus.nodes.size()});
 }
 
-extern "C" j1939_status_t j1939_virtual_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
-  for (auto &[port, node] : _bus) {
-    if (port == self)
-      continue;
-    node.push(*msg);
+static bool accept(const node_t &node, const j1939_static_message_t &msg) {
+  if (node.filter.empty())
+    return true;
+  for (auto &f : node.filter) {
+    if (((msg.id ^ f.id) & f.mask) == 0)
+      return true;
   }
-  printf("port [%02lX] tx id [%08X] size [%d] data [", (size_t)self, msg->id, msg->size);
+  return false;
+}
+
+static void trace(j1939_port_t *self, const char *dir, const j1939_static_message_t *msg) {
+  if (!_trace)
+    return;
+  printf("port [%02lX] %s id [%08X] size [%d] data [", (size_t)self, dir, msg->id, msg->size);
   for (uint16_t idx = 0; idx < msg->size; ++idx) {
     printf("%02X%s", msg->data[idx], idx == msg->size - 1 ? "]\n" : " ");
   }
+}
+
+extern "C" uint32_t j1939_virtual_get_tick(void) {
+  static std::atomic<uint32_t> count{0};
+  if (_realtime)
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  return count++;
+}
+
+extern "C" uint64_t j1939_virtual_get_time(void) {
+  /* real time, unlike the tick which only counts calls */
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+extern "C" j1939_status_t j1939_virtual_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms) {
+  std::lock_guard<std::mutex> lock(_lock);
+  _bus.log.push_back({self, *msg});
+  if (_bus.log.size() >= _bus.trim)
+    trim();
+  trace(self, "tx", msg);
   return J1939_OK;
 }
 
 extern "C" j1939_status_t j1939_virtual_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms) {
-  for (auto &[port, node] : _bus) {
-    if (port != self)
+  std::lock_guard<std::mutex> lock(_lock);
+  auto it = _bus.nodes.find(self);
+  if (it == _bus.nodes.end())
+    return J1939_ERROR;
+  node_t &node = it->second;
+  while (node.cursor < _bus.base + _bus.log.size()) {
+    const frame_t &frame = _bus.log[node.cursor++ - _bus.base];
+    if (frame.sender == self || !accept(node, frame.msg))
       continue;
-    if (node.size() == 0)
-      return J1939_TIMEOUT;
-    *msg = node.front();
-    node.pop();
-  }
-  printf("port [%02lX] rx id [%08X] size [%d] data [", (size_t)self, msg->id, msg->size);
-  for (uint16_t idx = 0; idx < msg->size; ++idx) {
-    printf("%02X%s", msg->data[idx], idx == msg->size - 1 ? "]\n" : " ");
+    *msg = frame.msg;
+    trace(self, "rx", msg);
+    return J1939_OK;
   }
+  return J1939_TIMEOUT;
+}
+
+extern "C" j1939_status_t j1939_virtual_set_filter(j1939_port_t *self, const j1939_filter_t *filter, uint8_t count) {
+  std::lock_guard<std::mutex> lock(_lock);
+  auto it = _bus.nodes.find(self);
+  if (it == _bus.nodes.end())
+    return J1939_ERROR;
+  it->second.filter.assign(filter, filter + count);
   return J1939_OK;
 }
 
+extern "C" void j1939_virtual_set_trace(int enable) {
+  _trace = enable;
+}
+
+extern "C" void j1939_virtual_set_realtime(int enable) {
+  _realtime = enable;
+}
+
 extern "C" void j1939_virtual_add_node(j1939_port_t *self) {
-  _bus[self] = {};
+  std::lock_guard<std::mutex> lock(_lock);
+  _bus.nodes[self] = {_bus.base + _bus.log.size(), {}};
+}
+
+extern "C" void j1939_virtual_remove_node(j1939_port_t *self) {
+  std::lock_guard<std::mutex> lock(_lock);
+  _bus.nodes.erase(self);
 }
@@ -6,11 +6,20 @@ extern "C"{
 #include "j1939_types.h"
 
 uint32_t j1939_virtual_get_tick(void);
+uint64_t j1939_virtual_get_time(void);
 
 j1939_status_t j1939_virtual_transmit(j1939_port_t *self, const j1939_static_message_t *msg, uint32_t timeout_ms);
 j1939_status_t j1939_virtual_receive(j1939_port_t *self, j1939_static_message_t *msg, uint32_t timeout_ms);
 
+/* frames not matching any of the count filters are skipped before they are copied, count 0 accepts all */
+j1939_status_t j1939_virtual_set_filter(j1939_port_t *self, const j1939_filter_t *filter, uint8_t count);
+void j1939_virtual_set_trace(int enable);
+/* the tick counts calls by default, with realtime set it counts ms, for handles running on threads,
+ * switch while no transport session is open */
+void j1939_virtual_set_realtime(int enable);
+
 void j1939_virtual_add_node(j1939_port_t *self);
+void j1939_virtual_remove_node(j1939_port_t *self);
 
 #ifdef __cplusplus
 }
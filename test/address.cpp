@@ -0,0 +1,152 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_tp.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <map>
+#include <vector>
+
+/* frames collected per destination address */
+typedef std::map<uint8_t, std::vector<std::vector<uint8_t>>> inbox_t;
+
+static auto collect_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  (*(inbox_t *)arg)[msg->pdu.pdu_format < 0xF0 ? msg->pdu.pdu_specific : 0xFF].emplace_back(msg->data, msg->data + msg->size);
+};
+
+static void run(j1939_t *handle[], size_t count) {
+  for (int round = 0; round < 1000; ++round) {
+    bool busy = false;
+    for (size_t idx = 0; idx < count; ++idx) {
+      while (j1939_receive(handle[idx], 0) != J1939_TIMEOUT);
+      j1939_tp_cm_transmit_manager(handle[idx], 0);
+      busy |= j1939_status(handle[idx]) == J1939_BUSY;
+    }
+    if (!busy)
+      break;
+  }
+}
+
+TEST(j1939, address) {
+  inbox_t gateway, ecu[16], tester;
+  j1939_config_t config[] = {
+    { .self_address = 0x80, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x80, .arg = &gateway, },
+    { .self_address = 0x10, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x81, .arg = &tester, },
+  };
+  j1939_t *handle[] = {j1939_create(&config[0]), j1939_create(&config[1])};
+  j1939_virtual_set_trace(0);
+
+  /* the gateway impersonates 16 ECUs, 0x80 from the config and 15 more with callbacks of their own */
+  for (uint8_t idx = 1; idx < 16; ++idx) {
+    ASSERT_EQ(j1939_add_address(handle[0], 0x80 + idx, collect_cb, &ecu[idx]), J1939_OK);
+  }
+  EXPECT_EQ(j1939_add_address(handle[0], 0x90, collect_cb, &ecu[0]), J1939_ERROR);
+  EXPECT_EQ(j1939_add_address(handle[0], 0x85, collect_cb, &ecu[0]), J1939_ERROR);
+  EXPECT_EQ(j1939_add_address(handle[0], J1939_ADDRESS_GLOBAL, collect_cb, &ecu[0]), J1939_ERROR);
+  ASSERT_EQ(j1939_add_address(handle[1], 0x11, nullptr, nullptr), J1939_OK);
+
+  /* single frames reach the addressed ECU only, broadcasts the handle callback once */
+  const uint32_t ids[] = {0x18EA8510U, 0x18EA8010U, 0x18EA9010U, 0x18FEF110U, 0x18EAFF10U};
+  for (uint32_t id : ids) {
+    j1939_static_message_t m = { .id = id, .size = 3, .data = {(uint8_t)(id >> 8)}, };
+    j1939_transmit_static(handle[1], &m, 0);
+  }
+  run(handle, 2);
+  EXPECT_EQ(ecu[5][0x85].size(), 1U);
+  EXPECT_EQ(gateway[0x80].size(), 1U);
+  EXPECT_EQ(gateway[0xFF].size(), 2U);
+  EXPECT_EQ(gateway.count(0x90), 0U);
+
+  /* concurrent transport sessions, one per local address on both sides */
+  std::vector<uint8_t> data[4];
+  for (uint8_t idx = 0; idx < 4; ++idx)
+    data[idx].assign(20 + 30 * idx, 0xA0 + idx);
+  ASSERT_EQ(j1939_transmit(handle[1], j1939_message_create(0x18EF8310U, data[0].data(), data[0].size()), 0), J1939_OK);
+  ASSERT_EQ(j1939_transmit(handle[1], j1939_message_create(0x18EF8A11U, data[1].data(), data[1].size()), 0), J1939_OK);
+  j1939_message_t *busy = j1939_message_create(0x18EF8B11U, data[1].data(), data[1].size());
+  EXPECT_EQ(j1939_transmit(handle[1], busy, 0), J1939_BUSY);
+  j1939_message_delete(busy);
+  ASSERT_EQ(j1939_transmit(handle[0], j1939_message_create(0x18EF1084U, data[2].data(), data[2].size()), 0), J1939_OK);
+  ASSERT_EQ(j1939_transmit_bam(handle[0], j1939_message_create(0x18FEE085U, data[3].data(), data[3].size()), J1939_TP_BAM_TX_BURST, 0), J1939_OK);
+  run(handle, 2);
+  EXPECT_EQ(j1939_status(handle[0]), J1939_OK);
+  EXPECT_EQ(j1939_status(handle[1]), J1939_OK);
+  ASSERT_EQ(ecu[3][0x83].size(), 1U);
+  EXPECT_EQ(ecu[3][0x83][0], data[0]);
+  ASSERT_EQ(ecu[10][0x8A].size(), 1U);
+  EXPECT_EQ(ecu[10][0x8A][0], data[1]);
+  ASSERT_EQ(tester[0x10].size(), 1U);
+  EXPECT_EQ(tester[0x10][0], data[2]);
+  ASSERT_EQ(tester[0xFF].size(), 1U);
+  EXPECT_EQ(tester[0xFF][0], data[3]);
+
+  /* a removed address is filtered again, the config address stays */
+  EXPECT_EQ(j1939_remove_address(handle[0], 0x80), J1939_ERROR);
+  ASSERT_EQ(j1939_remove_address(handle[0], 0x85), J1939_OK);
+  EXPECT_EQ(j1939_remove_address(handle[0], 0x85), J1939_ERROR);
+  j1939_static_message_t m = { .id = 0x18EA8510U, .size = 3, .data = {0}, };
+  j1939_transmit_static(handle[1], &m, 0);
+  m.id = 0x18EA8F10U;
+  j1939_transmit_static(handle[1], &m, 0);
+  run(handle, 2);
+  EXPECT_EQ(ecu[5][0x85].size(), 1U);
+  EXPECT_EQ(ecu[15][0x8F].size(), 1U);
+
+  j1939_virtual_set_trace(1);
+  j1939_delete(handle[0]);
+  j1939_delete(handle[1]);
+}
+
+TEST(j1939, address_none) {
+  inbox_t listener, ecu;
+  j1939_config_t config[] = {
+    { .self_address = J1939_ADDRESS_NULL, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x82, .arg = &listener, },
+    { .self_address = 0x20, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x83, .arg = &ecu, },
+    { .self_address = 0x21, .recv_cb = nullptr, .timeout_cb = nullptr, .port = (j1939_port_t *)0x84, .arg = nullptr, },
+  };
+  j1939_t *handle[] = {j1939_create(&config[0]), j1939_create(&config[1]), j1939_create(&config[2])};
+  ASSERT_NE(handle[0], nullptr);
+  j1939_virtual_set_trace(0);
+
+  /* a handle without an address hears broadcasts, sends single frames and refuses transport messages */
+  std::vector<uint8_t> data(40, 0x3C);
+  j1939_message_t *msg = j1939_message_create(0x18FEE0FEU, data.data(), data.size());
+  EXPECT_EQ(j1939_tx_status(handle[0], J1939_ADDRESS_NULL), J1939_ERROR);
+  EXPECT_EQ(j1939_transmit(handle[0], msg, 0), J1939_ERROR);
+  j1939_message_delete(msg);
+  j1939_static_message_t m = { .id = 0x18EA20FEU, .size = 3, .data = {0xE0, 0xFE, 0x00}, };
+  EXPECT_EQ(j1939_transmit_static(handle[0], &m, 0), J1939_OK);
+  ASSERT_EQ(j1939_transmit(handle[2], j1939_message_create(0x18FEE021U, data.data(), data.size()), 0), J1939_OK);
+  msg = j1939_message_create(0x18EF2021U, data.data(), data.size());
+  EXPECT_EQ(j1939_tx_status(handle[2], 0x21), J1939_BUSY);
+  EXPECT_EQ(j1939_transmit(handle[2], msg, 0), J1939_BUSY);
+  j1939_message_delete(msg);
+
+  /* another ECU's broadcast keeps the handle busy, but not the session of its own address */
+  while (j1939_receive(handle[1], 0) != J1939_TIMEOUT);
+  EXPECT_EQ(ecu[0x20].size(), 1U);
+  EXPECT_EQ(j1939_status(handle[1]), J1939_BUSY);
+  EXPECT_EQ(j1939_tx_status(handle[1], 0x20), J1939_OK);
+  run(handle, 3);
+  ASSERT_EQ(listener[0xFF].size(), 1U);
+  EXPECT_EQ(listener[0xFF][0], data);
+  ASSERT_EQ(ecu[0xFF].size(), 1U);
+  EXPECT_EQ(j1939_tx_status(handle[2], 0x21), J1939_OK);
+
+  j1939_virtual_set_trace(1);
+  for (j1939_t *each : handle)
+    j1939_delete(each);
+}
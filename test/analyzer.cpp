@@ -0,0 +1,123 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "src/j1939_analyzer.h"
+#include "gtest/gtest.h"
+#include <string>
+#include <vector>
+
+struct analyzed_t {
+  j1939_analyzer_message_t msg;
+  std::vector<uint8_t> data;
+};
+
+static auto collect_cb = +[](const j1939_analyzer_message_t *msg, void *arg) {
+  ((std::vector<analyzed_t> *)arg)->push_back({*msg, std::vector<uint8_t>(msg->data, msg->data + msg->size)});
+};
+
+static void write_frame(j1939_recorder_t *recorder, uint64_t timestamp_us, uint32_t id, std::vector<uint8_t> data) {
+  j1939_log_record_t record = {};
+  record.timestamp_us = timestamp_us;
+  record.id = id;
+  record.size = 8;
+  memset(record.data, 0xFF, sizeof(record.data));
+  memcpy(record.data, data.data(), data.size());
+  j1939_recorder_write(recorder, &record);
+}
+
+TEST(j1939, analyzer) {
+  std::string path = testing::TempDir() + "j1939_analyzer.bin";
+  j1939_recorder_t *recorder = j1939_recorder_create(path.c_str(), 0);
+  ASSERT_NE(recorder, nullptr);
+
+  /* 64 interleaved BAMs of 20 bytes from different sources, PGN 0xFE00 + sa */
+  uint64_t t = 1000;
+  for (uint8_t sa = 0; sa < 64; ++sa)
+    write_frame(recorder, t += 10, 0x18ECFF00U | sa, {0x20, 20, 0, 3, 0xFF, sa, 0xFE, 0x00});
+  for (uint8_t seq = 1; seq <= 3; ++seq)
+    for (uint8_t sa = 0; sa < 64; ++sa)
+      write_frame(recorder, t += 10, 0x18EBFF00U | sa, {seq, sa, seq, 0, 0, 0, 0, 0});
+
+  /* CMDT 0x80 -> 0x90 aborted by the receiver after one packet */
+  write_frame(recorder, t += 10, 0x18EC9080U, {0x10, 16, 0, 3, 3, 0x00, 0xEF, 0x00});
+  write_frame(recorder, t += 10, 0x18EC8090U, {0x11, 1, 1, 0xFF, 0xFF, 0x00, 0xEF, 0x00});
+  write_frame(recorder, t += 10, 0x18EB9080U, {1, 1, 2, 3, 4, 5, 6, 7});
+  write_frame(recorder, t += 10, 0x18EC8090U, {0xFF, 3, 0xFF, 0xFF, 0xFF, 0x00, 0xEF, 0x00});
+
+  /* BAM from 0xA0 that loses its last packet, then traffic long after its T1 */
+  write_frame(recorder, t += 10, 0x18ECFFA0U, {0x20, 10, 0, 2, 0xFF, 0xCA, 0xFE, 0x00});
+  write_frame(recorder, t += 10, 0x18EBFFA0U, {1, 1, 2, 3, 4, 5, 6, 7});
+  uint64_t lost = t;
+  write_frame(recorder, t += 2000000, 0x18FEF100U, {0});
+
+  /* 8 bytes fit a single frame, the stack opens no session for them and neither does the analyzer */
+  write_frame(recorder, t += 10, 0x18ECFFB1U, {0x20, 8, 0, 2, 0xFF, 0xCA, 0xFE, 0x00});
+  write_frame(recorder, t += 10, 0x18EBFFB1U, {1, 1, 2, 3, 4, 5, 6, 7});
+  write_frame(recorder, t += 10, 0x18EBFFB1U, {2, 8, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF});
+
+  /* invalid announce, total packets disagrees with the size */
+  write_frame(recorder, t += 10, 0x18ECFFB0U, {0x20, 100, 0, 2, 0xFF, 0xCA, 0xFE, 0x00});
+  ASSERT_EQ(j1939_recorder_delete(recorder), J1939_OK);
+
+  j1939_log_t *log = j1939_log_open(path.c_str());
+  ASSERT_NE(log, nullptr);
+
+  std::vector<analyzed_t> single, multi;
+  ASSERT_EQ(j1939_analyze(log, 1, collect_cb, &single), J1939_OK);
+  ASSERT_EQ(j1939_analyze(log, 4, collect_cb, &multi), J1939_OK);
+  ASSERT_EQ(single.size(), 66U);
+  ASSERT_EQ(multi.size(), single.size());
+
+  size_t complete = 0;
+  for (size_t idx = 0; idx < multi.size(); ++idx) {
+    const j1939_analyzer_message_t &msg = multi[idx].msg;
+    /* same records regardless of the thread count, in time order */
+    EXPECT_EQ(msg.timestamp_us, single[idx].msg.timestamp_us);
+    EXPECT_EQ(multi[idx].data, single[idx].data);
+    if (idx) {
+      EXPECT_GE(msg.timestamp_us, multi[idx - 1].msg.timestamp_us);
+    }
+
+    switch (msg.event) {
+      case J1939_ANALYZER_COMPLETE:
+        ++complete;
+        EXPECT_EQ(msg.pgn, 0xFE00U + msg.source_address);
+        EXPECT_EQ(msg.size, 20);
+        EXPECT_EQ(multi[idx].data[0], msg.source_address);
+        EXPECT_EQ(multi[idx].data[15], 3);
+        EXPECT_LT(msg.first_us, msg.last_us);
+        break;
+      case J1939_ANALYZER_ABORT:
+        EXPECT_EQ(msg.source_address, 0x80);
+        EXPECT_EQ(msg.destination_address, 0x90);
+        EXPECT_EQ(msg.abort_reason, 3);
+        EXPECT_EQ(msg.received_packets, 1);
+        break;
+      case J1939_ANALYZER_TIMEOUT:
+        EXPECT_EQ(msg.source_address, 0xA0);
+        EXPECT_EQ(msg.last_us, lost);
+        EXPECT_EQ(msg.received_packets, 1);
+        EXPECT_EQ(multi[idx].data[7], 0xFF);
+        break;
+      default:
+        ADD_FAILURE();
+        break;
+    }
+  }
+  EXPECT_EQ(complete, 64U);
+
+  j1939_log_close(log);
+  remove(path.c_str());
+}
@@ -0,0 +1,97 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_scheduler.h"
+#include "src/j1939_tp.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <vector>
+
+static auto collect_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ((std::vector<uint8_t> *)arg)->assign(msg->data, msg->data + msg->size);
+};
+
+TEST(j1939, bam) {
+  std::vector<uint8_t> received;
+  j1939_config_t config[] = {
+    { .self_address = 0x30, .recv_cb = nullptr, .timeout_cb = nullptr, .port = (j1939_port_t *)0x30, .arg = nullptr, },
+    { .self_address = 0x31, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x31, .arg = &received, },
+  };
+  j1939_t *handle[] = {j1939_create(&config[0]), j1939_create(&config[1])};
+  j1939_scheduler_t *scheduler = j1939_scheduler_create(handle[0], 1);
+  j1939_virtual_set_trace(0);
+
+  std::vector<uint8_t> data(J1939_TP_MAX_MSG_SIZE);
+  for (size_t idx = 0; idx < data.size(); ++idx)
+    data[idx] = idx * 13;
+  /* the handle takes over every message it starts a session with */
+  auto create = [&](uint16_t size) { return j1939_message_create(0x18FEE030U, data.data(), size); };
+
+  /* nothing to send, nothing to wait for */
+  EXPECT_EQ(j1939_tp_next_deadline(handle[0]), UINT32_MAX);
+  EXPECT_EQ(j1939_scheduler_next_deadline(scheduler), UINT32_MAX);
+
+  /* the interval is clamped to the window of the standard, the scheduler paces the packets */
+  j1939_set_bam_interval(handle[0], 1);
+  ASSERT_EQ(j1939_transmit(handle[0], create(data.size()), 0), J1939_OK);
+  uint32_t deadline = j1939_scheduler_next_deadline(scheduler);
+  EXPECT_GT(deadline, 0U);
+  EXPECT_LE(deadline, (uint32_t)J1939_TP_BAM_TX_INTERVAL_MIN);
+  EXPECT_EQ(j1939_scheduler_process(scheduler, 0), J1939_OK);
+  EXPECT_EQ(j1939_status(handle[0]), J1939_BUSY);
+  uint32_t calls = 0;
+  while (j1939_status(handle[0]) == J1939_BUSY) {
+    if (j1939_scheduler_next_deadline(scheduler) == 0) {
+      ASSERT_EQ(j1939_scheduler_process(scheduler, 0), J1939_OK);
+    }
+    while (j1939_receive(handle[1], 0) == J1939_OK);
+    ASSERT_LT(++calls, 100000U);
+  }
+  while (j1939_receive(handle[1], 0) == J1939_OK);
+  EXPECT_EQ(received, data);
+
+  /* per message interval, clamped from above */
+  received.clear();
+  ASSERT_EQ(j1939_transmit_bam(handle[0], create(data.size()), 1000, 0), J1939_OK);
+  deadline = j1939_tp_next_deadline(handle[0]);
+  EXPECT_GT(deadline, (uint32_t)J1939_TP_BAM_TX_INTERVAL);
+  EXPECT_LE(deadline, (uint32_t)J1939_TP_BAM_TX_INTERVAL_MAX);
+  EXPECT_EQ(j1939_tp_cm_transmit_manager(handle[0], 0), J1939_BLOCKED);
+
+  /* a second transport message waits for the running session */
+  j1939_message_t *other = create(100);
+  EXPECT_EQ(j1939_transmit_bam(handle[0], other, J1939_TP_BAM_TX_BURST, 0), J1939_BUSY);
+  while (j1939_status(handle[0]) == J1939_BUSY)
+    j1939_scheduler_process(scheduler, 0);
+  while (j1939_receive(handle[1], 0) == J1939_OK);
+  EXPECT_EQ(received, data);
+
+  /* burst mode sends every packet in one go */
+  received.clear();
+  ASSERT_EQ(j1939_transmit_bam(handle[0], create(data.size()), J1939_TP_BAM_TX_BURST, 0), J1939_OK);
+  EXPECT_EQ(j1939_tp_next_deadline(handle[0]), 0U);
+  EXPECT_EQ(j1939_tp_cm_transmit_manager(handle[0], 0), J1939_OK);
+  EXPECT_EQ(j1939_status(handle[0]), J1939_OK);
+  while (j1939_receive(handle[1], 0) == J1939_OK);
+  EXPECT_EQ(received, data);
+
+  j1939_message_delete(other);
+  j1939_virtual_set_trace(1);
+  j1939_scheduler_delete(scheduler);
+  j1939_delete(handle[0]);
+  j1939_delete(handle[1]);
+}
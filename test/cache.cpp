@@ -0,0 +1,102 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+TEST(j1939, cache) {
+  /* formatted in plain memory here, the same works for a shared mapping */
+  std::vector<uint64_t> mem(j1939_cache_footprint(8, 32) / sizeof(uint64_t) + 1);
+  j1939_cache_t *cache = j1939_cache_init(mem.data(), 8, 32, 0);
+  ASSERT_EQ(j1939_cache_attach(mem.data()), cache);
+
+  j1939_config_t config[] = {
+    {
+      .self_address = 0x30,
+      .recv_cb = nullptr,
+      .timeout_cb = nullptr,
+      .port = (j1939_port_t *)0x30,
+      .arg = nullptr,
+    },
+    {
+      .self_address = 0x31,
+      .recv_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {},
+      .timeout_cb = nullptr,
+      .port = (j1939_port_t *)0x31,
+      .arg = nullptr,
+    },
+  };
+  j1939_t *bus[] = {j1939_create(&config[0]), j1939_create(&config[1])};
+  j1939_set_cache(bus[1], cache);
+
+  j1939_static_message_t msg = { .id = 0x18FEF130U, .size = 8, .data = {1, 2, 3, 4, 5, 6, 7, 8}, };
+  j1939_transmit_static(bus[0], &msg, 0);
+  ASSERT_EQ(j1939_receive(bus[1], 0), J1939_OK);
+
+  uint8_t data[32] = {0};
+  j1939_cache_info_t info;
+  ASSERT_EQ(j1939_cache_read(cache, 0xFEF1, 0x30, data, sizeof(data), &info), J1939_OK);
+  EXPECT_EQ(info.size, 8);
+  EXPECT_EQ(info.stale, 0);
+  EXPECT_EQ(memcmp(data, msg.data, 8), 0);
+  EXPECT_EQ(j1939_cache_read(cache, 0xFEF1, 0x31, data, sizeof(data), &info), J1939_ERROR);
+
+  /* reassembled transport messages are cached the same way */
+  j1939_message_t *lmsg = j1939_message_create(0x18FECA30U, "ABCDEFGHIJKLMNOPQRSTUVWXYZ", 26);
+  ASSERT_EQ(j1939_cache_update(cache, lmsg), J1939_OK);
+  ASSERT_EQ(j1939_cache_read(cache, 0xFECA, 0x30, data, sizeof(data), &info), J1939_OK);
+  EXPECT_EQ(info.size, 26);
+  EXPECT_EQ(memcmp(data, lmsg->data, 26), 0);
+  j1939_message_delete(lmsg);
+
+  /* readers never observe a torn entry while the writer keeps going */
+  std::atomic<bool> done{false};
+  std::thread reader([&] {
+    uint8_t snapshot[8];
+    while (!done) {
+      if (j1939_cache_read(cache, 0xFEF2, 0x30, snapshot, sizeof(snapshot), nullptr) != J1939_OK)
+        continue;
+      for (auto &byte : snapshot)
+        ASSERT_EQ(byte, snapshot[0]);
+    }
+  });
+  j1939_static_message_t m = { .id = 0x18FEF230U, .size = 8, .data = {0}, };
+  for (int idx = 0; idx < 100000; ++idx) {
+    memset(m.data, idx, sizeof(m.data));
+    j1939_cache_update(cache, (j1939_message_t *)&m);
+  }
+  done = true;
+  reader.join();
+
+  /* an entry without updates for longer than max_age_ms turns stale */
+  j1939_cache_t *aging = j1939_cache_create(4, 8, 5);
+  ASSERT_EQ(j1939_cache_update(aging, (j1939_message_t *)&msg), J1939_OK);
+  ASSERT_EQ(j1939_cache_read(aging, 0xFEF1, 0x30, data, sizeof(data), &info), J1939_OK);
+  EXPECT_EQ(info.stale, 0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  ASSERT_EQ(j1939_cache_read(aging, 0xFEF1, 0x30, data, sizeof(data), &info), J1939_OK);
+  EXPECT_EQ(info.stale, 1);
+  ASSERT_EQ(j1939_cache_update(aging, (j1939_message_t *)&msg), J1939_OK);
+  ASSERT_EQ(j1939_cache_read(aging, 0xFEF1, 0x30, data, sizeof(data), &info), J1939_OK);
+  EXPECT_EQ(info.stale, 0);
+  j1939_cache_delete(aging);
+
+  j1939_delete(bus[0]);
+  j1939_delete(bus[1]);
+}
@@ -0,0 +1,128 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_dm1.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+struct dm1_event_t {
+  uint8_t sa;
+  j1939_dm1_event_t event;
+  uint32_t spn;
+  uint8_t fmi;
+  uint16_t lamp;
+};
+
+static auto collect_cb = +[](uint8_t source_address, j1939_dm1_event_t event, const j1939_dtc_t *dtc, uint16_t lamp, void *arg) {
+  ((std::vector<dm1_event_t> *)arg)->push_back({source_address, event, dtc ? dtc->spn : 0, dtc ? dtc->fmi : (uint8_t)0, lamp});
+};
+
+static j1939_message_t *dm1(uint8_t sa, uint8_t lamp, std::vector<std::pair<uint32_t, uint8_t>> dtcs) {
+  std::vector<uint8_t> data = {lamp, 0xFF};
+  for (auto &[spn, fmi] : dtcs) {
+    data.insert(data.end(), {(uint8_t)spn, (uint8_t)(spn >> 8), (uint8_t)((spn >> 11 & 0xE0) | fmi), 1});
+  }
+  if (dtcs.empty())
+    data.insert(data.end(), {0, 0, 0, 0});
+  while (data.size() < 8)
+    data.push_back(0xFF);
+  return j1939_message_create(0x18FECA00U | sa, data.data(), data.size());
+}
+
+static void update(j1939_dm1_t *table, uint8_t sa, uint8_t lamp, std::vector<std::pair<uint32_t, uint8_t>> dtcs, j1939_status_t expect = J1939_OK) {
+  j1939_message_t *msg = dm1(sa, lamp, dtcs);
+  EXPECT_EQ(j1939_dm1_update(table, msg), expect);
+  j1939_message_delete(msg);
+}
+
+TEST(j1939, dm1) {
+  std::vector<dm1_event_t> events;
+  j1939_dm1_t *table = j1939_dm1_create(8, collect_cb, &events);
+  ASSERT_NE(table, nullptr);
+
+  /* single frame with one DTC, lamps reported once */
+  update(table, 0x00, 0x04, {{190, 3}});
+  ASSERT_EQ(events.size(), 2U);
+  EXPECT_EQ(events[0].event, J1939_DM1_SET);
+  EXPECT_EQ(events[0].spn, 190U);
+  EXPECT_EQ(events[0].fmi, 3);
+  EXPECT_EQ(events[0].lamp, 0x04FF);
+  EXPECT_EQ(events[1].event, J1939_DM1_LAMP);
+  EXPECT_EQ(events[1].lamp, 0x04FF);
+
+  /* the same DM1 again changes nothing */
+  events.clear();
+  update(table, 0x00, 0x04, {{190, 3}});
+  EXPECT_TRUE(events.empty());
+
+  /* multi packet DM1 as reassembled from BAM, one new, one high SPN */
+  update(table, 0x00, 0x04, {{190, 3}, {524287 - 1, 31}, {91, 2}});
+  ASSERT_EQ(events.size(), 2U);
+  EXPECT_EQ(events[0].spn, 524286U);
+  EXPECT_EQ(events[0].fmi, 31);
+  EXPECT_EQ(events[1].spn, 91U);
+
+  /* another source is tracked on its own */
+  events.clear();
+  update(table, 0x03, 0x00, {{190, 3}});
+  ASSERT_EQ(events.size(), 2U);
+  EXPECT_EQ(events[0].sa, 0x03);
+  j1939_dtc_t dtcs[8];
+  EXPECT_EQ(j1939_dm1_active(table, 0x00, dtcs, 8), 3);
+  EXPECT_EQ(j1939_dm1_active(table, 0x03, dtcs, 8), 1);
+
+  /* faults cleared one by one, then all with SPN 0 */
+  events.clear();
+  update(table, 0x00, 0x04, {{91, 2}, {190, 3}});
+  ASSERT_EQ(events.size(), 1U);
+  EXPECT_EQ(events[0].event, J1939_DM1_CLEARED);
+  EXPECT_EQ(events[0].spn, 524286U);
+
+  events.clear();
+  update(table, 0x00, 0x00, {});
+  ASSERT_EQ(events.size(), 3U);
+  EXPECT_EQ(events[0].event, J1939_DM1_CLEARED);
+  EXPECT_EQ(events[0].lamp, 0x00FF);
+  EXPECT_EQ(events[1].event, J1939_DM1_CLEARED);
+  EXPECT_EQ(events[2].event, J1939_DM1_LAMP);
+  EXPECT_EQ(j1939_dm1_lamp(table, 0x00), 0x00FF);
+  EXPECT_EQ(j1939_dm1_active(table, 0x00, dtcs, 8), 0);
+  EXPECT_EQ(j1939_dm1_active(table, 0x03, dtcs, 8), 1);
+
+  /* the table is bounded, overflow is reported instead of allocating */
+  events.clear();
+  update(table, 0x10, 0x00, {{1, 1}, {2, 1}, {3, 1}, {4, 1}, {5, 1}, {6, 1}, {7, 1}, {8, 1}}, J1939_BUSY);
+  EXPECT_EQ(j1939_dm1_active(table, 0x10, dtcs, 8), 7);
+
+  /* churn through the table, lookups keep working after backward shift deletes */
+  for (uint32_t round = 0; round < 1000; ++round) {
+    update(table, 0x10, 0x00, {{round % 50 + 1, 1}, {round % 7 + 100, 2}, {round % 13 + 200, 3}});
+    ASSERT_EQ(j1939_dm1_active(table, 0x10, dtcs, 8), 3);
+  }
+  EXPECT_EQ(j1939_dm1_active(table, 0x03, dtcs, 8), 1);
+  EXPECT_EQ(dtcs[0].spn, 190U);
+
+  events.clear();
+  j1939_dm1_remove(table, 0x10);
+  EXPECT_EQ(events.size(), 3U);
+  EXPECT_EQ(j1939_dm1_active(table, 0x10, dtcs, 8), 0);
+
+  /* other parameter groups are ignored */
+  j1939_static_message_t m = { .id = 0x18FEF100U, .size = 8, .data = {0}, };
+  EXPECT_EQ(j1939_dm1_update(table, (j1939_message_t *)&m), J1939_OK);
+
+  j1939_dm1_delete(table);
+}
@@ -0,0 +1,116 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_port.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+static auto collect_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ((std::vector<uint32_t> *)arg)->push_back(j1939_get_pgn(msg->id));
+};
+
+static auto count_hook = +[](j1939_port_t *port, const j1939_static_message_t *msg, j1939_port_dir_t dir, void *arg) {
+  if (port == (j1939_port_t *)0x41 && dir == J1939_PORT_RX)
+    ++*(int *)arg;
+};
+
+TEST(j1939, filter) {
+  std::vector<uint32_t> received;
+  int seen = 0;
+  j1939_config_t config[] = {
+    { .self_address = 0x40, .recv_cb = nullptr, .timeout_cb = nullptr, .port = (j1939_port_t *)0x40, .arg = nullptr, },
+    { .self_address = 0x41, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x41, .arg = &received, },
+  };
+  j1939_t *handle[] = {j1939_create(&config[0]), j1939_create(&config[1])};
+  ASSERT_EQ(j1939_port_hook_register(count_hook, &seen), J1939_OK);
+  j1939_virtual_set_trace(0);
+
+  /* one exact PGN from one source only, a PDU2 group range and a PDU1 PGN */
+  j1939_filter_t filter[] = {{ .id = 0x00FEF100U | 0x40, .mask = 0x03FFFFFFU, }};
+  j1939_pgn_range_t range[] = {{ .first = 0xFE00, .last = 0xFE0F, }, { .first = 0xEF00, .last = 0xEF00, }};
+  j1939_pgn_range_t invalid = { .first = 2, .last = 1, };
+  EXPECT_EQ(j1939_set_filter(handle[1], filter, 1, &invalid, 1), J1939_ERROR);
+  ASSERT_EQ(j1939_set_filter(handle[1], filter, 1, range, 2), J1939_OK);
+
+  const uint32_t ids[] = {
+    0x18FEF140U, /* filter */
+    0x18FEF142U, /* filter, other source */
+    0x18FEF240U, /* nothing */
+    0x18FE0540U, /* range */
+    0x18FE1040U, /* just past the range */
+    0x18EF4140U, /* PDU1 range, to us */
+    0x18EF4240U, /* PDU1 range, to someone else */
+    0x18EE0040U, /* nothing */
+  };
+  for (uint32_t id : ids) {
+    j1939_static_message_t m = { .id = id & 0x1FFFFF00U, .size = 8, .data = {0}, };
+    m.pdu.source_address = id & 0xFF;
+    j1939_transmit_static(handle[0], &m, 0);
+  }
+  while (j1939_receive(handle[1], 0) != J1939_TIMEOUT);
+  EXPECT_EQ(received, std::vector<uint32_t>({0xFEF1, 0xFE05, 0xEF00}));
+  /* the port already dropped the rest, the PDU1 destination is still checked by the handle */
+  EXPECT_EQ(seen, 4);
+
+  /* transport messages pass by the PGN they announce */
+  received.clear();
+  std::vector<uint8_t> data(100, 0x5A);
+  ASSERT_EQ(j1939_transmit(handle[0], j1939_message_create(0x18FEE040U, data.data(), data.size()), 0), J1939_OK);
+  while (j1939_status(handle[0]) == J1939_BUSY)
+    j1939_tp_cm_transmit_manager(handle[0], 0);
+  while (j1939_receive(handle[1], 0) != J1939_TIMEOUT);
+  EXPECT_TRUE(received.empty());
+  EXPECT_EQ(j1939_status(handle[1]), J1939_OK);
+
+  ASSERT_EQ(j1939_transmit(handle[0], j1939_message_create(0x18FE0A40U, data.data(), data.size()), 0), J1939_OK);
+  while (j1939_status(handle[0]) == J1939_BUSY)
+    j1939_tp_cm_transmit_manager(handle[0], 0);
+  while (j1939_receive(handle[1], 0) != J1939_TIMEOUT);
+  EXPECT_EQ(received, std::vector<uint32_t>({0xFE0A}));
+
+  /* a bank too large for the port filters leaves the port open, the handle still drops the rest */
+  j1939_pgn_range_t split[] = {{ .first = 0xFD01, .last = 0xFDFE, }, { .first = 0xFE01, .last = 0xFEFE, }};
+  ASSERT_EQ(j1939_set_filter(handle[1], nullptr, 0, split, 2), J1939_OK);
+  received.clear();
+  seen = 0;
+  for (uint32_t id : {0x18FD0540U, 0x18FF0040U}) {
+    j1939_static_message_t m = { .id = id & 0x1FFFFF00U, .size = 8, .data = {0}, };
+    m.pdu.source_address = id & 0xFF;
+    j1939_transmit_static(handle[0], &m, 0);
+  }
+  while (j1939_receive(handle[1], 0) != J1939_TIMEOUT);
+  EXPECT_EQ(received, std::vector<uint32_t>({0xFD05}));
+  EXPECT_EQ(seen, 2);
+
+  /* an empty bank accepts everything again */
+  received.clear();
+  ASSERT_EQ(j1939_set_filter(handle[1], nullptr, 0, nullptr, 0), J1939_OK);
+  j1939_static_message_t m = { .id = 0x18FEF240U, .size = 8, .data = {0}, };
+  j1939_transmit_static(handle[0], &m, 0);
+  while (j1939_receive(handle[1], 0) != J1939_TIMEOUT);
+  EXPECT_EQ(received, std::vector<uint32_t>({0xFEF2}));
+
+  /* controllers with a single code/mask get a filter that lets all of them pass */
+  j1939_filter_t merged = j1939_port_filter_merge((const j1939_filter_t[]){{0x00FEF100U, 0x00FFFF00U}, {0x00FEF300U, 0x00FFFF00U}}, 2);
+  EXPECT_EQ(merged.id, 0x00FEF100U);
+  EXPECT_EQ(merged.mask, 0x00FFFD00U);
+
+  j1939_virtual_set_trace(1);
+  j1939_port_hook_unregister(count_hook, &seen);
+  j1939_delete(handle[0]);
+  j1939_delete(handle[1]);
+}
@@ -0,0 +1,107 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_port.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+#if J1939_TIMESTAMP
+struct stamp_t {
+  uint64_t timestamp;
+  uint64_t timestamp_first;
+  uint64_t delivered;
+};
+
+static auto stamp_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ((std::vector<stamp_t> *)arg)->push_back({msg->timestamp, msg->timestamp_first, j1939_port_get_time()});
+};
+
+TEST(j1939, latency) {
+  std::vector<stamp_t> stamps;
+  j1939_config_t config[] = {
+    { .self_address = 0x50, .recv_cb = nullptr, .timeout_cb = nullptr, .port = (j1939_port_t *)0x50, .arg = nullptr, },
+    { .self_address = 0x51, .recv_cb = stamp_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x51, .arg = &stamps, },
+  };
+  j1939_t *handle[] = {j1939_create(&config[0]), j1939_create(&config[1])};
+  j1939_virtual_set_trace(0);
+
+  /* single frames carry the time they were sent on the virtual bus */
+  uint64_t before = j1939_port_get_time();
+  for (uint8_t idx = 0; idx < 100; ++idx) {
+    j1939_static_message_t m = { .id = 0x18FEF150U, .size = 8, .data = {idx}, };
+    ASSERT_EQ(j1939_transmit_static(handle[0], &m, 0), J1939_OK);
+  }
+  while (j1939_receive(handle[1], 0) == J1939_OK);
+  ASSERT_EQ(stamps.size(), 100U);
+  for (size_t idx = 0; idx < stamps.size(); ++idx) {
+    EXPECT_GE(stamps[idx].timestamp, before);
+    EXPECT_EQ(stamps[idx].timestamp_first, stamps[idx].timestamp);
+    EXPECT_LE(stamps[idx].timestamp, stamps[idx].delivered);
+    if (idx) {
+      EXPECT_GE(stamps[idx].timestamp, stamps[idx - 1].timestamp);
+    }
+  }
+
+  /* reassembled messages span from the BAM to the last packet */
+  stamps.clear();
+  std::vector<uint8_t> data(200, 0x33);
+  ASSERT_EQ(j1939_transmit_bam(handle[0], j1939_message_create(0x18FEE050U, data.data(), data.size()), 0, 0), J1939_OK);
+  while (j1939_status(handle[0]) == J1939_BUSY)
+    j1939_tp_cm_transmit_manager(handle[0], 0);
+  while (j1939_receive(handle[1], 0) == J1939_OK);
+  ASSERT_EQ(stamps.size(), 1U);
+  EXPECT_GT(stamps[0].timestamp, stamps[0].timestamp_first);
+
+  j1939_histogram_t callback, tp;
+  ASSERT_EQ(j1939_get_latency(handle[1], J1939_LATENCY_CALLBACK, &callback), J1939_OK);
+  ASSERT_EQ(j1939_get_latency(handle[1], J1939_LATENCY_TP, &tp), J1939_OK);
+  EXPECT_EQ(j1939_get_latency(handle[1], J1939_LATENCY_MAX, &tp), J1939_ERROR);
+  EXPECT_EQ(callback.count, 101U);
+  EXPECT_EQ(tp.count, 1U);
+  EXPECT_EQ(tp.min, stamps[0].timestamp - stamps[0].timestamp_first);
+  EXPECT_LE(callback.min, callback.max);
+  uint32_t total = 0;
+  for (uint32_t count : callback.buckets)
+    total += count;
+  EXPECT_EQ(total, callback.count);
+  uint64_t p50 = j1939_histogram_percentile(&callback, 50), p99 = j1939_histogram_percentile(&callback, 99);
+  EXPECT_LE(p50, p99);
+  EXPECT_LE(p99, callback.max);
+  printf("callback latency min [%lu] p50 [%lu] p99 [%lu] max [%lu] ns, tp [%lu] ns\n",
+         (unsigned long)callback.min, (unsigned long)p50, (unsigned long)p99, (unsigned long)callback.max, (unsigned long)tp.max);
+
+  j1939_reset_latency(handle[1]);
+  ASSERT_EQ(j1939_get_latency(handle[1], J1939_LATENCY_CALLBACK, &callback), J1939_OK);
+  EXPECT_EQ(callback.count, 0U);
+
+  /* a fixed histogram, the percentile is the upper bound of its bucket */
+  j1939_histogram_t fixed = {};
+  fixed.count = 4;
+  fixed.min = 1;
+  fixed.max = 1000;
+  fixed.buckets[0] = 1;
+  fixed.buckets[3] = 2;
+  fixed.buckets[9] = 1;
+  EXPECT_EQ(j1939_histogram_percentile(&fixed, 25), 1U);
+  EXPECT_EQ(j1939_histogram_percentile(&fixed, 50), 15U);
+  EXPECT_EQ(j1939_histogram_percentile(&fixed, 100), 1000U);
+
+  j1939_virtual_set_trace(1);
+  j1939_delete(handle[0]);
+  j1939_delete(handle[1]);
+}
+#endif /* J1939_TIMESTAMP */
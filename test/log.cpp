@@ -0,0 +1,120 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_log.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+static auto collect_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ((std::vector<std::vector<uint8_t>> *)arg)->emplace_back(msg->data, msg->data + msg->size);
+};
+
+TEST(j1939, log) {
+  std::string capture = testing::TempDir() + "j1939_capture.bin";
+  std::string imported = testing::TempDir() + "j1939_candump.bin";
+  std::string candump = testing::TempDir() + "j1939_candump.log";
+
+  /* capture everything passing the port layer */
+  j1939_recorder_t *recorder = j1939_recorder_create(capture.c_str(), 1);
+  ASSERT_NE(recorder, nullptr);
+  j1939_port_t *port[] = {(j1939_port_t *)0x60, (j1939_port_t *)0x61};
+  j1939_virtual_add_node(port[0]);
+  j1939_virtual_add_node(port[1]);
+  j1939_static_message_t m = { .id = 0x18FEF160U, .size = 8, .data = {0}, };
+  for (uint8_t idx = 0; idx < 3; ++idx) {
+    m.data[0] = idx;
+    j1939_port_transmit(port[0], &m, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    j1939_port_receive(port[1], &m, 0);
+  }
+  ASSERT_EQ(j1939_recorder_delete(recorder), J1939_OK);
+
+  j1939_log_t *log = j1939_log_open(capture.c_str());
+  ASSERT_NE(log, nullptr);
+  ASSERT_EQ(j1939_log_count(log), 6U);
+  EXPECT_EQ(j1939_log_record(log, 0)->dir, J1939_PORT_TX);
+  EXPECT_EQ(j1939_log_record(log, 1)->dir, J1939_PORT_RX);
+  EXPECT_NE(j1939_log_record(log, 0)->channel, j1939_log_record(log, 1)->channel);
+  EXPECT_EQ(j1939_log_record(log, 4)->data[0], 2);
+  /* both records carry the time the frame went on the bus, not the time the hook saw it */
+  EXPECT_EQ(j1939_log_record(log, 0)->timestamp_us, j1939_log_record(log, 1)->timestamp_us);
+
+  /* replayed across all channels, every frame goes out once and not again for each receiving port */
+  j1939_replay_t *replay = j1939_replay_create(log, port[0], 0xFF, 0);
+  while (j1939_replay_step(replay, 0) == J1939_OK);
+  uint8_t replayed = 0;
+  while (j1939_port_receive(port[1], &m, 0) == J1939_OK)
+    EXPECT_EQ(m.data[0], replayed++);
+  EXPECT_EQ(replayed, 3);
+  j1939_replay_delete(replay);
+  j1939_log_close(log);
+
+  /* a BAM from another vehicle, replayed into a handle */
+  FILE *file = fopen(candump.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fputs("(1650000000.000100) can0 18FEF100#0102030405060708\n", file);
+  fputs("(1650000000.010000) can1 0CF00400#F07D7D000000F07D\n", file);
+  fputs("(1650000000.050000) can0 18ECFF00#200A0002FFCAFE00\n", file);
+  fputs("(1650000000.100000) can0 18EBFF00#0101020304050607\n", file);
+  fputs("(1650000000.150000) can0 18EBFF00#0208090AFFFFFFFF\n", file);
+  fputs("(1650000000.200000) can0 18EA00FF#R\n", file);
+  fclose(file);
+
+  recorder = j1939_recorder_create(imported.c_str(), 0);
+  file = fopen(candump.c_str(), "r");
+  ASSERT_EQ(j1939_recorder_import_candump(recorder, file), J1939_OK);
+  fclose(file);
+  ASSERT_EQ(j1939_recorder_delete(recorder), J1939_OK);
+
+  log = j1939_log_open(imported.c_str());
+  ASSERT_NE(log, nullptr);
+  ASSERT_EQ(j1939_log_count(log), 5U);
+  EXPECT_EQ(j1939_log_record(log, 0)->timestamp_us, 1650000000000100ULL);
+  EXPECT_EQ(j1939_log_record(log, 1)->channel, 1);
+  EXPECT_EQ(j1939_log_record(log, 1)->id, 0x0CF00400U);
+  EXPECT_EQ(j1939_log_seek(log, 1650000000050000ULL), 2U);
+  EXPECT_EQ(j1939_log_seek(log, 1650000000050001ULL), 3U);
+  EXPECT_EQ(j1939_log_seek(log, UINT64_MAX), 5U);
+
+  std::vector<std::vector<uint8_t>> received;
+  j1939_config_t config = {
+    .self_address = 0x62,
+    .recv_cb = collect_cb,
+    .timeout_cb = nullptr,
+    .port = (j1939_port_t *)0x62,
+    .arg = &received,
+  };
+  j1939_t *handle = j1939_create(&config);
+  replay = j1939_replay_create(log, port[0], 0, 0);
+  while (j1939_replay_step(replay, 0) == J1939_OK)
+    while (j1939_receive(handle, 0) == J1939_OK);
+
+  ASSERT_EQ(received.size(), 2U);
+  EXPECT_EQ(received[1], std::vector<uint8_t>({1, 2, 3, 4, 5, 6, 7, 8, 9, 10}));
+
+  j1939_replay_delete(replay);
+  j1939_delete(handle);
+  j1939_log_close(log);
+  j1939_virtual_remove_node(port[0]);
+  j1939_virtual_remove_node(port[1]);
+  remove(capture.c_str());
+  remove(imported.c_str());
+  remove(candump.c_str());
+}
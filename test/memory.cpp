@@ -0,0 +1,146 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_memory.h"
+#include "src/j1939_port.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <vector>
+
+struct ecu_t {
+  j1939_memory_client_t *client;
+  j1939_memory_server_t *server;
+  std::vector<uint8_t> flash;
+};
+
+static auto recv_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ecu_t *ecu = (ecu_t *)arg;
+  if (ecu->client)
+    j1939_memory_client_receive(ecu->client, msg);
+  if (ecu->server)
+    j1939_memory_server_receive(ecu->server, msg);
+};
+
+static auto flash_read = +[](void *arg, uint32_t address, uint8_t *data, uint16_t size) {
+  std::vector<uint8_t> &flash = ((ecu_t *)arg)->flash;
+  if (address + size > flash.size())
+    return J1939_ERROR;
+  memcpy(data, &flash[address], size);
+  return J1939_OK;
+};
+
+static auto flash_write = +[](void *arg, uint32_t address, const uint8_t *data, uint16_t size) {
+  std::vector<uint8_t> &flash = ((ecu_t *)arg)->flash;
+  if (address + size > flash.size())
+    return J1939_ERROR;
+  memcpy(&flash[address], data, size);
+  return J1939_OK;
+};
+
+static auto image_write = +[](void *arg, uint32_t address, const uint8_t *data, uint16_t size) {
+  std::vector<uint8_t> &image = *(std::vector<uint8_t> *)arg;
+  image.insert(image.end(), data, data + size);
+  return J1939_OK;
+};
+
+static j1939_status_t run(j1939_t *handle[], j1939_memory_client_t *client, j1939_memory_server_t *server) {
+  j1939_status_t res;
+  while ((res = j1939_memory_client_process(client, 0)) == J1939_BUSY) {
+    while (j1939_receive(handle[1], 0) == J1939_OK);
+    j1939_memory_server_process(server, 0);
+    while (j1939_receive(handle[0], 0) == J1939_OK);
+  }
+  return res;
+}
+
+TEST(j1939, memory) {
+  ecu_t tool = {nullptr, nullptr, {}}, ecu = {nullptr, nullptr, std::vector<uint8_t>(0x10000, 0xFF)};
+  j1939_config_t config[] = {
+    { .self_address = 0xF9, .recv_cb = recv_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x70, .arg = &tool, },
+    { .self_address = 0x20, .recv_cb = recv_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x71, .arg = &ecu, },
+  };
+  j1939_t *handle[] = {j1939_create(&config[0]), j1939_create(&config[1])};
+  j1939_set_tp_window(handle[0], 0xFF);
+  j1939_set_tp_window(handle[1], 0xFF);
+  j1939_virtual_set_trace(0);
+
+  /* the image is streamed from a file, one block at a time */
+  std::vector<uint8_t> image(20000);
+  for (size_t idx = 0; idx < image.size(); ++idx)
+    image[idx] = idx * 7 + (idx >> 8);
+  FILE *file = tmpfile();
+  ASSERT_NE(file, nullptr);
+  fwrite(image.data(), 1, image.size(), file);
+
+  ecu.server = j1939_memory_server_create(handle[1], 0x20, flash_read, flash_write, &ecu);
+  j1939_memory_stats_t stats[2];
+  for (uint8_t pipeline = 0; pipeline < 2; ++pipeline) {
+    tool.client = j1939_memory_client_create(handle[0], 0xF9, 0x20, 1024, pipeline);
+    std::fill(ecu.flash.begin(), ecu.flash.end(), 0xFF);
+    ASSERT_EQ(j1939_memory_client_write(tool.client, 0x1000, image.size(), j1939_memory_file_read, file), J1939_OK);
+    ASSERT_EQ(run(handle, tool.client, ecu.server), J1939_OK);
+    EXPECT_EQ(memcmp(&ecu.flash[0x1000], image.data(), image.size()), 0);
+    EXPECT_EQ(ecu.flash[0x1000 + image.size()], 0xFF);
+    j1939_memory_client_stats(tool.client, &stats[pipeline]);
+    EXPECT_EQ(stats[pipeline].bytes, image.size());
+    printf("pipeline %u: %u bytes in %u ticks\n", pipeline, stats[pipeline].bytes, stats[pipeline].elapsed);
+    j1939_memory_client_delete(tool.client);
+  }
+  EXPECT_LE(stats[1].elapsed, stats[0].elapsed);
+
+  /* read back, including a short last block */
+  std::vector<uint8_t> readback;
+  tool.client = j1939_memory_client_create(handle[0], 0xF9, 0x20, 1000, 2);
+  ASSERT_EQ(j1939_memory_client_read(tool.client, 0x1000, image.size() - 5, image_write, &readback), J1939_OK);
+  ASSERT_EQ(run(handle, tool.client, ecu.server), J1939_OK);
+  ASSERT_EQ(readback.size(), image.size() - 5);
+  EXPECT_EQ(memcmp(readback.data(), image.data(), readback.size()), 0);
+
+  /* a write outside the server memory fails */
+  ASSERT_EQ(j1939_memory_client_write(tool.client, 0xFFF0, 0x100, j1939_memory_file_read, file), J1939_OK);
+  EXPECT_EQ(run(handle, tool.client, ecu.server), J1939_ERROR);
+  /* the server dropped the pipelined requests and serves the next transfer */
+  readback.clear();
+  ASSERT_EQ(j1939_memory_client_read(tool.client, 0x1000, 16, image_write, &readback), J1939_OK);
+  ASSERT_EQ(run(handle, tool.client, ecu.server), J1939_OK);
+  EXPECT_EQ(memcmp(readback.data(), image.data(), 16), 0);
+  j1939_memory_client_delete(tool.client);
+
+  /* a client vanishes with requests queued, another one is told to retry until the server drops them */
+  ecu_t other = {nullptr, nullptr, {}};
+  ASSERT_EQ(j1939_add_address(handle[0], 0xFA, recv_cb, &other), J1939_OK);
+  tool.client = j1939_memory_client_create(handle[0], 0xF9, 0x20, 16, 2);
+  ASSERT_EQ(j1939_memory_client_write(tool.client, 0x1000, 64, j1939_memory_file_read, file), J1939_OK);
+  EXPECT_EQ(j1939_memory_client_process(tool.client, 0), J1939_BUSY);
+  j1939_memory_client_delete(tool.client);
+  tool.client = nullptr;
+  while (j1939_receive(handle[1], 0) == J1939_OK);
+  readback.clear();
+  other.client = j1939_memory_client_create(handle[0], 0xFA, 0x20, 16, 0);
+  ASSERT_EQ(j1939_memory_client_read(other.client, 0x1000, 16, image_write, &readback), J1939_OK);
+  uint32_t start = j1939_port_get_tick();
+  ASSERT_EQ(run(handle, other.client, ecu.server), J1939_OK);
+  EXPECT_GT(j1939_port_get_tick() - start, (uint32_t)J1939_TIMEOUT_T3);
+  EXPECT_EQ(memcmp(readback.data(), image.data(), 16), 0);
+
+  j1939_memory_client_delete(other.client);
+  j1939_memory_server_delete(ecu.server);
+  fclose(file);
+  j1939_virtual_set_trace(1);
+  j1939_delete(handle[0]);
+  j1939_delete(handle[1]);
+}
@@ -0,0 +1,137 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_monitor.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <vector>
+
+static j1939_static_message_t frame(uint32_t id, uint8_t fill, uint8_t size = 8) {
+  j1939_static_message_t m = { .id = id, .size = size, .data = {0}, };
+  for (uint8_t idx = 0; idx < size; ++idx)
+    m.data[idx] = fill;
+  return m;
+}
+
+static auto alarm_cb = +[](uint16_t load, int raised, void *arg) {
+  ((std::vector<std::pair<uint16_t, int>> *)arg)->push_back({load, raised});
+};
+
+TEST(j1939, monitor) {
+  /* 67 bits plus data before stuffing, runs of zeros or ones cost a stuff bit every four */
+  j1939_static_message_t m = frame(0x18FEF100U, 0x55);
+  EXPECT_EQ(j1939_monitor_frame_bits(&m), 135);
+  m = frame(0x18FEF100U, 0x00);
+  EXPECT_EQ(j1939_monitor_frame_bits(&m), 147);
+  m = frame(0x18FEF100U, 0xFF);
+  EXPECT_EQ(j1939_monitor_frame_bits(&m), 146);
+  m = frame(0x0CF00400U, 0, 0);
+  EXPECT_EQ(j1939_monitor_frame_bits(&m), 71);
+
+  EXPECT_EQ(j1939_monitor_create(250000, 4, 16), nullptr);
+  j1939_monitor_t *monitor = j1939_monitor_create(250000, 1000, 2);
+  ASSERT_NE(monitor, nullptr);
+  std::vector<std::pair<uint16_t, int>> alarms;
+  j1939_monitor_set_alarm(monitor, 500, alarm_cb, &alarms);
+
+  /* EEC1 from 0x00 every 10 ms, CCVS from 0x00 and ET1 from 0x17 every 100 ms, one second long */
+  uint64_t time = 0;
+  uint32_t bits = 0;
+  for (uint32_t ms = 0; ms < 1000; ms += 10) {
+    std::vector<uint32_t> ids = {0x0CF00400U};
+    if (ms % 100 == 0)
+      ids.insert(ids.end(), {0x18FEF100U, 0x18FEEE17U});
+    for (uint32_t id : ids) {
+      m = frame(id, 0x55);
+      bits += j1939_monitor_frame_bits(&m);
+      j1939_monitor_frame(monitor, &m, time = ms * 1000ULL);
+    }
+  }
+  /* the window still reaches back to the first frame */
+  time = 1000000 - 1;
+  j1939_monitor_usage_t usage;
+  j1939_monitor_load(monitor, time, &usage);
+  EXPECT_EQ(usage.frames_per_second, 120U);
+  EXPECT_EQ(usage.bits_per_second, bits);
+  EXPECT_EQ(usage.load, bits * 1000 / 250000);
+
+  j1939_monitor_usage_t top[4];
+  ASSERT_EQ(j1939_monitor_top(monitor, J1939_MONITOR_SOURCE, time, top, 4), 2);
+  EXPECT_EQ(top[0].key, 0x00U);
+  EXPECT_EQ(top[0].frames_per_second, 110U);
+  EXPECT_EQ(top[1].key, 0x17U);
+  EXPECT_EQ(top[1].frames_per_second, 10U);
+  /* two PGNs fit, the third one is counted as other */
+  ASSERT_EQ(j1939_monitor_top(monitor, J1939_MONITOR_PGN, time, top, 4), 3);
+  EXPECT_EQ(top[0].key, 0xF004U);
+  EXPECT_EQ(top[0].frames_per_second, 100U);
+  EXPECT_EQ(top[1].frames_per_second, 10U);
+  EXPECT_EQ(top[2].frames_per_second, 10U);
+  EXPECT_TRUE(top[1].key == J1939_MONITOR_OTHER || top[2].key == J1939_MONITOR_OTHER);
+  EXPECT_EQ(j1939_monitor_top(monitor, J1939_MONITOR_PGN, time, top, 1), 1);
+  EXPECT_EQ(top[0].key, 0xF004U);
+  EXPECT_TRUE(alarms.empty());
+
+  /* a burst of back to back frames raises the alarm, silence clears it and ages out the counters */
+  for (uint32_t idx = 0; idx < 2000; ++idx) {
+    m = frame(0x18EF0020U, 0x00);
+    j1939_monitor_frame(monitor, &m, time += 600);
+  }
+  ASSERT_EQ(alarms.size(), 1U);
+  EXPECT_EQ(alarms[0].second, 1);
+  EXPECT_GE(alarms[0].first, 500);
+  ASSERT_EQ(j1939_monitor_top(monitor, J1939_MONITOR_SOURCE, time, top, 1), 1);
+  EXPECT_EQ(top[0].key, 0x20U);
+  time += 2000000;
+  j1939_monitor_load(monitor, time, &usage);
+  EXPECT_EQ(usage.load, 0);
+  ASSERT_EQ(alarms.size(), 2U);
+  EXPECT_EQ(alarms[1].second, 0);
+  EXPECT_EQ(j1939_monitor_top(monitor, J1939_MONITOR_SOURCE, time, top, 4), 0);
+  EXPECT_EQ(j1939_monitor_top(monitor, J1939_MONITOR_PGN, time, top, 4), 0);
+
+  /* the freed PGN slots take new PGNs */
+  m = frame(0x18FECA03U, 0x55);
+  j1939_monitor_frame(monitor, &m, time);
+  ASSERT_EQ(j1939_monitor_top(monitor, J1939_MONITOR_PGN, time, top, 4), 1);
+  EXPECT_EQ(top[0].key, 0xFECAU);
+  j1939_monitor_delete(monitor);
+
+  /* captured from one port of the virtual bus, each frame counts once */
+  j1939_config_t config[] = {
+    { .self_address = 0x50, .recv_cb = nullptr, .timeout_cb = nullptr, .port = (j1939_port_t *)0x50, .arg = nullptr, },
+    { .self_address = 0x51, .recv_cb = nullptr, .timeout_cb = nullptr, .port = (j1939_port_t *)0x51, .arg = nullptr, },
+  };
+  j1939_t *handle[] = {j1939_create(&config[0]), j1939_create(&config[1])};
+  j1939_virtual_set_trace(0);
+  monitor = j1939_monitor_create(250000, 1000, 8);
+  ASSERT_EQ(j1939_monitor_capture(monitor, (j1939_port_t *)0x51), J1939_OK);
+  for (uint8_t idx = 0; idx < 10; ++idx) {
+    m = frame(0x18FEF150U, idx);
+    j1939_transmit_static(handle[0], &m, 0);
+    m = frame(0x18FEF151U, idx);
+    j1939_transmit_static(handle[1], &m, 0);
+    while (j1939_receive(handle[0], 0) != J1939_TIMEOUT);
+    while (j1939_receive(handle[1], 0) != J1939_TIMEOUT);
+  }
+  ASSERT_EQ(j1939_monitor_top(monitor, J1939_MONITOR_SOURCE, j1939_port_get_time() / 1000, top, 4), 2);
+  EXPECT_GT(top[0].frames_per_second, 0U);
+  EXPECT_EQ(top[0].frames_per_second, top[1].frames_per_second);
+  j1939_monitor_delete(monitor);
+  j1939_virtual_set_trace(1);
+  j1939_delete(handle[0]);
+  j1939_delete(handle[1]);
+}
@@ -0,0 +1,136 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_runtime.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+struct node_t {
+  j1939_runtime_t *runtime;
+  /* set while a worker is inside the handle, two at once is a violation */
+  std::atomic<int> active{0};
+  std::atomic<uint32_t> *violations;
+  std::atomic<uint32_t> *received;
+  uint32_t remaining;
+  uint8_t destination;
+};
+
+static void enter(node_t *node) {
+  if (node->active.exchange(1))
+    ++*node->violations;
+}
+
+static void leave(node_t *node) {
+  node->active = 0;
+}
+
+static auto recv_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  node_t *node = (node_t *)arg;
+  enter(node);
+  bool intact = msg->size == 200;
+  for (uint16_t idx = 0; intact && idx < msg->size; ++idx)
+    intact = msg->data[idx] == (uint8_t)(idx + msg->pdu.source_address);
+  if (intact)
+    ++*node->received;
+  leave(node);
+};
+
+/* one message after the other, the sender's transport session takes one at a time */
+static void send_next(j1939_t *handle, void *arg) {
+  node_t *node = (node_t *)arg;
+  enter(node);
+  uint8_t sa = node->destination - 1;
+  if (j1939_tx_status(handle, sa) == J1939_OK) {
+    std::vector<uint8_t> data(200);
+    for (uint16_t idx = 0; idx < data.size(); ++idx)
+      data[idx] = idx + sa;
+    j1939_message_t *msg = j1939_message_create(0x18EF0000U | node->destination << 8 | sa, data.data(), data.size());
+    if (j1939_transmit(handle, msg, 0) == J1939_OK)
+      --node->remaining;
+    else
+      j1939_message_delete(msg);
+  }
+  leave(node);
+  if (node->remaining)
+    j1939_runtime_post(node->runtime, handle, send_next, node);
+}
+
+TEST(j1939, runtime) {
+  constexpr uint8_t pairs = 12;
+  std::atomic<uint32_t> violations{0}, received{0};
+  uint32_t expected = 0;
+  j1939_runtime_t *runtime = j1939_runtime_create(4, 1, 1);
+  ASSERT_NE(runtime, nullptr);
+  j1939_virtual_set_trace(0);
+  j1939_virtual_set_realtime(1);
+
+  /* uneven load, some pairs move twenty times what others do */
+  std::vector<node_t> nodes(2 * pairs);
+  std::vector<j1939_t *> handle(2 * pairs);
+  for (uint8_t idx = 0; idx < 2 * pairs; ++idx) {
+    node_t &node = nodes[idx];
+    node.runtime = runtime;
+    node.violations = &violations;
+    node.received = &received;
+    node.destination = 0x61 + idx;
+    node.remaining = idx % 2 ? 0 : (idx / 2 % 3 ? 1 : 20);
+    expected += node.remaining;
+    j1939_config_t config = { .self_address = (uint8_t)(0x60 + idx), .recv_cb = recv_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)(0x60UL + idx), .arg = &node, };
+    handle[idx] = j1939_create(&config);
+    j1939_set_tp_window(handle[idx], 0xFF);
+    ASSERT_EQ(j1939_runtime_add(runtime, handle[idx], nullptr), J1939_OK);
+  }
+  EXPECT_EQ(j1939_runtime_add(runtime, handle[0], nullptr), J1939_ERROR);
+  EXPECT_EQ(j1939_runtime_post(runtime, (j1939_t *)0x10, send_next, nullptr), J1939_ERROR);
+
+  auto begin = std::chrono::steady_clock::now();
+  for (uint8_t idx = 0; idx < 2 * pairs; idx += 2) {
+    ASSERT_EQ(j1939_runtime_post(runtime, handle[idx], send_next, &nodes[idx]), J1939_OK);
+  }
+  while (received < expected && std::chrono::steady_clock::now() - begin < std::chrono::seconds(20))
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+
+  EXPECT_EQ(received, expected);
+  EXPECT_EQ(violations, 0U);
+  j1939_runtime_stats_t stats, total = {0, 0, 0, 0};
+  for (uint16_t worker = 0; worker < j1939_runtime_workers(runtime); ++worker) {
+    ASSERT_EQ(j1939_runtime_stats(runtime, worker, &stats), J1939_OK);
+    total.runs += stats.runs;
+    total.steals += stats.steals;
+    total.frames += stats.frames;
+    total.parks += stats.parks;
+  }
+  EXPECT_EQ(j1939_runtime_stats(runtime, j1939_runtime_workers(runtime), &stats), J1939_ERROR);
+  EXPECT_GT(total.frames, 0U);
+  printf("%u messages in %lld ms, runs [%llu] steals [%llu] frames [%llu] parks [%llu]\n", expected, (long long)elapsed,
+         (unsigned long long)total.runs, (unsigned long long)total.steals, (unsigned long long)total.frames, (unsigned long long)total.parks);
+
+  for (uint8_t idx = 0; idx < 2 * pairs; ++idx) {
+    EXPECT_EQ(j1939_runtime_notify(runtime, handle[idx]), J1939_OK);
+    ASSERT_EQ(j1939_runtime_remove(runtime, handle[idx]), J1939_OK);
+    EXPECT_EQ(j1939_runtime_remove(runtime, handle[idx]), J1939_ERROR);
+  }
+  j1939_runtime_delete(runtime);
+  j1939_virtual_set_trace(1);
+  j1939_virtual_set_realtime(0);
+  for (j1939_t *it : handle)
+    j1939_delete(it);
+}
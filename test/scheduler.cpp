@@ -0,0 +1,84 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_port.h"
+#include "gtest/gtest.h"
+
+TEST(j1939, scheduler) {
+  j1939_config_t config = {
+    .self_address = 0x10,
+    .recv_cb = nullptr,
+    .timeout_cb = nullptr,
+    .port = (j1939_port_t *)0x10,
+    .arg = nullptr,
+  };
+  j1939_t *handle = j1939_create(&config);
+  j1939_static_message_t msg = { .id = 0x18FEF110U, .size = 8, .data = {0, 1, 2, 3, 4, 5, 6, 7}, };
+
+  /* messages of equal period are due at different phases, 0, 1/2 and 1/4 of the period, removing the
+   * earliest one each time moves the next deadline out. the tick counts calls, hence the long period */
+  j1939_scheduler_t *spread = j1939_scheduler_create(handle, 3);
+  j1939_static_message_t *phase[] = {
+    j1939_scheduler_add(spread, &msg, 1600),
+    j1939_scheduler_add(spread, &msg, 1600),
+    j1939_scheduler_add(spread, &msg, 1600),
+  };
+  EXPECT_EQ(j1939_scheduler_next_deadline(spread), 0U);
+  EXPECT_EQ(j1939_scheduler_remove(spread, phase[0]), J1939_OK);
+  EXPECT_NEAR(j1939_scheduler_next_deadline(spread), 400, 20);
+  EXPECT_EQ(j1939_scheduler_remove(spread, phase[2]), J1939_OK);
+  EXPECT_NEAR(j1939_scheduler_next_deadline(spread), 800, 20);
+  j1939_scheduler_delete(spread);
+
+  j1939_scheduler_t *scheduler = j1939_scheduler_create(handle, 4);
+  uint32_t start = j1939_port_get_tick();
+  j1939_static_message_t *fast[] = {
+    j1939_scheduler_add(scheduler, &msg, 16),
+    j1939_scheduler_add(scheduler, &msg, 16),
+    j1939_scheduler_add(scheduler, &msg, 16),
+  };
+  j1939_static_message_t *slow = j1939_scheduler_add(scheduler, &msg, 64);
+  ASSERT_NE(slow, nullptr);
+  EXPECT_EQ(j1939_scheduler_add(scheduler, &msg, 64), nullptr);
+  EXPECT_EQ(j1939_scheduler_add(scheduler, &msg, 0), nullptr);
+
+  /* the payload is updated in place, without removing the message */
+  slow->data[0] = 0xA5;
+
+  for (int idx = 0; idx < 256; ++idx) {
+    EXPECT_EQ(j1939_scheduler_process(scheduler, 0), J1939_OK);
+    EXPECT_LE(j1939_scheduler_next_deadline(scheduler), 64U);
+  }
+  uint32_t elapsed = j1939_port_get_tick() - start;
+
+  j1939_scheduler_stats_t stats[4];
+  /* served more often than the period, every message goes out once per period and none is skipped */
+  for (int idx = 0; idx < 4; ++idx) {
+    uint32_t period = idx < 3 ? 16 : 64;
+    ASSERT_EQ(j1939_scheduler_stats(scheduler, idx < 3 ? fast[idx] : slow, &stats[idx]), J1939_OK);
+    EXPECT_NEAR(stats[idx].count, elapsed / period, 1);
+    EXPECT_EQ(stats[idx].overrun, 0U);
+    EXPECT_LT(stats[idx].jitter_max, period);
+  }
+
+  EXPECT_EQ(j1939_scheduler_remove(scheduler, fast[1]), J1939_OK);
+  EXPECT_EQ(j1939_scheduler_remove(scheduler, fast[1]), J1939_ERROR);
+  EXPECT_EQ(j1939_scheduler_stats(scheduler, fast[1], &stats[1]), J1939_ERROR);
+  EXPECT_NE(j1939_scheduler_add(scheduler, &msg, 32), nullptr);
+
+  j1939_scheduler_delete(scheduler);
+  j1939_delete(handle);
+}
@@ -0,0 +1,99 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_shm.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+TEST(j1939, shm) {
+  std::string name = "/j1939_test_" + std::to_string(getpid());
+  j1939_port_t *port[] = {(j1939_port_t *)0x40, (j1939_port_t *)0x41, (j1939_port_t *)0x42};
+  ASSERT_EQ(j1939_shm_attach(port[0], name.c_str()), J1939_OK);
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    /* another ECU in its own process */
+    j1939_static_message_t m = { .id = 0x18FEF141U, .size = 8, .data = {0}, };
+    if (j1939_shm_attach(port[1], name.c_str()) != J1939_OK)
+      _exit(1);
+    for (uint32_t idx = 0; idx < 1000; ++idx) {
+      memcpy(m.data, &idx, sizeof(idx));
+      j1939_shm_transmit(port[1], &m, 0);
+    }
+    _exit(j1939_shm_receive(port[1], &m, 5000) == J1939_OK && m.id == 0x18FEF140U ? 0 : 2);
+  }
+
+  j1939_static_message_t m;
+  for (uint32_t idx = 0; idx < 1000; ++idx) {
+    ASSERT_EQ(j1939_shm_receive(port[0], &m, 5000), J1939_OK);
+    EXPECT_EQ(m.id, 0x18FEF141U);
+    EXPECT_EQ(memcmp(m.data, &idx, sizeof(idx)), 0);
+  }
+  EXPECT_EQ(j1939_shm_overrun(port[0]), 0U);
+
+  m.id = 0x18FEF140U;
+  ASSERT_EQ(j1939_shm_transmit(port[0], &m, 0), J1939_OK);
+  int status = -1;
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  /* own frames are not looped back, slow readers detect the frames they lost */
+  EXPECT_EQ(j1939_shm_receive(port[0], &m, 0), J1939_TIMEOUT);
+  ASSERT_EQ(j1939_shm_attach(port[2], name.c_str()), J1939_OK);
+  for (uint32_t idx = 0; idx < 5000; ++idx)
+    j1939_shm_transmit(port[0], &m, 0);
+  ASSERT_EQ(j1939_shm_receive(port[2], &m, 0), J1939_OK);
+  EXPECT_GE(j1939_shm_overrun(port[2]), 5000U - 4096U);
+
+  j1939_shm_detach(port[0]);
+  j1939_shm_detach(port[2]);
+  EXPECT_EQ(j1939_shm_unlink(name.c_str()), J1939_OK);
+}
+
+TEST(j1939, shm_dead_writer) {
+  std::string name = "/j1939_test_dead_" + std::to_string(getpid());
+  j1939_port_t *port[] = {(j1939_port_t *)0x43, (j1939_port_t *)0x44};
+  ASSERT_EQ(j1939_shm_attach(port[0], name.c_str()), J1939_OK);
+  ASSERT_EQ(j1939_shm_attach(port[1], name.c_str()), J1939_OK);
+
+  /* a writer that died right after reserving a slot, the head (after magic and capacity) moved but
+   * nothing gets published there */
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  ASSERT_GE(fd, 0);
+  void *base = mmap(nullptr, 16, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT_NE(base, MAP_FAILED);
+  ((std::atomic<uint64_t> *)((char *)base + 8))->fetch_add(1);
+  munmap(base, 16);
+
+  /* the frames behind it still arrive, even to a reader waiting without a timeout */
+  j1939_static_message_t m = { .id = 0x18FEF143U, .size = 8, .data = {0}, };
+  ASSERT_EQ(j1939_shm_transmit(port[0], &m, 0), J1939_OK);
+  m.id = 0;
+  ASSERT_EQ(j1939_shm_receive(port[1], &m, UINT32_MAX), J1939_OK);
+  EXPECT_EQ(m.id, 0x18FEF143U);
+  EXPECT_EQ(j1939_shm_overrun(port[1]), 1U);
+
+  j1939_shm_detach(port[0]);
+  j1939_shm_detach(port[1]);
+  EXPECT_EQ(j1939_shm_unlink(name.c_str()), J1939_OK);
+}
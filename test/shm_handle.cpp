@@ -0,0 +1,80 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_shm.h"
+#include "gtest/gtest.h"
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static auto collect_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ((std::vector<std::vector<uint8_t>> *)arg)->emplace_back(msg->data, msg->data + msg->size);
+};
+
+/* receives and drives the transport sessions until done or about five seconds passed */
+template <typename done_t>
+static bool run(j1939_t *handle, done_t done) {
+  for (int round = 0; round < 500 && !done(); ++round) {
+    while (j1939_receive(handle, 10) != J1939_TIMEOUT);
+    j1939_tp_cm_transmit_manager(handle, 0);
+  }
+  return done();
+}
+
+static std::vector<uint8_t> payload(void) {
+  std::vector<uint8_t> data(100);
+  for (uint16_t idx = 0; idx < data.size(); ++idx)
+    data[idx] = idx;
+  return data;
+}
+
+TEST(j1939, shm_handle) {
+  /* a ring of this run only, the ports are attached before j1939_create picks the default one */
+  std::string name = "/j1939_handle_" + std::to_string(getpid());
+  std::vector<std::vector<uint8_t>> inbox;
+  j1939_config_t config = { .self_address = 0x20, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x20, .arg = &inbox, };
+  ASSERT_EQ(j1939_shm_attach(config.port, name.c_str()), J1939_OK);
+  j1939_t *handle = j1939_create(&config);
+  ASSERT_NE(handle, nullptr);
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    /* another ECU in its own process, it sends a transport message and waits for the answer */
+    std::vector<std::vector<uint8_t>> answers;
+    j1939_config_t ecu = { .self_address = 0x21, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x21, .arg = &answers, };
+    if (j1939_shm_attach(ecu.port, name.c_str()) != J1939_OK)
+      _exit(1);
+    j1939_t *peer = j1939_create(&ecu);
+    std::vector<uint8_t> data = payload();
+    if (peer == NULL || j1939_transmit(peer, j1939_message_create(0x18EF2021U, data.data(), data.size()), 0) != J1939_OK)
+      _exit(2);
+    _exit(run(peer, [&] { return !answers.empty(); }) && answers[0].size() == 3 ? 0 : 3);
+  }
+
+  EXPECT_TRUE(run(handle, [&] { return !inbox.empty() && j1939_status(handle) == J1939_OK; }));
+  ASSERT_EQ(inbox.size(), 1U);
+  EXPECT_EQ(inbox[0], payload());
+  j1939_static_message_t answer = { .id = 0x18EF2120U, .size = 3, .data = {1, 2, 3}, };
+  EXPECT_EQ(j1939_transmit_static(handle, &answer, 0), J1939_OK);
+
+  int status = -1;
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  j1939_delete(handle);
+  EXPECT_EQ(j1939_shm_unlink(name.c_str()), J1939_OK);
+}
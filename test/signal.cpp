@@ -0,0 +1,137 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_signal.h"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+static const j1939_spn_t eec1[] = {
+  { .spn = 190, .pgn = 0xF004, .start_bit = 24, .length = 16, .is_signed = 0, .scale = 0.125f, .offset = 0, .name = "EngineSpeed", },
+  { .spn = 513, .pgn = 0xF004, .start_bit = 16, .length = 8, .is_signed = 0, .scale = 1, .offset = -125, .name = "ActualEnginePercentTorque", },
+  { .spn = 899, .pgn = 0xF004, .start_bit = 0, .length = 4, .is_signed = 0, .scale = 1, .offset = 0, .name = nullptr, },
+  /* a parameter deep inside a transport message */
+  { .spn = 9000, .pgn = 0xFECA, .start_bit = 100, .length = 12, .is_signed = 1, .scale = 0.5f, .offset = 0, .name = nullptr, },
+};
+
+TEST(j1939, signal) {
+  j1939_signal_db_t *db = j1939_signal_db_create(eec1, sizeof(eec1) / sizeof(eec1[0]));
+  ASSERT_NE(db, nullptr);
+
+  const j1939_spn_t *spns;
+  ASSERT_EQ(j1939_signal_list(db, 0xF004, &spns), 3);
+  EXPECT_EQ(spns[0].spn, 899U);
+  EXPECT_EQ(spns[2].spn, 190U);
+  EXPECT_STREQ(j1939_signal_find(db, 513)->name, "ActualEnginePercentTorque");
+  EXPECT_EQ(j1939_signal_find(db, 1), nullptr);
+
+  /* single frame, torque mode 3, torque 50 %, 1000 rpm */
+  j1939_static_message_t m = { .id = 0x0CF00400U, .size = 8, .data = {0xF3, 0xFF, 175, 0x40, 0x1F, 0xFF, 0xFF, 0xFF}, };
+  float values[3];
+  uint32_t raw[3];
+  ASSERT_EQ(j1939_signal_decode(db, (j1939_message_t *)&m, values, raw), 3);
+  EXPECT_EQ(values[0], 3);
+  EXPECT_EQ(values[1], 50);
+  EXPECT_EQ(values[2], 1000);
+  EXPECT_EQ(raw[2], 8000U);
+
+  /* not available and frames too short */
+  m.data[3] = 0xFF, m.data[4] = 0xFF;
+  j1939_signal_decode(db, (j1939_message_t *)&m, values, nullptr);
+  EXPECT_TRUE(std::isnan(values[2]));
+  m.size = 3;
+  j1939_signal_decode(db, (j1939_message_t *)&m, values, nullptr);
+  EXPECT_EQ(values[1], 50);
+  EXPECT_TRUE(std::isnan(values[2]));
+
+  /* reassembled transport buffer, -3 in 12 bits starting at bit 100 */
+  std::vector<uint8_t> buffer(20, 0);
+  buffer[12] = 0xD0, buffer[13] = 0xFF;
+  j1939_message_t *lmsg = j1939_message_create(0x18FECA00U, buffer.data(), buffer.size());
+  ASSERT_EQ(j1939_signal_decode(db, lmsg, values, raw), 1);
+  EXPECT_EQ(values[0], -1.5f);
+  EXPECT_EQ(raw[0], 0xFFDU);
+  j1939_message_delete(lmsg);
+  EXPECT_EQ(j1939_signal_decode(db, (j1939_message_t *)&m, values, nullptr), 3);
+  m.id = 0x18FEF100U;
+  EXPECT_EQ(j1939_signal_decode(db, (j1939_message_t *)&m, values, nullptr), 0);
+
+  /* columnar decode agrees with the per frame decoder */
+  std::vector<j1939_static_message_t> frames(1000);
+  for (size_t idx = 0; idx < frames.size(); ++idx) {
+    frames[idx] = { .id = 0x0CF00400U, .size = 8, .data = {(uint8_t)(idx % 16), 0xFF, (uint8_t)idx, (uint8_t)idx, (uint8_t)(idx >> 3), 0xFF, 0xFF, 0xFF}, };
+  }
+  std::vector<float> columns[3];
+  for (auto &column : columns)
+    column.resize(frames.size());
+  float *outputs[] = {columns[0].data(), columns[1].data(), columns[2].data()};
+  ASSERT_EQ(j1939_signal_decode_columns(db, 0xF004, frames[0].data, sizeof(j1939_static_message_t), 8, frames.size(), outputs, nullptr), 3);
+  for (size_t idx = 0; idx < frames.size(); ++idx) {
+    j1939_signal_decode(db, (j1939_message_t *)&frames[idx], values, nullptr);
+    for (int k = 0; k < 3; ++k) {
+      if (std::isnan(values[k]))
+        EXPECT_TRUE(std::isnan(columns[k][idx]));
+      else
+        EXPECT_EQ(values[k], columns[k][idx]);
+    }
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  for (int round = 0; round < 100; ++round)
+    j1939_signal_decode_columns(db, 0xF004, frames[0].data, sizeof(j1939_static_message_t), 8, frames.size(), outputs, nullptr);
+  auto end = std::chrono::steady_clock::now();
+  printf("columnar decode %.1f ns/signal\n", std::chrono::duration<double, std::nano>(end - begin).count() / (100 * frames.size() * 3));
+
+  j1939_signal_db_delete(db);
+}
+
+TEST(j1939, signal_dbc) {
+  std::string path = testing::TempDir() + "j1939_signal.dbc";
+  FILE *file = fopen(path.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fputs("VERSION \"\"\n\n", file);
+  fputs("BO_ 2364540158 EEC1: 8 Vector__XXX\n", file);
+  fputs(" SG_ EngineSpeed : 24|16@1+ (0.125,0) [0|8031.875] \"rpm\" Vector__XXX\n", file);
+  fputs(" SG_ ActualEnginePercentTorque : 16|8@1+ (1,-125) [-125|125] \"%\" Vector__XXX\n", file);
+  fputs(" SG_ Motorola : 7|8@0+ (1,0) [0|255] \"\" Vector__XXX\n", file);
+  fputs("\n", file);
+  fputs("BA_ \"SPN\" SG_ 2364540158 EngineSpeed 190;\n", file);
+  fputs("BA_ \"SPN\" SG_ 2364540158 ActualEnginePercentTorque 513;\n", file);
+  fclose(file);
+
+  file = fopen(path.c_str(), "r");
+  j1939_signal_db_t *db = j1939_signal_db_load(file);
+  fclose(file);
+  ASSERT_NE(db, nullptr);
+
+  const j1939_spn_t *spns;
+  ASSERT_EQ(j1939_signal_list(db, 0xF004, &spns), 2);
+  EXPECT_EQ(spns[0].spn, 513U);
+  EXPECT_EQ(spns[1].spn, 190U);
+  EXPECT_STREQ(spns[1].name, "EngineSpeed");
+  EXPECT_EQ(spns[0].offset, -125);
+
+  j1939_static_message_t m = { .id = 0x0CF00400U, .size = 8, .data = {0xF3, 0xFF, 175, 0x40, 0x1F, 0xFF, 0xFF, 0xFF}, };
+  float values[2];
+  ASSERT_EQ(j1939_signal_decode(db, (j1939_message_t *)&m, values, nullptr), 2);
+  EXPECT_EQ(values[0], 50);
+  EXPECT_EQ(values[1], 1000);
+
+  j1939_signal_db_delete(db);
+  remove(path.c_str());
+}
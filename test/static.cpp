@@ -0,0 +1,121 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_handle.h"
+#include "src/j1939_tp.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <vector>
+
+static auto collect_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ((std::vector<std::vector<uint8_t>> *)arg)->emplace_back(msg->data, msg->data + msg->size);
+};
+
+static std::vector<std::vector<uint8_t>> inbox;
+
+#if J1939_STATIC
+/* the largest transport message a pool buffer holds */
+static const size_t largest = J1939_SIZE_TP_BUFFER;
+#else
+static const size_t largest = J1939_TP_MAX_MSG_SIZE;
+#endif /* J1939_STATIC */
+
+J1939_DEFINE_HANDLE(engine, .self_address = 0x00, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x90, .arg = &inbox);
+J1939_DEFINE_HANDLE(tester, .self_address = 0x17, .recv_cb = nullptr, .timeout_cb = nullptr, .port = (j1939_port_t *)0x92, .arg = nullptr);
+J1939_DEFINE_HANDLE(listener, .self_address = J1939_ADDRESS_NULL, .recv_cb = nullptr, .timeout_cb = nullptr, .port = (j1939_port_t *)0x91, .arg = nullptr);
+
+TEST(j1939, static_handle) {
+  /* no address of its own, it listens only */
+  ASSERT_EQ(listener_init(), &listener_storage);
+  EXPECT_EQ(j1939_tx_status(&listener_storage, 0x00), J1939_ERROR);
+  EXPECT_EQ(j1939_deinit(&listener_storage), J1939_OK);
+  j1939_t *handle = engine_init();
+  ASSERT_NE(handle, nullptr);
+  j1939_t *tester = tester_init();
+  ASSERT_NE(tester, nullptr);
+  j1939_virtual_set_trace(0);
+
+  /* a transport message into the static handle, it reassembles like any other */
+  std::vector<uint8_t> data(std::min<size_t>(100, largest), 0x5A);
+  ASSERT_EQ(j1939_transmit(tester, j1939_message_create(0x18EF0017U, data.data(), data.size()), 0), J1939_OK);
+  for (int round = 0; round < 100 && (j1939_status(handle) == J1939_BUSY || j1939_status(tester) == J1939_BUSY); ++round) {
+    while (j1939_receive(tester, 0) != J1939_TIMEOUT);
+    while (j1939_receive(handle, 0) != J1939_TIMEOUT);
+    j1939_tp_cm_transmit_manager(tester, 0);
+    j1939_tp_cm_transmit_manager(handle, 0);
+  }
+  ASSERT_EQ(inbox.size(), 1U);
+  EXPECT_EQ(inbox[0], data);
+
+  /* the storage can be set up again once released */
+  EXPECT_EQ(j1939_deinit(handle), J1939_OK);
+  EXPECT_EQ(engine_init(), handle);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+  EXPECT_EQ(j1939_deinit(handle), J1939_OK);
+  j1939_virtual_set_trace(1);
+  j1939_deinit(tester);
+}
+
+#if J1939_STATIC
+/* a raw node on the bus, it announces transport messages and sees whether the handle clears them */
+static j1939_port_t *const peer = (j1939_port_t *)0x93;
+
+static size_t announce(j1939_t *handle, uint16_t size) {
+  j1939_static_message_t m = { .id = 0x1CEC0017U, .size = J1939_SIZE_DATAFIELD, .data = {J1939_CONTROL_RTS, (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)((size + 6) / 7), 0xFF, 0x00, 0xEF, 0x00}, };
+  j1939_virtual_transmit(peer, &m, 0);
+  while (j1939_receive(handle, 0) != J1939_TIMEOUT);
+  j1939_tp_cm_transmit_manager(handle, 0);
+  size_t cts = 0;
+  while (j1939_virtual_receive(peer, &m, 0) == J1939_OK)
+    cts += m.pdu.pdu_format == 0xEC && m.data[0] == J1939_CONTROL_CTS;
+  return cts;
+}
+
+TEST(j1939, static_pool) {
+  j1939_t *handle = engine_init();
+  ASSERT_NE(handle, nullptr);
+  j1939_virtual_add_node(peer);
+  j1939_virtual_set_trace(0);
+
+  /* every buffer taken, messages and incoming sessions are refused until one is given back */
+  std::vector<j1939_message_t *> taken;
+  for (uint8_t idx = 0; idx < J1939_SIZE_MESSAGE; ++idx) {
+    taken.push_back(j1939_message_create(0x18EF0017U, nullptr, J1939_SIZE_TP_BUFFER));
+    ASSERT_NE(taken.back(), nullptr);
+  }
+  EXPECT_EQ(j1939_message_create(0x18EF0017U, nullptr, J1939_SIZE_DATAFIELD + 1), nullptr);
+  EXPECT_EQ(announce(handle, J1939_SIZE_DATAFIELD + 1), 0U);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+  j1939_message_delete(taken.back());
+  taken.pop_back();
+
+  /* a message larger than a buffer is refused with buffers to spare */
+  EXPECT_EQ(j1939_message_create(0x18EF0017U, nullptr, J1939_SIZE_TP_BUFFER + 1), nullptr);
+  EXPECT_EQ(announce(handle, J1939_SIZE_TP_BUFFER + 1), 0U);
+  EXPECT_EQ(announce(handle, J1939_SIZE_TP_BUFFER), 1U);
+  EXPECT_EQ(j1939_status(handle), J1939_BUSY);
+
+  /* the handle gives its buffer back */
+  EXPECT_EQ(j1939_deinit(handle), J1939_OK);
+  taken.push_back(j1939_message_create(0x18EF0017U, nullptr, J1939_SIZE_TP_BUFFER));
+  EXPECT_NE(taken.back(), nullptr);
+  for (j1939_message_t *msg : taken)
+    j1939_message_delete(msg);
+  j1939_virtual_remove_node(peer);
+  j1939_virtual_set_trace(1);
+}
+#endif /* J1939_STATIC */
@@ -0,0 +1,82 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "gtest/gtest.h"
+
+static auto count_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ++((int *)arg)[msg->pdu.pdu_specific & 0x03];
+};
+
+TEST(j1939, subscription) {
+  int count[4] = {0};
+  j1939_config_t config[] = {
+    {
+      .self_address = 0x20,
+      .recv_cb = nullptr,
+      .timeout_cb = nullptr,
+      .port = (j1939_port_t *)0x20,
+      .arg = nullptr,
+    },
+    {
+      .self_address = 0x21,
+      .recv_cb = count_cb,
+      .timeout_cb = nullptr,
+      .port = (j1939_port_t *)0x21,
+      .arg = count,
+    },
+  };
+  j1939_t *bus[] = {j1939_create(&config[0]), j1939_create(&config[1])};
+
+  /* byte 7 is a rolling counter and must not count as a change */
+  j1939_subscription_t on_change = { .pgn = 0xFEF0, .source_address = 0xFF, .ignore_mask = 0x80, .mode = J1939_DELIVERY_ON_CHANGE, .interval_ms = 0, };
+  j1939_subscription_t rate_limit = { .pgn = 0xFEF1, .source_address = 0x20, .ignore_mask = 0x00, .mode = J1939_DELIVERY_RATE_LIMIT, .interval_ms = 1000, };
+  ASSERT_EQ(j1939_subscribe(bus[1], &on_change), J1939_OK);
+  ASSERT_EQ(j1939_subscribe(bus[1], &rate_limit), J1939_OK);
+
+  for (uint8_t idx = 0; idx < 8; ++idx) {
+    j1939_static_message_t m[] = {
+      { .id = 0x18FEF020U, .size = 8, .data = {1, 2, 3, 4, 5, 6, (uint8_t)(idx < 4 ? 0 : 1), idx}, },
+      { .id = 0x18FEF120U, .size = 8, .data = {1, 2, 3, 4, 5, 6, 7, idx}, },
+      { .id = 0x18FEF220U, .size = 8, .data = {1, 2, 3, 4, 5, 6, 7, 8}, },
+    };
+    for (auto &msg : m) {
+      j1939_transmit_static(bus[0], &msg, 0);
+      j1939_receive(bus[1], 0);
+    }
+  }
+
+  EXPECT_EQ(count[0], 2);
+  EXPECT_EQ(count[1], 1);
+  EXPECT_EQ(count[2], 8);
+
+  EXPECT_EQ(j1939_unsubscribe(bus[1], 0xFEF0, 0x20), J1939_ERROR);
+  EXPECT_EQ(j1939_unsubscribe(bus[1], 0xFEF0, 0xFF), J1939_OK);
+
+  /* the exact source takes its own mode even though the wildcard was subscribed first */
+  j1939_subscription_t wildcard = { .pgn = 0xFEF3, .source_address = 0xFF, .ignore_mask = 0x00, .mode = J1939_DELIVERY_ALWAYS, .interval_ms = 0, };
+  j1939_subscription_t exact = { .pgn = 0xFEF3, .source_address = 0x20, .ignore_mask = 0x00, .mode = J1939_DELIVERY_ON_CHANGE, .interval_ms = 0, };
+  ASSERT_EQ(j1939_subscribe(bus[1], &wildcard), J1939_OK);
+  ASSERT_EQ(j1939_subscribe(bus[1], &exact), J1939_OK);
+  for (uint8_t idx = 0; idx < 4; ++idx) {
+    j1939_static_message_t m = { .id = 0x18FEF320U, .size = 8, .data = {1, 2, 3, 4, 5, 6, 7, 8}, };
+    j1939_transmit_static(bus[0], &m, 0);
+    j1939_receive(bus[1], 0);
+  }
+  EXPECT_EQ(count[3], 1);
+
+  j1939_delete(bus[0]);
+  j1939_delete(bus[1]);
+}
@@ -0,0 +1,348 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_handle.h"
+#include "src/j1939_port.h"
+#include "src/j1939_tp.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct delivery_t {
+  uint8_t sa;
+  std::vector<uint8_t> data;
+};
+
+static auto collect_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  ((std::vector<delivery_t> *)arg)->push_back({(uint8_t)msg->pdu.source_address, std::vector<uint8_t>(msg->data, msg->data + msg->size)});
+};
+
+#if J1939_STATIC
+/* j1939_create is compiled out, handles live in storage of the test, a free slot has no port */
+static struct j1939 storage[2];
+
+static j1939_t *create(j1939_config_t *config) {
+  for (struct j1939 &slot : storage) {
+    if (slot.port != nullptr)
+      continue;
+    if (j1939_init(&slot, config) == J1939_OK)
+      return &slot;
+    slot.port = nullptr;
+    break;
+  }
+  return nullptr;
+}
+
+static void destroy(j1939_t *handle) {
+  j1939_deinit(handle);
+  handle->port = nullptr;
+}
+#else
+static j1939_t *create(j1939_config_t *config) {
+  return j1939_create(config);
+}
+
+static void destroy(j1939_t *handle) {
+  j1939_delete(handle);
+}
+#endif /* J1939_STATIC */
+
+/* a second local address sends while the first receives, profiles with one address use the first for both */
+static const uint8_t second = J1939_SIZE_ADDRESS > 1 ? 0x81 : 0x80;
+
+/* a raw node on the bus, it sends whatever it is told and sees what the handle answers */
+static j1939_port_t *const peer = (j1939_port_t *)0x4F;
+
+static void inject(uint8_t pf, uint8_t da, uint8_t sa, std::vector<uint8_t> data, uint8_t size = J1939_SIZE_DATAFIELD) {
+  j1939_static_message_t m = { .id = 0x1C000000U | pf << 16 | da << 8 | sa, .size = size, .data = {0}, };
+  memcpy(m.data, data.data(), std::min<size_t>(data.size(), sizeof(m.data)));
+  j1939_virtual_transmit(peer, &m, 0);
+}
+
+static std::vector<uint8_t> announce(uint8_t control, uint16_t size, uint8_t packets, uint8_t max_packets, uint32_t pgn) {
+  return {control, (uint8_t)size, (uint8_t)(size >> 8), packets, max_packets, (uint8_t)pgn, (uint8_t)(pgn >> 8), (uint8_t)(pgn >> 16)};
+}
+
+static std::vector<uint8_t> cts(uint8_t packets, uint8_t next, uint32_t pgn) {
+  return {J1939_CONTROL_CTS, packets, next, 0xFF, 0xFF, (uint8_t)pgn, (uint8_t)(pgn >> 8), (uint8_t)(pgn >> 16)};
+}
+
+static std::vector<uint8_t> abort_frame(uint32_t pgn) {
+  return {J1939_CONTROL_ABORT, 1, 0xFF, 0xFF, 0xFF, (uint8_t)pgn, (uint8_t)(pgn >> 8), (uint8_t)(pgn >> 16)};
+}
+
+static void send_dt(uint8_t da, uint8_t sa, uint8_t packets) {
+  for (uint8_t seq = 1; seq <= packets; ++seq)
+    inject(0xEB, da, sa, {seq, seq, seq, seq, seq, seq, seq, seq});
+}
+
+static void run(j1939_t *handle) {
+  while (j1939_receive(handle, 0) != J1939_TIMEOUT);
+  j1939_tp_cm_transmit_manager(handle, 0);
+}
+
+/* transport frames the handle put on the bus since the last call, by control byte or DT */
+static size_t answered(uint8_t control, uint8_t da) {
+  j1939_static_message_t m;
+  size_t count = 0;
+  while (j1939_virtual_receive(peer, &m, 0) == J1939_OK) {
+    if (m.pdu.pdu_specific == da && (m.pdu.pdu_format == 0xEB ? control == 0 : m.data[0] == control))
+      ++count;
+  }
+  return count;
+}
+
+TEST(j1939, tp_malformed) {
+  std::vector<delivery_t> delivered;
+  j1939_config_t config = { .self_address = 0x80, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x40, .arg = &delivered, };
+  j1939_t *handle = create(&config);
+  if (second != 0x80) {
+    ASSERT_EQ(j1939_add_address(handle, second, collect_cb, &delivered), J1939_OK);
+  }
+  j1939_virtual_add_node(peer);
+  j1939_virtual_set_trace(0);
+
+  /* announcements that do not describe a transport message open no session */
+  inject(0xEC, 0x80, 0x20, announce(J1939_CONTROL_RTS, 0xFFFF, 0xFF, 0xFF, 0xEF00));
+  inject(0xEC, 0x80, 0x20, announce(J1939_CONTROL_RTS, 20, 10, 0xFF, 0xEF00));
+  inject(0xEC, 0x80, 0x20, announce(J1939_CONTROL_RTS, 20, 3, 0, 0xEF00));
+  inject(0xEC, 0xFF, 0x20, announce(J1939_CONTROL_RTS, 20, 3, 0xFF, 0xFEE0));
+  inject(0xEC, 0xFF, 0x20, announce(J1939_CONTROL_BAM, 5, 1, 0xFF, 0xFEE0));
+  inject(0xEC, 0xFF, 0x20, announce(J1939_CONTROL_BAM, 0, 0, 0xFF, 0xFEE0));
+  inject(0xEC, 0x80, 0x20, announce(J1939_CONTROL_BAM, 20, 3, 0xFF, 0xFEE0));
+  inject(0xEC, 0xFF, 0x20, announce(J1939_CONTROL_BAM, 20, 3, 0xFF, 0xFEE0), 7);
+  run(handle);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+  EXPECT_EQ(answered(J1939_CONTROL_CTS, 0x20), 0U);
+  send_dt(0x80, 0x20, 10);
+  send_dt(0xFF, 0x20, 10);
+  run(handle);
+  EXPECT_TRUE(delivered.empty());
+
+  /* no CAN frame is longer than a data field */
+  inject(0xFE, 0xF1, 0x20, {1, 2, 3, 4, 5, 6, 7, 8}, 12);
+  EXPECT_EQ(j1939_receive(handle, 0), J1939_ERROR);
+  EXPECT_TRUE(delivered.empty());
+
+  /* a broadcast in progress belongs to its sender, only the sender may restart it */
+  inject(0xEC, 0xFF, 0x20, announce(J1939_CONTROL_BAM, 20, 3, 0xFF, 0xFEE0));
+  inject(0xEC, 0xFF, 0x21, announce(J1939_CONTROL_BAM, 20, 3, 0xFF, 0xFEE0));
+  inject(0xEC, 0xFF, 0x21, abort_frame(0xFEE0));
+  send_dt(0xFF, 0x21, 3);
+  run(handle);
+  EXPECT_EQ(j1939_status(handle), J1939_BUSY);
+  EXPECT_TRUE(delivered.empty());
+  inject(0xEC, 0xFF, 0x20, announce(J1939_CONTROL_BAM, 15, 3, 0xFF, 0xFEE0));
+  send_dt(0xFF, 0x20, 3);
+  run(handle);
+  ASSERT_EQ(delivered.size(), 1U);
+  EXPECT_EQ(delivered[0].sa, 0x20);
+  EXPECT_EQ(delivered[0].data.size(), 15U);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+  delivered.clear();
+
+  /* CTS and abort count from the destination of the session only */
+  std::vector<uint8_t> data(30, 0x5A);
+  ASSERT_EQ(j1939_transmit(handle, j1939_message_create(0x18EF3000U | second, data.data(), data.size()), 0), J1939_OK);
+  EXPECT_EQ(answered(J1939_CONTROL_RTS, 0x30), 1U);
+  inject(0xEC, second, 0x31, cts(5, 1, 0xEF00));
+  inject(0xEC, second, 0x30, cts(5, 2, 0xEF00));
+  inject(0xEC, second, 0x31, abort_frame(0xEF00));
+  run(handle);
+  EXPECT_EQ(answered(0, 0x30), 0U);
+  EXPECT_EQ(j1939_status(handle), J1939_BUSY);
+  inject(0xEC, second, 0x30, abort_frame(0xEF00));
+  run(handle);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+
+  /* a CTS asking for more than is left is cut to the rest */
+  ASSERT_EQ(j1939_transmit(handle, j1939_message_create(0x18EF3000U | second, data.data(), data.size()), 0), J1939_OK);
+  inject(0xEC, second, 0x30, cts(200, 1, 0xEF00));
+  for (uint8_t packet = 0; packet < 10; ++packet)
+    run(handle);
+  EXPECT_EQ(answered(0, 0x30), 5U);
+  inject(0xEC, second, 0x30, announce(J1939_CONTROL_ACK, 30, 5, 0xFF, 0xEF00));
+  run(handle);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+
+  /* a receive session whose sender went silent is taken over after T1 */
+  inject(0xEC, 0x80, 0x40, announce(J1939_CONTROL_RTS, 20, 3, 0xFF, 0xEF00));
+  run(handle);
+  EXPECT_EQ(answered(J1939_CONTROL_CTS, 0x40), 1U);
+  inject(0xEC, 0x80, 0x41, announce(J1939_CONTROL_RTS, 20, 3, 0xFF, 0xEF00));
+  run(handle);
+  EXPECT_EQ(answered(J1939_CONTROL_CTS, 0x41), 0U);
+  for (uint32_t tick = 0; tick < J1939_TIMEOUT_T1; ++tick)
+    j1939_port_get_tick();
+  inject(0xEC, 0x80, 0x41, announce(J1939_CONTROL_RTS, 20, 3, 0xFF, 0xEF00));
+  run(handle);
+  EXPECT_EQ(answered(J1939_CONTROL_CTS, 0x41), 1U);
+  send_dt(0x80, 0x41, 3);
+  run(handle);
+  ASSERT_EQ(delivered.size(), 1U);
+  EXPECT_EQ(delivered[0].sa, 0x41);
+  EXPECT_EQ(answered(J1939_CONTROL_ACK, 0x41), 1U);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+
+  j1939_virtual_remove_node(peer);
+  j1939_virtual_set_trace(1);
+  destroy(handle);
+}
+
+TEST(j1939, tp_timeout) {
+  std::vector<delivery_t> timed_out;
+  j1939_config_t config = { .self_address = 0x80, .recv_cb = nullptr, .timeout_cb = collect_cb, .port = (j1939_port_t *)0x42, .arg = &timed_out, };
+  j1939_t *handle = create(&config);
+  j1939_virtual_add_node(peer);
+  j1939_virtual_set_trace(0);
+  std::vector<uint8_t> data(30, 0x5A);
+
+  /* no CTS after the RTS, the session is aborted after T3 and reported to timeout_cb */
+  ASSERT_EQ(j1939_transmit(handle, j1939_message_create(0x18EF3080U, data.data(), data.size()), 0), J1939_OK);
+  EXPECT_EQ(answered(J1939_CONTROL_RTS, 0x30), 1U);
+  EXPECT_GT(j1939_tp_next_deadline(handle), 0U);
+  for (uint32_t tick = 0; tick < J1939_TIMEOUT_T3; ++tick)
+    j1939_port_get_tick();
+  EXPECT_EQ(j1939_tp_next_deadline(handle), 0U);
+  EXPECT_EQ(j1939_tp_cm_transmit_manager(handle, 0), J1939_TIMEOUT);
+  EXPECT_EQ(answered(J1939_CONTROL_ABORT, 0x30), 1U);
+  ASSERT_EQ(timed_out.size(), 1U);
+  EXPECT_EQ(timed_out[0].sa, 0x80);
+  EXPECT_EQ(timed_out[0].data, data);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+
+  /* a connection held open by CTS for zero packets lasts T4 */
+  ASSERT_EQ(j1939_transmit(handle, j1939_message_create(0x18EF3080U, data.data(), data.size()), 0), J1939_OK);
+  inject(0xEC, 0x80, 0x30, cts(0, 1, 0xEF00));
+  run(handle);
+  for (uint32_t tick = 0; tick < J1939_TIMEOUT_T4; ++tick)
+    j1939_port_get_tick();
+  EXPECT_EQ(j1939_tp_cm_transmit_manager(handle, 0), J1939_TIMEOUT);
+  EXPECT_EQ(answered(J1939_CONTROL_ABORT, 0x30), 1U);
+  EXPECT_EQ(timed_out.size(), 2U);
+
+  /* every packet sent but no ACK */
+  ASSERT_EQ(j1939_transmit(handle, j1939_message_create(0x18EF3080U, data.data(), data.size()), 0), J1939_OK);
+  inject(0xEC, 0x80, 0x30, cts(5, 1, 0xEF00));
+  for (uint8_t packet = 0; packet < 6; ++packet)
+    run(handle);
+  EXPECT_EQ(answered(0, 0x30), 5U);
+  EXPECT_EQ(j1939_status(handle), J1939_BUSY);
+  for (uint32_t tick = 0; tick < J1939_TIMEOUT_T3; ++tick)
+    j1939_port_get_tick();
+  EXPECT_EQ(j1939_tp_cm_transmit_manager(handle, 0), J1939_TIMEOUT);
+  EXPECT_EQ(timed_out.size(), 3U);
+  EXPECT_EQ(answered(J1939_CONTROL_ABORT, 0x30), 1U);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+
+  /* a BAM whose sender went silent is dropped after T1, a broadcast is not aborted */
+  inject(0xEC, 0xFF, 0x30, announce(J1939_CONTROL_BAM, 20, 3, 0xFF, 0xFEE0));
+  send_dt(0xFF, 0x30, 1);
+  run(handle);
+  EXPECT_EQ(j1939_status(handle), J1939_BUSY);
+  EXPECT_GT(j1939_tp_next_deadline(handle), 0U);
+  for (uint32_t tick = 0; tick < J1939_TIMEOUT_T1; ++tick)
+    j1939_port_get_tick();
+  EXPECT_EQ(j1939_tp_next_deadline(handle), 0U);
+  EXPECT_EQ(j1939_tp_cm_transmit_manager(handle, 0), J1939_TIMEOUT);
+  EXPECT_EQ(answered(J1939_CONTROL_ABORT, 0x30), 0U);
+  ASSERT_EQ(timed_out.size(), 4U);
+  EXPECT_EQ(timed_out[3].sa, 0x30);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+
+  /* the sender has T2 for the first packet after a CTS */
+  inject(0xEC, 0x80, 0x30, announce(J1939_CONTROL_RTS, 20, 3, 0xFF, 0xEF00));
+  run(handle);
+  EXPECT_EQ(answered(J1939_CONTROL_CTS, 0x30), 1U);
+  for (uint32_t tick = 0; tick < J1939_TIMEOUT_T1; ++tick)
+    j1939_port_get_tick();
+  EXPECT_NE(j1939_tp_cm_transmit_manager(handle, 0), J1939_TIMEOUT);
+  for (uint32_t tick = J1939_TIMEOUT_T1; tick < J1939_TIMEOUT_T2; ++tick)
+    j1939_port_get_tick();
+  EXPECT_EQ(j1939_tp_cm_transmit_manager(handle, 0), J1939_TIMEOUT);
+  EXPECT_EQ(answered(J1939_CONTROL_ABORT, 0x30), 1U);
+  EXPECT_EQ(timed_out.size(), 5U);
+
+  /* and T1 between packets */
+  inject(0xEC, 0x80, 0x30, announce(J1939_CONTROL_RTS, 20, 3, 0xFF, 0xEF00));
+  run(handle);
+  send_dt(0x80, 0x30, 1);
+  run(handle);
+  for (uint32_t tick = 0; tick < J1939_TIMEOUT_T1; ++tick)
+    j1939_port_get_tick();
+  EXPECT_EQ(j1939_tp_cm_transmit_manager(handle, 0), J1939_TIMEOUT);
+  EXPECT_EQ(answered(J1939_CONTROL_ABORT, 0x30), 1U);
+  EXPECT_EQ(timed_out.size(), 6U);
+  EXPECT_EQ(j1939_status(handle), J1939_OK);
+
+  /* the address is free for the next message */
+  ASSERT_EQ(j1939_transmit(handle, j1939_message_create(0x18EF3080U, data.data(), data.size()), 0), J1939_OK);
+  EXPECT_EQ(answered(J1939_CONTROL_RTS, 0x30), 1U);
+
+  j1939_virtual_remove_node(peer);
+  j1939_virtual_set_trace(1);
+  destroy(handle);
+}
+
+TEST(j1939, tp_random) {
+  std::vector<delivery_t> delivered;
+  j1939_config_t config = { .self_address = 0x80, .recv_cb = collect_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0x41, .arg = &delivered, };
+  j1939_t *handle = create(&config);
+  if (second != 0x80) {
+    ASSERT_EQ(j1939_add_address(handle, second, collect_cb, &delivered), J1939_OK);
+  }
+  j1939_virtual_set_trace(0);
+
+  /* transport frames with plausible headers and arbitrary fields, sessions in every state */
+  std::mt19937 rng(1939);
+  const uint8_t controls[] = {J1939_CONTROL_RTS, J1939_CONTROL_CTS, J1939_CONTROL_ACK, J1939_CONTROL_BAM, J1939_CONTROL_ABORT};
+  const uint8_t addresses[] = {0x80, second, 0xFF, 0x20};
+  std::vector<uint8_t> data(100, 0xA5);
+  for (uint32_t round = 0; round < 20000; ++round) {
+    std::vector<uint8_t> frame(8);
+    for (uint8_t &byte : frame)
+      byte = rng();
+    if (rng() % 2)
+      frame[0] = controls[rng() % 5];
+    else
+      frame[0] = frame[0] % 20 + 1;
+    inject(rng() % 2 ? 0xEC : 0xEB, addresses[rng() % 4], 0x20 + rng() % 3, frame, rng() % 8 ? 8 : rng() % 16);
+    run(handle);
+    if (rng() % 64 == 0) {
+      j1939_message_t *msg = j1939_message_create(0x18EF2000U | (rng() % 2 ? second : 0x80), data.data(), 9 + rng() % 90);
+      /* static pools refuse what does not fit */
+      if (msg && j1939_transmit(handle, msg, 0) != J1939_OK)
+        j1939_message_delete(msg);
+    }
+  }
+  for (const delivery_t &msg : delivered)
+    EXPECT_LE(msg.data.size(), (size_t)J1939_TP_MAX_MSG_SIZE);
+
+  /* whatever state the sessions were left in, a well formed broadcast gets through after T1 */
+  delivered.clear();
+  for (uint32_t tick = 0; tick < J1939_TIMEOUT_T1; ++tick)
+    j1939_port_get_tick();
+  inject(0xEC, 0xFF, 0x30, announce(J1939_CONTROL_BAM, 20, 3, 0xFF, 0xFEE0));
+  send_dt(0xFF, 0x30, 3);
+  run(handle);
+  ASSERT_EQ(delivered.size(), 1U);
+  EXPECT_EQ(delivered[0].sa, 0x30);
+
+  j1939_virtual_set_trace(1);
+  destroy(handle);
+}
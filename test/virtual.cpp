@@ -0,0 +1,48 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_virtual.h"
+#include "gtest/gtest.h"
+
+TEST(j1939, virtual_bus) {
+  j1939_virtual_set_trace(0);
+
+  /* acceptance filters are applied before anything is copied, the cost per node is measured by
+   * tools/bench_virtual.cpp */
+  j1939_port_t *port[] = {(j1939_port_t *)0x50, (j1939_port_t *)0x51};
+  j1939_virtual_add_node(port[0]);
+  j1939_virtual_add_node(port[1]);
+  j1939_filter_t filter = { .id = 0x00FEF100U, .mask = 0x00FFFF00U, };
+  ASSERT_EQ(j1939_virtual_set_filter(port[1], &filter, 1), J1939_OK);
+
+  j1939_static_message_t m[] = {
+    { .id = 0x18FEF050U, .size = 8, .data = {0}, },
+    { .id = 0x18FEF150U, .size = 8, .data = {1}, },
+  };
+  j1939_virtual_transmit(port[0], &m[0], 0);
+  j1939_virtual_transmit(port[0], &m[1], 0);
+
+  j1939_static_message_t msg;
+  ASSERT_EQ(j1939_virtual_receive(port[1], &msg, 0), J1939_OK);
+  EXPECT_EQ(msg.id, 0x18FEF150U);
+  EXPECT_EQ(j1939_virtual_receive(port[1], &msg, 0), J1939_TIMEOUT);
+  EXPECT_EQ(j1939_virtual_receive(port[0], &msg, 0), J1939_TIMEOUT);
+
+  j1939_virtual_remove_node(port[0]);
+  j1939_virtual_remove_node(port[1]);
+  EXPECT_EQ(j1939_virtual_receive(port[1], &msg, 0), J1939_ERROR);
+  j1939_virtual_set_trace(1);
+}
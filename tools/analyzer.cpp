@@ -0,0 +1,66 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "src/j1939_analyzer.h"
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+static const char *events[] = {"complete", "abort", "timeout", "restart"};
+
+static auto print_cb = +[](const j1939_analyzer_message_t *msg, void *arg) {
+  ++*(uint64_t *)arg;
+  printf("(%llu.%06llu) ch [%u] sa [%02X] da [%02X] pgn [%05X] size [%u] packets [%u/%u] %s",
+         (unsigned long long)(msg->timestamp_us / 1000000), (unsigned long long)(msg->timestamp_us % 1000000),
+         msg->channel, msg->source_address, msg->destination_address, msg->pgn, msg->size,
+         msg->received_packets, msg->total_packets, events[msg->event]);
+  if (msg->event == J1939_ANALYZER_ABORT)
+    printf(" reason [%u]", msg->abort_reason);
+  printf(" data [");
+  for (uint16_t idx = 0; idx < msg->size; ++idx)
+    printf("%02X%s", msg->data[idx], idx == msg->size - 1 ? "" : " ");
+  printf("]\n");
+};
+
+/* j1939_analyzer <binary log | candump -l file> [threads] */
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <binary log | candump -l file> [threads]\n", argv[0]);
+    return 1;
+  }
+
+  std::string path = argv[1];
+  j1939_log_t *log = j1939_log_open(path.c_str());
+  if (log == nullptr) {
+    /* not a binary log, convert the candump text next to it first */
+    FILE *candump = fopen(argv[1], "r");
+    path += ".j1939";
+    j1939_recorder_t *recorder = candump ? j1939_recorder_create(path.c_str(), 0) : nullptr;
+    if (recorder == nullptr || j1939_recorder_import_candump(recorder, candump) != J1939_OK || j1939_recorder_delete(recorder) != J1939_OK || (log = j1939_log_open(path.c_str())) == nullptr) {
+      fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[1]);
+      return 1;
+    }
+    fclose(candump);
+  }
+
+  uint64_t messages = 0;
+  auto begin = std::chrono::steady_clock::now();
+  j1939_analyze(log, argc > 2 ? (uint16_t)atoi(argv[2]) : 0, print_cb, &messages);
+  auto end = std::chrono::steady_clock::now();
+
+  fprintf(stderr, "%llu frames, %llu messages, %.3f s\n", (unsigned long long)j1939_log_count(log), (unsigned long long)messages, std::chrono::duration<double>(end - begin).count());
+  j1939_log_close(log);
+  return 0;
+}
@@ -0,0 +1,52 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_virtual.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+/* Virtual bus benchmark, the cost of a broadcast per frame and receiving node should not grow with the
+ * node count. wall clock ratios do not hold on loaded or sanitized builds, so it is not part of ctest:
+ *   ./j1939_bench_virtual [slack], exits 1 if 256 nodes cost more than slack (default 4) times 2 nodes */
+
+static double bench(uintptr_t nodes, uint32_t frames) {
+  j1939_static_message_t m = { .id = 0x18FEF100U, .size = 8, .data = {0}, };
+  for (uintptr_t idx = 0; idx < nodes; ++idx)
+    j1939_virtual_add_node((j1939_port_t *)(0x1000 + idx));
+
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t frame = 0; frame < frames; ++frame) {
+    j1939_virtual_transmit((j1939_port_t *)0x1000, &m, 0);
+    for (uintptr_t idx = 1; idx < nodes; ++idx)
+      j1939_virtual_receive((j1939_port_t *)(0x1000 + idx), &m, 0);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  for (uintptr_t idx = 0; idx < nodes; ++idx)
+    j1939_virtual_remove_node((j1939_port_t *)(0x1000 + idx));
+  return std::chrono::duration<double, std::nano>(end - begin).count() / frames / (nodes - 1);
+}
+
+int main(int argc, char **argv) {
+  double slack = argc > 1 ? atof(argv[1]) : 4;
+  j1939_virtual_set_trace(0);
+
+  double cost[] = {bench(2, 20000), bench(16, 20000), bench(64, 5000), bench(256, 2000)};
+  printf("ns per delivered frame: 2 nodes [%.1f] 16 nodes [%.1f] 64 nodes [%.1f] 256 nodes [%.1f]\n", cost[0], cost[1], cost[2], cost[3]);
+
+  return cost[3] > cost[0] * slack ? 1 : 0;
+}
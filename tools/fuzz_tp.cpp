@@ -0,0 +1,119 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "j1939.h"
+#include "src/j1939_port.h"
+#include "src/j1939_tp.h"
+#include "src/j1939_virtual.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/* Transport protocol fuzz target. The input is cut into 12 byte records, each one puts a frame from
+ * a peer on the virtual bus or drives the handle under test, which serves several local addresses:
+ *   op    bits 0-1 frame kind (TP.CM, TP.DT, any other PGN, handle action), bits 2-3 destination,
+ *         bits 4-5 source, bits 6-7 payload length (8, as given, 12, 0)
+ *   arg   PDU format for other PGNs, action selector otherwise
+ *   len   payload length for "as given"
+ *   pad
+ *   data  8 bytes */
+#define FUZZ_RECORD                         12
+
+static const uint8_t destinations[] = {0x80, 0x81, 0x82, J1939_ADDRESS_GLOBAL};
+static const uint8_t sources[] = {0x20, 0x21, 0x30, 0x80};
+
+static uint64_t delivered;
+
+static auto recv_cb = +[](j1939_port_t *port, const j1939_message_t *msg, void *arg) {
+  /* touch every byte, the sanitizers report a message that is shorter than it claims */
+  uint8_t sum = 0;
+  for (uint16_t idx = 0; idx < msg->size; ++idx)
+    sum += msg->data[idx];
+  delivered += sum + 1;
+};
+
+static void action(j1939_t *handle, uint8_t arg, const uint8_t *data) {
+  static std::vector<uint8_t> payload(J1939_TP_MAX_MSG_SIZE, 0xA5);
+  switch (arg % 4) {
+    case 0:
+      j1939_tp_cm_transmit_manager(handle, 0);
+      break;
+    case 1: {
+      /* a transport message of the given size from one local address to a peer, or broadcast */
+      uint16_t size = (data[0] | data[1] << 8) % (J1939_TP_MAX_MSG_SIZE + 1);
+      uint32_t id = 0x18000000U | (data[2] % 2 ? 0xEF00U | sources[data[3] % 3] : 0xFEE0U) << 8 | destinations[data[4] % 3];
+      j1939_message_t *msg = j1939_message_create(id, payload.data(), size);
+      if (msg && (size <= J1939_SIZE_DATAFIELD || j1939_transmit_bam(handle, msg, data[5], 0) != J1939_OK))
+        j1939_message_delete(msg);
+      break;
+    }
+    case 2:
+      /* lets session timers run out */
+      for (uint16_t tick = 0; tick < (data[0] | data[1] << 8) % (J1939_TIMEOUT_T4 + 1); ++tick)
+        j1939_port_get_tick();
+      break;
+    default:
+      j1939_set_tp_window(handle, data[0]);
+      break;
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *input, size_t size) {
+  j1939_port_t *peer = (j1939_port_t *)0xF0;
+  j1939_config_t config = { .self_address = 0x80, .recv_cb = recv_cb, .timeout_cb = nullptr, .port = (j1939_port_t *)0xF1, .arg = nullptr, };
+  j1939_t *handle = j1939_create(&config);
+  j1939_add_address(handle, 0x81, recv_cb, nullptr);
+  j1939_add_address(handle, 0x82, nullptr, nullptr);
+  j1939_virtual_set_trace(0);
+
+  for (; size >= FUZZ_RECORD; input += FUZZ_RECORD, size -= FUZZ_RECORD) {
+    uint8_t op = input[0], arg = input[1];
+    const uint8_t lengths[] = {J1939_SIZE_DATAFIELD, (uint8_t)(input[2] % 16), 12, 0};
+    if ((op & 0x03) == 0x03) {
+      action(handle, arg, &input[4]);
+      continue;
+    }
+    uint8_t pf = (op & 0x03) == 0 ? J1939_PGN_TP_CM >> 8 : (op & 0x03) == 1 ? J1939_PGN_TP_DT >> 8 : arg;
+    j1939_static_message_t m = { .id = 0x1C000000U | pf << 16 | destinations[op >> 2 & 0x03] << 8 | sources[op >> 4 & 0x03], .size = lengths[op >> 6], .data = {0}, };
+    memcpy(m.data, &input[4], J1939_SIZE_DATAFIELD);
+    j1939_virtual_transmit(peer, &m, 0);
+    while (j1939_receive(handle, 0) != J1939_TIMEOUT);
+  }
+
+  j1939_tp_cm_transmit_manager(handle, 0);
+  j1939_delete(handle);
+  return 0;
+}
+
+#ifndef J1939_FUZZ
+/* without libFuzzer the target replays inputs, e.g. a corpus or a crash, given as files */
+int main(int argc, char *argv[]) {
+  for (int idx = 1; idx < argc; ++idx) {
+    FILE *file = fopen(argv[idx], "rb");
+    if (file == nullptr) {
+      fprintf(stderr, "%s: cannot read %s\n", argv[0], argv[idx]);
+      return 1;
+    }
+    std::vector<uint8_t> input;
+    for (int byte; (byte = fgetc(file)) != EOF;)
+      input.push_back(byte);
+    fclose(file);
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+  }
+  printf("%d inputs, %llu delivered\n", argc - 1, (unsigned long long)delivered);
+  return 0;
+}
+#endif /* J1939_FUZZ */
@@ -0,0 +1,23 @@
+/**
+  * Copyright 2022 ShunzDai
+  *
+  * Licensed under the Apache License, Version 2.0 (the "License");
+  * you may not use this file except in compliance with the License.
+  * You may obtain a copy of the License at
+  *
+  *     http://www.apache.org/licenses/LICENSE-2.0
+  *
+  * Unless required by applicable law or agreed to in writing, software
+  * distributed under the License is distributed on an "AS IS" BASIS,
+  * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  * See the License for the specific language governing permissions and
+  * limitations under the License.
+  */
+#include "src/j1939_handle.h"
+
+/* one statically allocated handle, so the size report shows its RAM as .bss */
+J1939_DEFINE_HANDLE(size, .self_address = 0x80, .recv_cb = NULL, .timeout_cb = NULL, .port = NULL, .arg = NULL);
+
+j1939_t *j1939_size_handle(void) {
+  return size_init();
+}